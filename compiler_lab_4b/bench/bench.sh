@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Benchmark the KPL programs in bench/ with and without optimizations
+# Usage: bench/bench.sh [extra kplc options...]
+# bench/NAME.in is the input of bench/NAME.kpl, and bench/NAME.run holds
+# options of kplrun it needs
+
+COMPILER="./kplc"
+KPLRUN="./kplrun"
+BENCH_DIR="./bench"
+OUTPUT_DIR="./output"
+OPTIONS="$*"
+
+if [ -z "$OPTIONS" ]; then
+    OPTIONS="-O"
+fi
+
+mkdir -p "$OUTPUT_DIR"
+
+if [ ! -x "$COMPILER" ] || [ ! -x "$KPLRUN" ]; then
+    make
+fi
+
+TIMEFORMAT=%R
+
+printf "%-12s %-22s %14s %12s %12s %8s %8s\n" "program" "options" "instructions" "jumps" "peak stack" "code" "time(s)"
+for kpl_file in "$BENCH_DIR"/*.kpl; do
+    base_name=$(basename "$kpl_file" .kpl)
+    input_file="$BENCH_DIR/$base_name.in"
+    if [ ! -f "$input_file" ]; then
+        input_file=/dev/null
+    fi
+    # Options of kplrun, such as the stack size, for the program
+    run_options=""
+    if [ -f "$BENCH_DIR/$base_name.run" ]; then
+        run_options=$(cat "$BENCH_DIR/$base_name.run")
+    fi
+
+    reference=""
+    for opt in "" "$OPTIONS"; do
+        output_file="$OUTPUT_DIR/bench-$base_name"
+        $COMPILER "$kpl_file" "$output_file" $opt > /dev/null
+        # The header of the executable holds the size of a word, then the number of instructions
+        code_size=$(od -An -t d4 -j 4 -N 4 "$output_file" | tr -d ' ')
+
+        stats=$($KPLRUN "$output_file" $run_options -stat < "$input_file")
+        result=$(echo "$stats" | grep -v -e "^instructions:" -e "^peak stack:" -e "^  ")
+        count=$(echo "$stats" | sed -n 's/^instructions: //p')
+        peak=$(echo "$stats" | sed -n 's/^peak stack: //p')
+        jumps=$(echo "$stats" | sed -n 's/^  \(J\|FJ\|JT\): //p' | awk '{ s += $1 } END { print s }')
+        seconds=$( { time $KPLRUN "$output_file" $run_options < "$input_file" > /dev/null; } 2>&1 )
+
+        if [ -z "$opt" ]; then
+            reference="$result"
+        elif [ "$result" != "$reference" ]; then
+            echo "$base_name: output differs with $opt"
+        fi
+        printf "%-12s %-22s %14s %12s %12s %8s %8s\n" "$base_name" "${opt:--}" "$count" "${jumps:-0}" "$peak" "$code_size" "$seconds"
+    done
+done
@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+
+// Bounds checks. With -fbounds-check, each index of an array that is not
+// a constant is followed by BC n, n the size of the dimension. A check is
+// removed where the index is known to be in [1, n]:
+//
+//    LC c; BC n                        1 <= c <= n
+//    LV 0,q; [LC d; AD|SB]; BC n       in the body of a FOR statement over
+//                                      (0,q) from LC lo to LC hi, with
+//                                      1 <= lo + d and hi + d <= n
+//
+// The body must not store to the variable nor take its address, and its
+// calls must not write it (see summary.h).
+
+// Tell whether the body of the statement may change its variable
+int changesForVariable(CodeBlock* codeBlock, ForStatement* loop) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+
+  for (i = loop->body; i < loop->latch; i ++)
+    switch (code[i].op) {
+    case OP_LA:
+      if ((code[i].p == 0) && (code[i].q == loop->q)) return TRUE;
+      break;
+    case OP_CALL:
+      if (callWritesVariable(code + i, loop->q)) return TRUE;
+      break;
+    case OP_CS:
+    case OP_TC:
+      return TRUE;
+    default:
+      break;
+    }
+  return FALSE;
+}
+
+// Tell whether lo + d and hi + d, computed without overflow, are in [1, n]
+int isInBounds(WORD lo, WORD hi, long long d, WORD n) {
+  long long first = lo + d, last = hi + d;
+
+  return (first >= 1) && (last <= n);
+}
+
+// Remove the checks of the indexes computed from the variable of the
+// statement in its body
+int eliminateLoopChecks(CodeBlock* codeBlock, ForStatement* loop, char* removed) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+  WORD lo, hi;
+  long long d;
+  int count = 0;
+
+  if ((loop->head - 3 != loop->lo + 1) || (code[loop->lo].op != OP_LC)) return 0;
+  if ((loop->body - 2 != loop->head + 1) || (code[loop->head].op != OP_LC)) return 0;
+  lo = code[loop->lo].q;
+  hi = code[loop->head].q;
+  if ((lo > hi) || changesForVariable(codeBlock, loop)) return 0;
+
+  for (i = loop->body + 1; i < loop->latch; i ++) {
+    if (code[i].op != OP_BC) continue;
+    d = 0;
+    if ((i - 3 >= loop->body) && (code[i - 2].op == OP_LC) &&
+	((code[i - 1].op == OP_AD) || (code[i - 1].op == OP_SB)) &&
+	(code[i - 3].op == OP_LV) && (code[i - 3].p == 0) && (code[i - 3].q == loop->q))
+      d = (code[i - 1].op == OP_AD) ? code[i - 2].q : - (long long) code[i - 2].q;
+    else if ((code[i - 1].op != OP_LV) || (code[i - 1].p != 0) || (code[i - 1].q != loop->q))
+      continue;
+    if (!removed[i] && isInBounds(lo, hi, d, code[i].q)) {
+      removed[i] = TRUE;
+      count ++;
+    }
+  }
+  return count;
+}
+
+int eliminateBoundsChecks(CodeBlock* codeBlock, CodeAddress start) {
+  Instruction* code = codeBlock->code;
+  ForStatement loop;
+  CodeEdits* edits;
+  CodeAddress i;
+  int count = 0;
+
+  edits = createCodeEdits(codeBlock);
+  for (i = start + 1; i < codeBlock->codeSize; i ++) {
+    if ((code[i].op == OP_BC) && (code[i - 1].op == OP_LC) &&
+	(code[i - 1].q >= 1) && (code[i - 1].q <= code[i].q) && !edits->removed[i]) {
+      edits->removed[i] = TRUE;
+      count ++;
+    }
+    if (matchForStatement(codeBlock, i, &loop))
+      count += eliminateLoopChecks(codeBlock, &loop, edits->removed);
+  }
+
+  if ((count > 0) && !applyCodeEdits(codeBlock, edits))
+    count = 0;
+  freeCodeEdits(edits);
+  return count;
+}
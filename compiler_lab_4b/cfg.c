@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cfg.h"
+
+int isBlockTerminator(enum OpCode op) {
+  switch (op) {
+  case OP_J:
+  case OP_FJ:
+  case OP_JT:
+  case OP_HL:
+  case OP_EP:
+  case OP_EF:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+Instruction* lastInstruction(ControlFlowGraph* cfg, int block) {
+  return cfg->codeBlock->code + cfg->blocks[block].end - 1;
+}
+
+// Split [start, end) into basic blocks. Returns NULL when the range cannot
+// be handled as a whole: a jump leaves it, or control falls off its end.
+//
+// Each J of the table of a JT is a block of its own. The JT falls through
+// to the first one, and each one but the last falls through to the next
+// one besides jumping, so that every target of the table is a successor
+// of the JT as far as the analyses are concerned.
+ControlFlowGraph* buildCFG(CodeBlock* codeBlock, CodeAddress start, CodeAddress end) {
+  Instruction* code = codeBlock->code;
+  ControlFlowGraph* cfg;
+  char* isLeader;
+  char* tableEntry;
+  int i, k, n;
+
+  if ((start >= end) || (end > codeBlock->codeSize)) return NULL;
+  switch (code[end - 1].op) {
+  case OP_J:
+  case OP_HL:
+  case OP_EP:
+  case OP_EF:
+    break;
+  default:
+    return NULL;
+  }
+
+  isLeader = (char*) calloc(end - start + 1, 1);
+  tableEntry = (char*) calloc(end - start + 1, 1);
+  isLeader[0] = TRUE;
+  for (i = start; i < end; i ++) {
+    if (code[i].op == OP_JT) {
+      if ((code[i].q < 0) || (i + 1 + code[i].q >= end)) {
+	free(isLeader);
+	free(tableEntry);
+	return NULL;
+      }
+      // 1 for the Js followed by another one, 2 for the last one
+      for (k = 0; k <= code[i].q; k ++) {
+	if (code[i + 1 + k].op != OP_J) {
+	  free(isLeader);
+	  free(tableEntry);
+	  return NULL;
+	}
+	tableEntry[i + 1 + k - start] = (k < code[i].q) ? 1 : 2;
+      }
+    }
+    if ((code[i].op == OP_J) || (code[i].op == OP_FJ)) {
+      if ((code[i].q < start) || (code[i].q >= end)) {
+	free(isLeader);
+	free(tableEntry);
+	return NULL;
+      }
+      isLeader[code[i].q - start] = TRUE;
+    }
+    if (isBlockTerminator(code[i].op))
+      isLeader[i + 1 - start] = TRUE;
+  }
+
+  cfg = (ControlFlowGraph*) malloc(sizeof(ControlFlowGraph));
+  cfg->codeBlock = codeBlock;
+  cfg->start = start;
+  cfg->end = end;
+  cfg->blockOf = (int*) malloc((end - start + 1) * sizeof(int));
+
+  cfg->blockCount = 0;
+  for (i = start; i < end; i ++)
+    if (isLeader[i - start]) cfg->blockCount ++;
+  cfg->blocks = (BasicBlock*) malloc(cfg->blockCount * sizeof(BasicBlock));
+
+  n = -1;
+  for (i = start; i < end; i ++) {
+    if (isLeader[i - start]) {
+      n ++;
+      cfg->blocks[n].start = i;
+    }
+    cfg->blocks[n].end = i + 1;
+    cfg->blockOf[i - start] = n;
+  }
+  cfg->blockOf[end - start] = NO_BLOCK;
+  free(isLeader);
+
+  for (n = 0; n < cfg->blockCount; n ++) {
+    BasicBlock* block = cfg->blocks + n;
+    Instruction* last = lastInstruction(cfg, n);
+
+    block->fallThrough = NO_BLOCK;
+    block->jumpTarget = NO_BLOCK;
+    block->inTable = (tableEntry[block->end - 1 - start] != 0);
+    switch (last->op) {
+    case OP_J:
+      block->jumpTarget = cfg->blockOf[last->q - start];
+      if (tableEntry[block->end - 1 - start] == 1)
+	block->fallThrough = cfg->blockOf[block->end - start];
+      break;
+    case OP_FJ:
+      block->jumpTarget = cfg->blockOf[last->q - start];
+      block->fallThrough = cfg->blockOf[block->end - start];
+      break;
+    case OP_HL:
+    case OP_EP:
+    case OP_EF:
+      break;
+    default:
+      // JT included
+      block->fallThrough = cfg->blockOf[block->end - start];
+      break;
+    }
+  }
+  free(tableEntry);
+
+  computeReachability(cfg);
+  return cfg;
+}
+
+void freeCFG(ControlFlowGraph* cfg) {
+  free(cfg->blocks);
+  free(cfg->blockOf);
+  free(cfg);
+}
+
+void computeReachability(ControlFlowGraph* cfg) {
+  int* work;
+  int top = 0;
+  int n, succ[2], i;
+
+  for (n = 0; n < cfg->blockCount; n ++) {
+    cfg->blocks[n].reachable = FALSE;
+    cfg->blocks[n].predecessorCount = 0;
+  }
+
+  work = (int*) malloc(cfg->blockCount * sizeof(int));
+  cfg->blocks[0].reachable = TRUE;
+  work[top++] = 0;
+  while (top > 0) {
+    n = work[--top];
+    succ[0] = cfg->blocks[n].fallThrough;
+    succ[1] = cfg->blocks[n].jumpTarget;
+    for (i = 0; i < 2; i ++)
+      if (succ[i] != NO_BLOCK) {
+	cfg->blocks[succ[i]].predecessorCount ++;
+	if (!cfg->blocks[succ[i]].reachable) {
+	  cfg->blocks[succ[i]].reachable = TRUE;
+	  work[top++] = succ[i];
+	}
+      }
+  }
+  free(work);
+}
+
+// Check whether block m is still free to be entered by falling through from
+// its neighbour in code order, the way the parser laid it out
+int keepsNaturalFallThrough(ControlFlowGraph* cfg, int m, char* placed) {
+  return (m > 0) && !placed[m - 1] && cfg->blocks[m - 1].reachable &&
+    (cfg->blocks[m - 1].fallThrough == m);
+}
+
+// Choose the block to place after the given one: its fall-through
+// successor if still free (unless that steals it from its neighbour in code
+// order), else the target of a final J that has no other way in, else the
+// next free block in code order.
+int nextInLayout(ControlFlowGraph* cfg, int n, char* placed) {
+  BasicBlock* block = cfg->blocks + n;
+  int m;
+
+  m = block->fallThrough;
+  if ((m != NO_BLOCK) && !placed[m] &&
+      ((m == n + 1) || !keepsNaturalFallThrough(cfg, m, placed)))
+    return m;
+  if ((lastInstruction(cfg, n)->op == OP_J) &&
+      (block->jumpTarget != NO_BLOCK) && !placed[block->jumpTarget] &&
+      (cfg->blocks[block->jumpTarget].predecessorCount == 1))
+    return block->jumpTarget;
+  for (m = 0; m < cfg->blockCount; m ++)
+    if (cfg->blocks[m].reachable && !placed[m])
+      return m;
+  return NO_BLOCK;
+}
+
+// Rewrite the code range so that reachable blocks are laid out to fall
+// through into each other as often as possible; unreachable blocks are
+// dropped. The range must extend to the end of the code.
+int linearizeCFG(ControlFlowGraph* cfg) {
+  CodeBlock* codeBlock = cfg->codeBlock;
+  Instruction* code = codeBlock->code;
+  Instruction* newCode;
+  int* newLines;
+  char* placed;
+  char* isBlockRef;
+  int* order;
+  int* newStart;
+  int count, i, n, next, size;
+  CodeAddress address;
+  Instruction* last;
+
+  if (cfg->end != codeBlock->codeSize) return FALSE;
+
+  placed = (char*) calloc(cfg->blockCount, 1);
+  order = (int*) malloc((cfg->blockCount + 1) * sizeof(int));
+  newStart = (int*) malloc(cfg->blockCount * sizeof(int));
+
+  count = 0;
+  n = 0;
+  while (n != NO_BLOCK) {
+    order[count++] = n;
+    placed[n] = TRUE;
+    n = nextInLayout(cfg, n, placed);
+  }
+  order[count] = NO_BLOCK;
+
+  // Each block may lose its final J or gain one
+  size = 0;
+  for (i = 0; i < count; i ++) {
+    BasicBlock* block = cfg->blocks + order[i];
+    size += block->end - block->start + 1;
+  }
+  newCode = (Instruction*) malloc(size * sizeof(Instruction));
+  newLines = (int*) malloc(size * sizeof(int));
+  isBlockRef = (char*) calloc(size, 1);
+
+  address = 0;
+  for (i = 0; i < count; i ++) {
+    BasicBlock* block = cfg->blocks + order[i];
+    next = order[i + 1];
+    last = lastInstruction(cfg, order[i]);
+    newStart[order[i]] = cfg->start + address;
+
+    memcpy(newCode + address, code + block->start, (block->end - block->start) * sizeof(Instruction));
+    memcpy(newLines + address, codeBlock->lines + block->start, (block->end - block->start) * sizeof(int));
+    address += block->end - block->start;
+
+    if ((last->op == OP_J) || (last->op == OP_FJ)) {
+      if ((last->op == OP_J) && (block->jumpTarget == next) && !block->inTable)
+	address --;
+      else {
+	newCode[address - 1].q = block->jumpTarget;
+	isBlockRef[address - 1] = TRUE;
+      }
+    }
+    if ((block->fallThrough != NO_BLOCK) && (block->fallThrough != next)) {
+      newCode[address].op = OP_J;
+      newCode[address].p = DC_VALUE;
+      newCode[address].q = block->fallThrough;
+      newLines[address] = (address > 0) ? newLines[address - 1] : 0;
+      isBlockRef[address] = TRUE;
+      address ++;
+    }
+  }
+
+  if (cfg->start + address > codeBlock->maxSize) {
+    free(newCode);
+    free(newLines);
+    free(isBlockRef);
+    free(placed);
+    free(order);
+    free(newStart);
+    return FALSE;
+  }
+
+  for (i = 0; i < address; i ++)
+    if (isBlockRef[i])
+      newCode[i].q = newStart[newCode[i].q];
+
+  memcpy(code + cfg->start, newCode, address * sizeof(Instruction));
+  memcpy(codeBlock->lines + cfg->start, newLines, address * sizeof(int));
+  codeBlock->codeSize = cfg->start + address;
+
+  free(newCode);
+  free(newLines);
+  free(isBlockRef);
+  free(placed);
+  free(order);
+  free(newStart);
+  return TRUE;
+}
@@ -0,0 +1,40 @@
+#ifndef __CFG_H__
+#define __CFG_H__
+
+#include "instructions.h"
+
+#define NO_BLOCK -1
+
+struct BasicBlock_ {
+  CodeAddress start;      // address of the first instruction
+  CodeAddress end;        // address following the last instruction
+  int fallThrough;        // block reached when control falls off the end
+  int jumpTarget;         // block reached by the final J or FJ
+  int inTable;            // a J of the table of a JT, which must stay in place
+  int predecessorCount;
+  int reachable;
+};
+
+typedef struct BasicBlock_ BasicBlock;
+
+struct ControlFlowGraph_ {
+  CodeBlock* codeBlock;
+  CodeAddress start;      // the code range covered by the graph
+  CodeAddress end;
+  int blockCount;
+  BasicBlock* blocks;     // blocks in code order, the entry block first
+  int* blockOf;           // index of the block of each address in [start, end]
+};
+
+typedef struct ControlFlowGraph_ ControlFlowGraph;
+
+ControlFlowGraph* buildCFG(CodeBlock* codeBlock, CodeAddress start, CodeAddress end);
+void freeCFG(ControlFlowGraph* cfg);
+
+Instruction* lastInstruction(ControlFlowGraph* cfg, int block);
+int isBlockTerminator(enum OpCode op);
+void computeReachability(ControlFlowGraph* cfg);
+
+int linearizeCFG(ControlFlowGraph* cfg);
+
+#endif
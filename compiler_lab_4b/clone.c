@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "summary.h"
+
+// Cloning. A call passing constants to value parameters,
+//
+//    INT 4; ... LC c ...; DCT 4+n; CALL p,callee
+//
+// is sent to a copy of the callee specialized for them: the parameters
+// are read as LC c in the copy, which is then folded and pruned. The copy
+// is a block of its own,
+//
+//    J body; body: INT F; ...
+//
+// put in front of the body of the caller, and the call only changes its
+// target. The arguments are still passed, so that the frame is the same
+// as for the callee and the nested procedures of the callee work as well.
+// The calls with the same constants share the copy, which is kept only if
+// it came out shorter than the callee, within a growth budget.
+
+#define CLONE_SIZE_LIMIT 200      // longest body copied
+#define CLONE_GROWTH_LIMIT 1000   // instructions the copies may add to a block
+#define CALL_FRAME_WORDS 4        // return value, dynamic link, return address, static link
+
+// The copies made so far, and the attempts that did not pay off
+struct Clone_ {
+  CodeAddress callee;
+  int argCount;
+  char* isConstant;
+  WORD* values;
+  CodeAddress blockAddress;  // 0 if the copy was not kept
+};
+
+typedef struct Clone_ Clone;
+
+Clone* clones = NULL;
+int cloneCount = 0;
+int maxClones = 0;
+
+struct CloneSite_ {
+  CodeAddress call;
+  CompiledBlock* callee;
+  int argCount;
+  char* isConstant;
+  WORD* values;
+};
+
+typedef struct CloneSite_ CloneSite;
+
+Clone* findClone(CloneSite* site) {
+  Clone* clone;
+  int i, k;
+
+  for (i = 0; i < cloneCount; i ++) {
+    clone = clones + i;
+    if ((clone->callee != site->callee->blockAddress) || (clone->argCount != site->argCount)) continue;
+    for (k = 0; k < site->argCount; k ++)
+      if ((clone->isConstant[k] != site->isConstant[k]) ||
+	  (site->isConstant[k] && (clone->values[k] != site->values[k])))
+	break;
+    if (k == site->argCount) return clone;
+  }
+  return NULL;
+}
+
+void addClone(CloneSite* site, CodeAddress blockAddress) {
+  Clone* clone;
+
+  if (cloneCount == maxClones) {
+    maxClones = 2 * maxClones + 8;
+    clones = (Clone*) realloc(clones, maxClones * sizeof(Clone));
+  }
+  clone = clones + (cloneCount++);
+  clone->callee = site->callee->blockAddress;
+  clone->argCount = site->argCount;
+  clone->isConstant = (char*) malloc(site->argCount + 1);
+  clone->values = (WORD*) malloc((site->argCount + 1) * sizeof(WORD));
+  memcpy(clone->isConstant, site->isConstant, site->argCount);
+  memcpy(clone->values, site->values, site->argCount * sizeof(WORD));
+  clone->blockAddress = blockAddress;
+}
+
+// Block whose body starts at address, NULL if none
+CompiledBlock* blockWithBody(CodeBlock* codeBlock, CodeAddress address) {
+  CompiledBlock* block;
+  int k;
+
+  for (k = 0; (block = compiledBlockAt(k)) != NULL; k ++)
+    if ((block->end != 0) && (codeBlock->code[block->blockAddress].q == address))
+      return block;
+  return NULL;
+}
+
+int canClone(CodeBlock* codeBlock, CompiledBlock* callee) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+
+  if ((callee->end == 0) || (callee->original != 0) || (callee->paramCount <= 0)) return FALSE;
+  if (code[callee->bodyStart].op != OP_INT) return FALSE;
+  if ((code[callee->end - 1].op != OP_EP) && (code[callee->end - 1].op != OP_EF)) return FALSE;
+  if (callee->end - firstBodyAddress(callee) > CLONE_SIZE_LIMIT) return FALSE;
+
+  for (i = firstBodyAddress(callee); i < callee->end; i ++)
+    switch (code[i].op) {
+    case OP_CALL:
+    case OP_CS:
+      // The nested procedures are left to the callee itself
+      if (code[i].p == 0) return FALSE;
+      break;
+    case OP_HL:
+      return FALSE;
+    default:
+      break;
+    }
+  return TRUE;
+}
+
+// Find a call with constant arguments to a callee that can be cloned, and
+// which was not tried before with them. Calls to a copy made earlier are
+// redirected on the way.
+int findCloneSite(CodeBlock* codeBlock, CodeAddress start, CloneSite* site) {
+  Instruction* code = codeBlock->code;
+  int* depth = computeStackDepths(codeBlock, start, codeBlock->codeSize);
+  CodeAddress* argStart = (CodeAddress*) malloc((codeBlock->codeSize + 1) * sizeof(CodeAddress));
+  CompiledBlock* callee;
+  Clone* clone;
+  CodeAddress i, frame;
+  int k, n, constants, frameDepth, found = FALSE;
+
+  for (i = start + 2; (i < codeBlock->codeSize) && !found; i ++) {
+    if ((code[i].op != OP_CALL) || (code[i - 1].op != OP_DCT)) continue;
+    callee = findCompiledBlock(code[i].q);
+    n = code[i - 1].q - CALL_FRAME_WORDS;
+    if ((callee == NULL) || (n != callee->paramCount) || !canClone(codeBlock, callee)) continue;
+
+    // The INT reserving the frame is the last instruction below it
+    frameDepth = depth[i - 1 - start] - code[i - 1].q;
+    if ((depth[i - 1 - start] < 0) || (frameDepth < 0)) continue;
+    for (frame = i - 2; (frame > start) && (depth[frame - start] != frameDepth); frame --);
+    if ((frame <= start) || (code[frame].op != OP_INT) || (code[frame].q != CALL_FRAME_WORDS)) continue;
+    if (!splitArguments(codeBlock, frame, i, n, argStart)) continue;
+
+    site->call = i;
+    site->callee = callee;
+    site->argCount = n;
+    site->isConstant = (char*) realloc(site->isConstant, n + 1);
+    site->values = (WORD*) realloc(site->values, (n + 1) * sizeof(WORD));
+    constants = 0;
+    for (k = 0; k < n; k ++) {
+      site->isConstant[k] = (argStart[k + 1] - argStart[k] == 1) && (code[argStart[k]].op == OP_LC) &&
+	isReadOnlySlot(codeBlock, callee, CALL_FRAME_WORDS + k);
+      site->values[k] = site->isConstant[k] ? code[argStart[k]].q : 0;
+      if (site->isConstant[k]) constants ++;
+    }
+    if (constants == 0) continue;
+
+    clone = findClone(site);
+    if (clone == NULL) found = TRUE;
+    else if (clone->blockAddress != 0) code[i].q = clone->blockAddress;
+  }
+
+  free(depth);
+  free(argStart);
+  return found;
+}
+
+// Append the copy of the callee for the site to the code, at address copy
+int copyCallee(CodeBlock* codeBlock, CloneSite* site, CodeAddress copy) {
+  Instruction* code = codeBlock->code;
+  int* lines = codeBlock->lines;
+  CompiledBlock* callee = site->callee;
+  CompiledBlock* target;
+  CodeAddress first = firstBodyAddress(callee);
+  CodeAddress i, n = copy;
+  WORD k;
+
+  if (copy + 2 + (callee->end - first) > codeBlock->maxSize) return FALSE;
+
+  code[n].op = OP_J;
+  code[n].p = DC_VALUE;
+  code[n].q = copy + 1;
+  lines[n] = lines[callee->bodyStart];
+  n ++;
+  lines[n] = lines[callee->bodyStart];
+  code[n++] = code[callee->bodyStart];
+
+  for (i = first; i < callee->end; i ++, n ++) {
+    code[n] = code[i];
+    lines[n] = lines[i];
+    switch (code[n].op) {
+    case OP_LV:
+      k = code[n].q - CALL_FRAME_WORDS;
+      if ((code[n].p == 0) && (k >= 0) && (k < site->argCount) && site->isConstant[k]) {
+	code[n].op = OP_LC;
+	code[n].p = DC_VALUE;
+	code[n].q = site->values[k];
+      }
+      break;
+    case OP_J:
+    case OP_FJ:
+      if ((code[n].q >= first) && (code[n].q < callee->end)) {
+	code[n].q = copy + 2 + (code[n].q - first);
+	break;
+      }
+      // TC p,n; J body  ==>  DCT 4+n; CALL p,block, to keep the jumps
+      // inside the copy
+      target = blockWithBody(codeBlock, code[n].q);
+      if ((code[n].op != OP_J) || (n == copy + 2) || (code[n - 1].op != OP_TC) || (target == NULL))
+	return FALSE;
+      code[n - 1].op = OP_DCT;
+      code[n - 1].p = DC_VALUE;
+      code[n - 1].q += CALL_FRAME_WORDS;
+      code[n].op = OP_CALL;
+      code[n].p = code[i - 1].p;
+      code[n].q = target->blockAddress;
+      break;
+    default:
+      break;
+    }
+  }
+  codeBlock->codeSize = n;
+  return TRUE;
+}
+
+// Move the code from address from up to the end in front of address to
+void moveCodeBefore(CodeBlock* codeBlock, CodeAddress to, CodeAddress from) {
+  Instruction* code = codeBlock->code;
+  Instruction* moved;
+  int* movedLines;
+  int length = codeBlock->codeSize - from;
+  CodeAddress i, q;
+
+  for (i = 0; i < codeBlock->codeSize; i ++)
+    switch (code[i].op) {
+    case OP_J:
+    case OP_FJ:
+    case OP_CALL:
+    case OP_CS:
+      q = code[i].q;
+      if ((q >= to) && (q < from)) code[i].q = q + length;
+      else if ((q >= from) && (q < codeBlock->codeSize)) code[i].q = q - (from - to);
+      break;
+    default:
+      break;
+    }
+
+  moved = (Instruction*) malloc(length * sizeof(Instruction));
+  memcpy(moved, code + from, length * sizeof(Instruction));
+  memmove(code + to + length, code + to, (from - to) * sizeof(Instruction));
+  memcpy(code + to, moved, length * sizeof(Instruction));
+  free(moved);
+
+  movedLines = (int*) malloc(length * sizeof(int));
+  memcpy(movedLines, codeBlock->lines + from, length * sizeof(int));
+  memmove(codeBlock->lines + to + length, codeBlock->lines + to, (from - to) * sizeof(int));
+  memcpy(codeBlock->lines + to, movedLines, length * sizeof(int));
+  free(movedLines);
+}
+
+// Make the copy for the site and put it in front of the body at start.
+// Returns the growth of the code, 0 if the copy was not kept.
+int cloneCallee(CodeBlock* codeBlock, CodeAddress start, CloneSite* site, int growth) {
+  CompiledBlock* callee = site->callee;
+  CompiledBlock* clone;
+  CodeAddress copy = codeBlock->codeSize;
+  int length;
+
+  if (!copyCallee(codeBlock, site, copy)) {
+    codeBlock->codeSize = copy;
+    addClone(site, 0);
+    return 0;
+  }
+  strengthReduce(codeBlock, copy + 1);
+  optimizeControlFlow(codeBlock, copy + 1);
+
+  length = codeBlock->codeSize - copy;
+  if ((length - 2 >= callee->end - firstBodyAddress(callee)) || (growth + length > CLONE_GROWTH_LIMIT)) {
+    codeBlock->codeSize = copy;
+    addClone(site, 0);
+    return 0;
+  }
+
+  codeBlock->code[site->call].q = copy;
+  moveCodeBefore(codeBlock, start, copy);
+
+  clone = enterCompiledBlock(start);
+  clone->bodyStart = start + 1;
+  clone->end = start + length;
+  clone->inlineHint = callee->inlineHint;
+  clone->paramCount = callee->paramCount;
+  clone->original = callee->blockAddress;
+  summarizeBlock(codeBlock, clone);
+  if (optCompactCalls)
+    compactEntry(codeBlock, clone);
+  addClone(site, start);
+  return length;
+}
+
+int cloneCalls(CodeBlock* codeBlock, CodeAddress blockAddress) {
+  CloneSite site;
+  int growth = 0, count = 0, length;
+
+  if (codeBlock->code[codeBlock->code[blockAddress].q].op != OP_INT) return 0;
+  site.isConstant = NULL;
+  site.values = NULL;
+
+  // One call at a time, since the body moves
+  while (findCloneSite(codeBlock, codeBlock->code[blockAddress].q, &site)) {
+    length = cloneCallee(codeBlock, codeBlock->code[blockAddress].q, &site, growth);
+    growth += length;
+    if (length > 0) count ++;
+  }
+
+  free(site.isConstant);
+  free(site.values);
+  return count;
+}
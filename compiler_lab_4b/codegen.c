@@ -5,10 +5,16 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "reader.h"
 #include "codegen.h"  
+#include "optimizer.h"
+#include "summary.h"
 
 #define CODE_SIZE 10000
+#define JUMP_TABLE_MIN_RANGES 4   // fewer ranges are told apart by comparisons
+#define JUMP_TABLE_DENSITY 3      // most entries of a jump table per range
 extern SymTab* symtab;
 
 extern Object* readiFunction;
@@ -18,33 +24,71 @@ extern Object* writecProcedure;
 extern Object* writelnProcedure;
 
 CodeBlock* codeBlock;
+int checkBounds = 0;
+int saveLines = 0;
 
-void genVariableAddress(Object* var) {
-  //todo
-  // Tạm thời: mọi biến ở level 0 (frame hiện tại)
+// Names of the blocks, for the code dump
+struct BlockName_ {
+  CodeAddress blockAddress;
+  char name[MAX_IDENT_LEN + 1];
+};
+
+typedef struct BlockName_ BlockName;
+
+BlockName* blockNames = NULL;
+int blockNameCount = 0;
+int maxBlockNames = 0;
+
+int computeNestedLevel(Scope* scope) {
+  // Number of static links to follow from the current frame to reach the frame of scope
   int level = 0;
+  Scope* tmp = symtab->currentScope;
+
+  while ((tmp != NULL) && (tmp != scope)) {
+    tmp = tmp->outer;
+    level ++;
+  }
+  return level;
+}
+
+void genVariableAddress(Object* var) {
+  int level = computeNestedLevel(VARIABLE_SCOPE(var));
   int offset = VARIABLE_OFFSET(var);
   genLA(level, offset);
 }
 
 void genVariableValue(Object* var) {
-  //todo
-  // Tạm thời: mọi biến ở level 0 (frame hiện tại)
-  int level = 0;
+  int level = computeNestedLevel(VARIABLE_SCOPE(var));
   int offset = VARIABLE_OFFSET(var);
   genLV(level, offset);
 }
 
+void genParameterAddress(Object* param) {
+  int level = computeNestedLevel(PARAMETER_SCOPE(param));
+  int offset = PARAMETER_OFFSET(param);
+  genLA(level, offset);
+}
+
 void genParameterValue(Object* param) {
-  // Tạm thời: mọi parameter ở level 0 (frame hiện tại)
-  int level = 0;
+  int level = computeNestedLevel(PARAMETER_SCOPE(param));
   int offset = PARAMETER_OFFSET(param);
   genLV(level, offset);
 }
 
+void genReturnValueAddress(Object* func) {
+  int level = computeNestedLevel(FUNCTION_SCOPE(func));
+  genLA(level, RETURN_VALUE_OFFSET);
+}
+
+void genProcedureCall(Object* proc) {
+  // The static link of the callee is the frame of the scope declaring it
+  int level = computeNestedLevel(PROCEDURE_SCOPE(proc)->outer);
+  genCALL(level, proc->procAttrs->codeAddress);
+}
+
 void genFunctionCall(Object* func) {
-  // Tạm thời: chưa xét function call, halt
-  genHL();
+  int level = computeNestedLevel(FUNCTION_SCOPE(func)->outer);
+  genCALL(level, func->funcAttrs->codeAddress);
 }
 
 int isPredefinedFunction(Object* func) {
@@ -163,6 +207,30 @@ void genDV(void) {
   emitDV(codeBlock);
 }
 
+void genMOD(void) {
+  emitMOD(codeBlock);
+}
+
+void genAND(void) {
+  emitAND(codeBlock);
+}
+
+void genOR(void) {
+  emitOR(codeBlock);
+}
+
+void genXOR(void) {
+  emitXOR(codeBlock);
+}
+
+void genSHL(void) {
+  emitSHL(codeBlock);
+}
+
+void genSHR(void) {
+  emitSHR(codeBlock);
+}
+
 void genNEG(void) {
   emitNEG(codeBlock);
 }
@@ -195,6 +263,124 @@ void genLE(void) {
   emitLE(codeBlock);
 }
 
+void genBC(WORD size) {
+  emitBC(codeBlock, size);
+}
+
+void genBM(WORD size) {
+  emitBM(codeBlock, size);
+}
+
+void genLD(void) {
+  emitLD(codeBlock);
+}
+
+void genData(WORD value) {
+  emitData(codeBlock, value);
+}
+
+int compareCaseRanges(const void* r1, const void* r2) {
+  const CaseRange* a = (const CaseRange*) r1;
+  const CaseRange* b = (const CaseRange*) r2;
+
+  return (a->lo < b->lo) ? -1 : (a->lo > b->lo);
+}
+
+// JT over the values from the first label to the last one, each J going
+// to the arm of its value, and the last one to otherwise
+void genJumpTable(CaseRange* ranges, int count, CodeAddress otherwise) {
+  WORD base = ranges[0].lo, value;
+  int size = (int) ((UWORD) ranges[count - 1].hi - (UWORD) base + 1);
+  CodeAddress end = getCurrentCodeAddress() + size + 2;
+  int offset, k = 0;
+
+  if (otherwise == NO_OTHERWISE) otherwise = end;
+  emitJT(codeBlock, base, size);
+  for (offset = 0; offset < size; offset ++) {
+    value = base + offset;
+    while (ranges[k].hi < value) k ++;
+    genJ((ranges[k].lo <= value) ? ranges[k].arm : otherwise);
+  }
+  genJ(otherwise);
+}
+
+// Binary search over ranges[first..last] for a selector known to be in
+// [lower, upper]. The selector stays on the stack until an arm is chosen;
+// the FJs taken when it matches no label are added to misses.
+void genDecisionTree(CaseRange* ranges, int first, int last, WORD lower, WORD upper,
+		     Instruction** misses, int* missCount) {
+  CaseRange* range;
+  Instruction* fjInstruction;
+  int middle;
+
+  if (first == last) {
+    range = ranges + first;
+    if ((range->lo == range->hi) && (lower < range->lo) && (upper > range->hi)) {
+      genCV();
+      genLC(range->lo);
+      genEQ();
+      misses[(*missCount)++] = genFJ(DC_VALUE);
+    } else {
+      if (lower < range->lo) {
+	genCV();
+	genLC(range->lo);
+	genGE();
+	misses[(*missCount)++] = genFJ(DC_VALUE);
+      }
+      if (upper > range->hi) {
+	genCV();
+	genLC(range->hi);
+	genLE();
+	misses[(*missCount)++] = genFJ(DC_VALUE);
+      }
+    }
+    genDCT(1);
+    genJ(range->arm);
+    return;
+  }
+
+  middle = (first + last + 1) / 2;
+  genCV();
+  genLC(ranges[middle].lo);
+  genLT();
+  fjInstruction = genFJ(DC_VALUE);
+  genDecisionTree(ranges, first, middle - 1, lower, ranges[middle].lo - 1, misses, missCount);
+  updateFJ(fjInstruction, getCurrentCodeAddress());
+  genDecisionTree(ranges, middle, last, ranges[middle].lo, upper, misses, missCount);
+}
+
+void genCaseDispatch(CaseRange* ranges, int count, CodeAddress otherwise) {
+  // Dense labels take one JT, the others about log2(count) comparisons
+  Instruction** misses;
+  UWORD span;
+  int k, n = 0, missCount = 0;
+
+  // Sorted, with the neighbouring ranges of the same arm merged
+  qsort(ranges, count, sizeof(CaseRange), compareCaseRanges);
+  for (k = 0; k < count; k ++)
+    if ((n > 0) && (ranges[n - 1].arm == ranges[k].arm) && (ranges[n - 1].hi + 1 == ranges[k].lo))
+      ranges[n - 1].hi = ranges[k].hi;
+    else ranges[n++] = ranges[k];
+
+  // The number of values from the first label to the last one, less one
+  span = (UWORD) ranges[n - 1].hi - (UWORD) ranges[0].lo;
+  if ((n >= JUMP_TABLE_MIN_RANGES) && (span < (UWORD) JUMP_TABLE_DENSITY * n)) {
+    genJumpTable(ranges, n, otherwise);
+    return;
+  }
+
+  misses = (Instruction**) malloc(2 * n * sizeof(Instruction*));
+  genDecisionTree(ranges, 0, n - 1, WORD_MIN, WORD_MAX, misses, &missCount);
+  if (missCount > 0) {
+    for (k = 0; k < missCount; k ++)
+      updateFJ(misses[k], getCurrentCodeAddress());
+    genDCT(1);
+    if (otherwise != NO_OTHERWISE)
+      genJ(otherwise);
+  }
+  free(misses);
+}
+
 void updateJ(Instruction* jmp, CodeAddress label) {
   jmp->q = label;
 }
@@ -203,21 +389,269 @@ void updateFJ(Instruction* jmp, CodeAddress label) {
   jmp->q = label;
 }
 
+void addJump(JumpList* list, Instruction* jmp) {
+  list->jumps = (Instruction**) realloc(list->jumps, (list->count + 1) * sizeof(Instruction*));
+  list->jumps[list->count++] = jmp;
+}
+
+void appendJumps(JumpList* list, JumpList* other) {
+  int k;
+
+  for (k = 0; k < other->count; k ++)
+    addJump(list, other->jumps[k]);
+  free(other->jumps);
+  other->jumps = NULL;
+  other->count = 0;
+}
+
+Instruction* takeLastJump(JumpList* list) {
+  return list->jumps[--list->count];
+}
+
+void updateJumps(JumpList* list, CodeAddress label) {
+  int k;
+
+  for (k = 0; k < list->count; k ++)
+    updateFJ(list->jumps[k], label);
+  free(list->jumps);
+  list->jumps = NULL;
+  list->count = 0;
+}
+
+void invertComparison(Instruction* fjInstruction) {
+  Instruction* comparison = fjInstruction - 1;
+
+  switch (comparison->op) {
+  case OP_EQ: comparison->op = OP_NE; break;
+  case OP_NE: comparison->op = OP_EQ; break;
+  case OP_LT: comparison->op = OP_GE; break;
+  case OP_GE: comparison->op = OP_LT; break;
+  case OP_GT: comparison->op = OP_LE; break;
+  case OP_LE: comparison->op = OP_GT; break;
+  default: break;
+  }
+}
+
 CodeAddress getCurrentCodeAddress(void) {
   return codeBlock->codeSize;
 }
 
+WORD getCurrentDataAddress(void) {
+  return codeBlock->dataSize;
+}
+
+int setSourceLine(int line) {
+  int outerLine = codeBlock->line;
+
+  codeBlock->line = line;
+  return outerLine;
+}
+
+int takeConstant(CodeAddress start, WORD* value) {
+  if ((codeBlock->codeSize != start + 1) || (codeBlock->code[start].op != OP_LC))
+    return FALSE;
+  *value = codeBlock->code[start].q;
+  codeBlock->codeSize = start;
+  return TRUE;
+}
+
 
 void initCodeBuffer(void) {
   codeBlock = createCodeBlock(CODE_SIZE);
 }
 
+void setBlockName(CodeAddress blockAddress, char* name) {
+  if (blockNameCount == maxBlockNames) {
+    maxBlockNames = 2 * maxBlockNames + 8;
+    blockNames = (BlockName*) realloc(blockNames, maxBlockNames * sizeof(BlockName));
+  }
+  blockNames[blockNameCount].blockAddress = blockAddress;
+  strncpy(blockNames[blockNameCount].name, name, MAX_IDENT_LEN);
+  blockNames[blockNameCount].name[MAX_IDENT_LEN] = '\0';
+  blockNameCount ++;
+}
+
+char* findBlockName(CodeAddress blockAddress) {
+  int i;
+
+  for (i = 0; i < blockNameCount; i ++)
+    if (blockNames[i].blockAddress == blockAddress)
+      return blockNames[i].name;
+  return NULL;
+}
+
+// The code, with the name of every block in front of it. A specialized
+// copy of a procedure or a function goes by the name of the original.
 void printCodeBuffer(void) {
-  printCodeBlock(codeBlock);
+  CompiledBlock* block;
+  char* name;
+  int i;
+
+  for (i = 0; i < codeBlock->codeSize; i ++) {
+    name = findBlockName(i);
+    if (name != NULL)
+      printf("%s:\n", name);
+    else {
+      block = findCompiledBlock(i);
+      if ((block != NULL) && (block->original != 0) && ((name = findBlockName(block->original)) != NULL))
+	printf("%s (specialized):\n", name);
+    }
+    printf("%d:  ", i);
+    printInstruction(codeBlock->code + i);
+    printf("\n");
+  }
 }
 
 void cleanCodeBuffer(void) {
   freeCodeBlock(codeBlock);
+  free(blockNames);
+}
+
+void optimizeCodeBuffer(CodeAddress blockAddress) {
+  optimizeBlock(codeBlock, blockAddress);
+}
+
+void setBlockParamCount(CodeAddress blockAddress, int paramCount) {
+  setParamCount(blockAddress, paramCount);
+}
+
+void setInlineDirective(CodeAddress blockAddress, int inlined) {
+  setInlineHint(blockAddress, inlined ? INLINE_ALWAYS : INLINE_NEVER);
+}
+
+void setMemoDirective(CodeAddress blockAddress) {
+  setMemoHint(blockAddress);
+}
+
+void printFrameSize(Object* owner) {
+  Scope* scope;
+  CodeAddress blockAddress;
+  Instruction* body;
+
+  switch (owner->kind) {
+  case OBJ_PROGRAM:
+    scope = PROGRAM_SCOPE(owner);
+    blockAddress = owner->progAttrs->codeAddress;
+    break;
+  case OBJ_FUNCTION:
+    scope = FUNCTION_SCOPE(owner);
+    blockAddress = owner->funcAttrs->codeAddress;
+    break;
+  case OBJ_PROCEDURE:
+    scope = PROCEDURE_SCOPE(owner);
+    blockAddress = owner->procAttrs->codeAddress;
+    break;
+  default:
+    return;
+  }
+
+  // The body starts by reserving the frame
+  body = codeBlock->code + codeBlock->code[blockAddress].q;
+  printf("Frame of %s: %d words, %d declared\n", owner->name,
+	 (body->op == OP_INT) ? (int) body->q : scope->frameSize, scope->frameSize);
+}
+
+Scope* blockScope(Object* owner) {
+  switch (owner->kind) {
+  case OBJ_PROGRAM:
+    return PROGRAM_SCOPE(owner);
+  case OBJ_FUNCTION:
+    return FUNCTION_SCOPE(owner);
+  case OBJ_PROCEDURE:
+    return PROCEDURE_SCOPE(owner);
+  default:
+    return NULL;
+  }
+}
+
+// Name of the word at offset q of the frame p levels above scope
+void printWordName(Scope* scope, WORD p, WORD q) {
+  ObjectNode* node;
+  Object* obj;
+  int k;
+
+  for (k = 0; (k < p) && (scope != NULL); k ++)
+    scope = scope->outer;
+  if (scope == NULL) {
+    printf(WORD_FORMAT "," WORD_FORMAT, p, q);
+    return;
+  }
+  if ((q == RETURN_VALUE_OFFSET) && (scope->owner->kind == OBJ_FUNCTION)) {
+    printf("%s", scope->owner->name);
+    return;
+  }
+  for (node = scope->objList; node != NULL; node = node->next) {
+    obj = node->object;
+    if (((obj->kind == OBJ_VARIABLE) && (q >= VARIABLE_OFFSET(obj)) &&
+	 (q < VARIABLE_OFFSET(obj) + sizeOfType(obj->varAttrs->type))) ||
+	((obj->kind == OBJ_PARAMETER) && (q == PARAMETER_OFFSET(obj)))) {
+      printf("%s", obj->name);
+      return;
+    }
+  }
+  printf(WORD_FORMAT "," WORD_FORMAT, p, q);
+}
+
+// Print the words read or written, as "reads a, b^, c[]": b^ is what the
+// reference parameter b refers to, c[] any element of the array c
+int printEffects(Scope* scope, SideEffects* effects, enum EffectKind kind, int any, int parts) {
+  Effect* effect;
+  int i, count = 0;
+
+  for (i = 0; i < effects->count; i ++) {
+    effect = effects->effects + i;
+    if (effect->kind != kind) continue;
+    if (count ++ == 0)
+      printf("%s%s ", (parts > 0) ? "; " : "", (kind == EFFECT_READ) ? "reads" : "writes");
+    else printf(", ");
+    printWordName(scope, effect->p, effect->q);
+    printf("%s%s", effect->indirect ? "^" : "", effect->indexed ? "[]" : "");
+  }
+  if (any) {
+    if (count ++ == 0)
+      printf("%s%s ", (parts > 0) ? "; " : "", (kind == EFFECT_READ) ? "reads" : "writes");
+    else printf(", ");
+    printf("any");
+  }
+  return parts + count;
+}
+
+void printSummary(Object* owner) {
+  CompiledBlock* block = findCompiledBlock((owner->kind == OBJ_FUNCTION) ?
+					   owner->funcAttrs->codeAddress : owner->procAttrs->codeAddress);
+  Scope* scope = blockScope(owner);
+  Summary* summary;
+  int parts = 0;
+
+  printf("Summary of %s: ", owner->name);
+  if ((block == NULL) || (block->summary == NULL)) {
+    printf("unknown\n");
+    return;
+  }
+  summary = block->summary;
+  if (isPure(summary)) {
+    printf("pure\n");
+    return;
+  }
+  parts = printEffects(scope, &summary->effects, EFFECT_READ, summary->effects.readsAny, parts);
+  parts = printEffects(scope, &summary->effects, EFFECT_WRITE, summary->effects.writesAny, parts);
+  if (summary->effects.input)
+    printf("%sinput", (parts ++ > 0) ? "; " : "");
+  if (summary->effects.output)
+    printf("%soutput", (parts ++ > 0) ? "; " : "");
+  printf("\n");
+}
+
+void printSummaries(Object* owner) {
+  Scope* scope = blockScope(owner);
+  ObjectNode* node;
+
+  if (scope == NULL) return;
+  for (node = scope->objList; node != NULL; node = node->next)
+    if ((node->object->kind == OBJ_FUNCTION) || (node->object->kind == OBJ_PROCEDURE)) {
+      printSummary(node->object);
+      printSummaries(node->object);
+    }
 }
 
 int serialize(char* fileName) {
@@ -226,6 +660,8 @@ int serialize(char* fileName) {
   f = fopen(fileName, "wb");
   if (f == NULL) return IO_ERROR;
   saveCode(codeBlock, f);
+  if (saveLines)
+    saveLineTable(codeBlock, f);
   fclose(f);
   return IO_SUCCESS;
 }
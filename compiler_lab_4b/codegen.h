@@ -12,11 +12,11 @@
 
 #define RESERVED_WORDS 4
 
-#define PROCEDURE_PARAM_COUNT(proc) (proc->procAttrs->numOfParams)
+#define PROCEDURE_PARAM_COUNT(proc) (proc->procAttrs->paramCount)
 #define PROCEDURE_SCOPE(proc) (proc->procAttrs->scope)
 #define PROCEDURE_FRAME_SIZE(proc) (proc->procAttrs->scope->frameSize)
 
-#define FUNCTION_PARAM_COUNT(func) (func->funcAttrs->numOfParams)
+#define FUNCTION_PARAM_COUNT(func) (func->funcAttrs->paramCount)
 #define FUNCTION_SCOPE(func) (func->funcAttrs->scope)
 #define FUNCTION_FRAME_SIZE(func) (func->funcAttrs->scope->frameSize)
 
@@ -34,8 +34,39 @@
 #define RETURN_ADDRESS_OFFSET 2
 #define STATIC_LINK_OFFSET 3
 
+#define NO_OTHERWISE -1
+
+// Check the indexes of arrays at run time
+extern int checkBounds;
+// Write the source line of each instruction to the executable
+extern int saveLines;
+
+// The labels lo..hi of a CASE statement lead to the arm at address arm
+struct CaseRange_ {
+  WORD lo, hi;
+  CodeAddress arm;
+};
+
+typedef struct CaseRange_ CaseRange;
+
+// The FJs of a condition still waiting for their target
+struct JumpList_ {
+  Instruction** jumps;
+  int count;
+};
+
+typedef struct JumpList_ JumpList;
+
+int computeNestedLevel(Scope* scope);
+
 void genVariableAddress(Object* var);
 void genVariableValue(Object* var);
+void genParameterAddress(Object* param);
+void genParameterValue(Object* param);
+void genReturnValueAddress(Object* func);
+
+void genProcedureCall(Object* proc);
+void genFunctionCall(Object* func);
 
 void genPredefinedProcedureCall(Object* proc);
 void genPredefinedFunctionCall(Object* func);
@@ -62,6 +93,12 @@ void genAD(void);
 void genSB(void);
 void genML(void);
 void genDV(void);
+void genMOD(void);
+void genAND(void);
+void genOR(void);
+void genXOR(void);
+void genSHL(void);
+void genSHR(void);
 void genNEG(void);
 void genCV(void);
 void genEQ(void);
@@ -70,17 +107,51 @@ void genGT(void);
 void genGE(void);
 void genLT(void);
 void genLE(void);
+void genBC(WORD size);
+void genBM(WORD size);
+void genLD(void);
+// Jump to the arm of a CASE statement chosen by the selector on the top
+// of the stack, to otherwise, or past this code when no label matches
+void genCaseDispatch(CaseRange* ranges, int count, CodeAddress otherwise);
+// Append a word to the read-only data segment
+void genData(WORD value);
 
 void updateJ(Instruction* jmp, CodeAddress label);
 void updateFJ(Instruction* jmp, CodeAddress label);
+void addJump(JumpList* list, Instruction* jmp);
+// Move the jumps of other to the end of list
+void appendJumps(JumpList* list, JumpList* other);
+Instruction* takeLastJump(JumpList* list);
+// Give all the jumps of the list their target, and empty it
+void updateJumps(JumpList* list, CodeAddress label);
+// Make the FJ after a comparison jump when the comparison holds
+void invertComparison(Instruction* fjInstruction);
 
 CodeAddress getCurrentCodeAddress(void);
+WORD getCurrentDataAddress(void);
+// Give the instructions emitted next the source line, and return the
+// line they had
+int setSourceLine(int line);
+// If the code from start on is a single LC, remove it and give its value
+int takeConstant(CodeAddress start, WORD* value);
 int isPredefinedProcedure(Object* proc);
 int isPredefinedFunction(Object* func);
 
 void initCodeBuffer(void);
 void printCodeBuffer(void);
 void cleanCodeBuffer(void);
+void optimizeCodeBuffer(CodeAddress blockAddress);
+// Number of parameters of a procedure or a function, for the optimizer
+void setBlockParamCount(CodeAddress blockAddress, int paramCount);
+// Always (TRUE) or never (FALSE) inline calls to the block
+void setInlineDirective(CodeAddress blockAddress, int inlined);
+void setMemoDirective(CodeAddress blockAddress);
+// Name of the program, procedure or function, for the code dump
+void setBlockName(CodeAddress blockAddress, char* name);
+void printFrameSize(Object* owner);
+// Print the summaries of the procedures and functions declared in the
+// block of owner, and in the blocks nested in them
+void printSummaries(Object* owner);
 
 int serialize(char* fileName);
 
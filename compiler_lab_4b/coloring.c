@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "cfg.h"
+#include "slots.h"
+
+// Frame slot coloring. Every variable gets a slot of its own from the
+// symbol table, and the other passes add hidden slots on top. Slots whose
+// values are never live at the same time can share one word of the frame,
+// which is then made shorter.
+//
+// Only private slots (see slots.h) of the current frame are moved, and
+// neither the reserved words nor a slot read before it is written.
+
+#define FIRST_COLORED_OFFSET 4  // after the return value, the links and the return address
+
+// Tell whether each slot can be moved
+char* findMovableSlots(SlotAnalysis* analysis, char* liveIn) {
+  char* movable = (char*) malloc(analysis->slotCount + 1);
+  int i;
+
+  for (i = 0; i < analysis->slotCount; i ++)
+    movable[i] = analysis->isPrivate[i] &&
+      (analysis->slots[i].q >= FIRST_COLORED_OFFSET) && !liveIn[i];
+  return movable;
+}
+
+// interferes[a * count + b]: slots a and b are live at the same time. It
+// is enough to look at the stores, since no movable slot is read before
+// being written.
+char* buildInterference(SlotAnalysis* analysis, char* liveIn, char* movable) {
+  ControlFlowGraph* cfg = analysis->cfg;
+  int count = analysis->slotCount;
+  char* interferes = (char*) calloc(count * count + 1, 1);
+  char* live = (char*) malloc(count + 1);
+  SlotAccess* access;
+  CodeAddress i;
+  int n, a, b;
+
+  for (n = 0; n < cfg->blockCount; n ++) {
+    if (!cfg->blocks[n].reachable) continue;
+    computeLiveOut(analysis, liveIn, n, live);
+    for (i = cfg->blocks[n].end - 1; i >= cfg->blocks[n].start; i --) {
+      access = analysis->accesses + (i - cfg->start);
+      if ((access->kind == SA_WRITE) && access->known) {
+	a = findSlot(analysis, access->p, access->q);
+	if (movable[a])
+	  for (b = 0; b < count; b ++)
+	    if ((b != a) && live[b]) {
+	      interferes[a * count + b] = TRUE;
+	      interferes[b * count + a] = TRUE;
+	    }
+      }
+      stepLiveness(analysis, i, live);
+    }
+  }
+
+  free(live);
+  return interferes;
+}
+
+int compareOffsets(const void* o1, const void* o2) {
+  return *(const WORD*) o1 - *(const WORD*) o2;
+}
+
+// Color the movable slots, lowest offsets first, and give each color the
+// offset of the movable slot with the same rank, so that slots only move
+// down. Returns the new offset of every slot.
+WORD* colorSlots(SlotAnalysis* analysis, char* movable, char* interferes) {
+  int count = analysis->slotCount;
+  WORD* offsets = (WORD*) malloc((count + 1) * sizeof(WORD));
+  WORD* newOffset = (WORD*) malloc((count + 1) * sizeof(WORD));
+  int* color = (int*) malloc((count + 1) * sizeof(int));
+  char* used = (char*) malloc(count + 1);
+  int movableCount = 0;
+  int i, j, c;
+
+  for (i = 0; i < count; i ++)
+    if (movable[i]) offsets[movableCount++] = analysis->slots[i].q;
+  qsort(offsets, movableCount, sizeof(WORD), compareOffsets);
+
+  for (i = 0; i < count; i ++)
+    color[i] = -1;
+  for (j = 0; j < movableCount; j ++) {
+    i = findSlot(analysis, 0, offsets[j]);
+    memset(used, FALSE, count);
+    for (c = 0; c < count; c ++)
+      if (interferes[i * count + c] && (color[c] >= 0))
+	used[color[c]] = TRUE;
+    for (c = 0; used[c]; c ++);
+    color[i] = c;
+  }
+
+  for (i = 0; i < count; i ++)
+    newOffset[i] = (color[i] >= 0) ? offsets[color[i]] : analysis->slots[i].q;
+
+  free(offsets);
+  free(color);
+  free(used);
+  return newOffset;
+}
+
+int colorFrameSlots(CodeBlock* codeBlock, CodeAddress start) {
+  Instruction* code = codeBlock->code;
+  ControlFlowGraph* cfg;
+  SlotAnalysis* analysis;
+  char* liveIn;
+  char* movable;
+  char* interferes;
+  char* inUse;
+  WORD* newOffset;
+  WORD frameSize, q;
+  CodeAddress i;
+  int slot, moved = 0;
+
+  if (code[start].op != OP_INT) return 0;
+  cfg = buildCFG(codeBlock, start, codeBlock->codeSize);
+  if (cfg == NULL) return 0;
+  analysis = analyseSlots(cfg);
+  frameSize = code[start].q;
+
+  // Slots live at the entry of the first block are read before written
+  liveIn = computeLiveness(analysis);
+  movable = findMovableSlots(analysis, liveIn);
+  interferes = buildInterference(analysis, liveIn, movable);
+  newOffset = colorSlots(analysis, movable, interferes);
+
+  for (i = start; i < codeBlock->codeSize; i ++)
+    if (((code[i].op == OP_LA) || (code[i].op == OP_LV)) && (code[i].p == 0)) {
+      slot = findSlot(analysis, 0, code[i].q);
+      if ((slot >= 0) && movable[slot] && (newOffset[slot] != code[i].q)) {
+	code[i].q = newOffset[slot];
+	moved ++;
+      }
+    }
+
+  // Cut the words left unused at the top of the frame. Words that are
+  // never accessed directly, such as array elements, stay in use.
+  inUse = (char*) malloc(frameSize + 1);
+  memset(inUse, TRUE, frameSize);
+  for (slot = 0; slot < analysis->slotCount; slot ++)
+    if (movable[slot] && (analysis->slots[slot].q < frameSize))
+      inUse[analysis->slots[slot].q] = FALSE;
+  for (slot = 0; slot < analysis->slotCount; slot ++)
+    if (movable[slot] && (newOffset[slot] < frameSize))
+      inUse[newOffset[slot]] = TRUE;
+  for (q = frameSize; (q > FIRST_COLORED_OFFSET) && !inUse[q - 1]; q --);
+  code[start].q = q;
+
+  free(inUse);
+  free(newOffset);
+  free(interferes);
+  free(movable);
+  free(liveIn);
+  freeSlotAnalysis(analysis);
+  freeCFG(cfg);
+  return moved;
+}
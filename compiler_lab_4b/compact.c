@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+
+// Compact calls. A call reserves the four words at the bottom of the
+// frame before pushing the arguments, drops them again, and the callee
+// grows the stack to its frame size:
+//
+//    INT 4; arguments; DCT 4+n; CALL p,callee    ...    callee: INT F
+//
+// A block gets a second entry, EN n,F, which builds the whole frame from
+// the arguments on the stack. It is called with
+//
+//    arguments; CS p,entry
+//
+// CS pushes the return address and the static link above the arguments.
+// EN moves the arguments up over the reserved words, fills the links and
+// reserves the frame, so that a call costs two instructions instead of
+// four. EP and EF leave the frame as before.
+//
+// The old entry stays in front of the body for the calls compiled before
+// the block, which come from the blocks nested in it:
+//
+//    INT F; J body; EN n,F; body
+//
+// A block whose code, and that of the blocks nested in it, never goes
+// through its static link is called with CS -1,entry, which does not
+// follow the static links of the caller at all.
+
+#define CALL_FRAME_WORDS 4        // return value, dynamic link, return address, static link
+#define NO_STATIC_LINK -1
+
+// Tell whether an instruction at the given nesting depth below a block
+// goes through the static link of its frame
+int usesStaticLink(Instruction* inst, int depth) {
+  switch (inst->op) {
+  case OP_LA:
+  case OP_LV:
+  case OP_CALL:
+  case OP_CS:
+  case OP_TC:
+    return inst->p > depth;
+  default:
+    return FALSE;
+  }
+}
+
+int needsStaticLink(CodeBlock* codeBlock, CompiledBlock* block) {
+  Instruction* code = codeBlock->code;
+  CompiledBlock* nested;
+  CompiledBlock* outer;
+  CodeAddress i;
+  int k, j, depth;
+
+  for (i = block->bodyStart; i < block->end; i ++)
+    if (usesStaticLink(code + i, 0)) return TRUE;
+
+  for (k = 0; (nested = compiledBlockAt(k)) != NULL; k ++) {
+    if ((nested->blockAddress <= block->blockAddress) || (nested->blockAddress >= block->bodyStart))
+      continue;
+    depth = 1;
+    for (j = 0; (outer = compiledBlockAt(j)) != NULL; j ++)
+      if ((outer->blockAddress > block->blockAddress) && (outer->blockAddress < nested->blockAddress) &&
+	  (nested->blockAddress < outer->bodyStart))
+	depth ++;
+    for (i = nested->bodyStart; i < nested->end; i ++)
+      if (usesStaticLink(code + i, depth)) return TRUE;
+  }
+  return FALSE;
+}
+
+// Give a procedure or a function its compact entry
+void compactEntry(CodeBlock* codeBlock, CompiledBlock* block) {
+  Instruction* code = codeBlock->code;
+  CodeAddress body = block->bodyStart;
+  WORD frameSize = code[body].q;
+  CodeEdits* edits;
+
+  if ((block->paramCount < 0) || (block->entry != 0) || (code[body].op != OP_INT)) return;
+  block->needsStaticLink = needsStaticLink(codeBlock, block);
+
+  edits = createCodeEdits(codeBlock);
+  insertCodeBefore(edits, body, OP_INT, DC_VALUE, frameSize);
+  insertCodeBefore(edits, body, OP_J, DC_VALUE, body + 1);
+  code[body].op = OP_EN;
+  code[body].p = block->paramCount;
+  code[body].q = frameSize;
+  if (applyCodeEdits(codeBlock, edits)) {
+    block->entry = body + 2;
+    block->end += 2;
+  } else {
+    code[body].op = OP_INT;
+    code[body].p = DC_VALUE;
+  }
+  freeCodeEdits(edits);
+}
+
+// Turn the calls of the body to blocks with a compact entry into CS
+int compactCalls(CodeBlock* codeBlock, CodeAddress start) {
+  Instruction* code = codeBlock->code;
+  CodeEdits* edits;
+  CompiledBlock* callee;
+  CodeAddress i, k;
+  int* depth;
+  int count = 0, frameDepth;
+
+  if ((code[start].op != OP_INT) && (code[start].op != OP_EN)) return 0;
+  depth = computeStackDepths(codeBlock, start, codeBlock->codeSize);
+  edits = createCodeEdits(codeBlock);
+
+  for (i = start + 1; i < codeBlock->codeSize; i ++) {
+    if ((code[i].op != OP_CALL) || (code[i - 1].op != OP_DCT)) continue;
+    callee = findCompiledBlock(code[i].q);
+    if ((callee == NULL) || (callee->entry == 0)) continue;
+    if (code[i - 1].q != CALL_FRAME_WORDS + callee->paramCount) continue;
+
+    // The INT reserving the frame is the last instruction below it
+    frameDepth = depth[i - 1 - start] - code[i - 1].q;
+    if ((depth[i - 1 - start] < 0) || (frameDepth < 0)) continue;
+    for (k = i - 2; (k > start) && (depth[k - start] != frameDepth); k --);
+    if ((k <= start) || (code[k].op != OP_INT) || (code[k].q != CALL_FRAME_WORDS)) continue;
+
+    edits->removed[k] = TRUE;
+    edits->removed[i - 1] = TRUE;
+    code[i].op = OP_CS;
+    code[i].p = callee->needsStaticLink ? code[i].p : NO_STATIC_LINK;
+    code[i].q = callee->entry;
+    count ++;
+  }
+
+  if (count > 0)
+    applyCodeEdits(codeBlock, edits);
+  freeCodeEdits(edits);
+  free(depth);
+  return count;
+}
@@ -0,0 +1,503 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "cfg.h"
+#include "summary.h"
+
+// Local value numbering. The stack code of each basic block is run
+// symbolically: every pushed word gets a value number, and two pieces of
+// side-effect free code with the same value number compute the same word.
+// A recomputation right on top of an equal value becomes a CV; other
+// recomputations load the value from a hidden frame slot filled by the
+// first computation. A call to a pure function (see summary.h) is
+// computed from its arguments alone, as an operator is.
+
+enum ValueKind {
+  VK_UNKNOWN,   // an input, a read, or anything not understood
+  VK_CONST,
+  VK_ADDR,      // LA p,q
+  VK_LOAD,      // the content of the frame word (p,q)
+  VK_DEREF,     // the content of a computed address
+  VK_OP,        // an arithmetic or comparison on other values
+  VK_ARGS,      // an argument list: the list a followed by the value b
+  VK_CALL       // the result of the pure function p applied to the list a
+};
+
+#define CALL_FRAME_WORDS 4      // return value, dynamic link, return address, static link
+
+struct Value_ {
+  enum ValueKind kind;
+  enum OpCode op;
+  int a, b;
+  WORD p, q;
+  int version;
+  int epoch;
+};
+
+typedef struct Value_ Value;
+
+struct StackEntry_ {
+  int value;
+  CodeAddress start;      // where the code computing it begins, -1 if it cannot be recomputed
+  CodeAddress end;
+};
+
+typedef struct StackEntry_ StackEntry;
+
+struct Occurrence_ {
+  int value;
+  CodeAddress start;
+  CodeAddress end;
+  int adjacent;           // computed right on top of an equal value
+};
+
+typedef struct Occurrence_ Occurrence;
+
+struct SlotVersion_ {
+  WORD p, q;
+  int version;
+};
+
+typedef struct SlotVersion_ SlotVersion;
+
+struct ValueTable_ {
+  Value* values;
+  int valueCount, maxValues;
+  StackEntry* stack;
+  int top, maxStack;
+  Occurrence* occurrences;
+  int occurrenceCount, maxOccurrences;
+  SlotVersion* slots;
+  int slotCount, maxSlots;
+  int epoch;              // bumped by every store through a computed address
+  int stores;             // bumped by every store, which may write a computed address
+};
+
+typedef struct ValueTable_ ValueTable;
+
+#define GROW(array, count, max, type)					\
+  if ((count) == (max)) {						\
+    (max) = (max) * 2 + 16;						\
+    (array) = (type*) realloc((array), (max) * sizeof(type));		\
+  }
+
+void resetValueTable(ValueTable* table) {
+  table->valueCount = 0;
+  table->top = 0;
+  table->occurrenceCount = 0;
+  table->slotCount = 0;
+  table->epoch = 0;
+  table->stores = 0;
+}
+
+int slotVersion(ValueTable* table, WORD p, WORD q) {
+  int i;
+
+  for (i = 0; i < table->slotCount; i ++)
+    if ((table->slots[i].p == p) && (table->slots[i].q == q))
+      return table->slots[i].version;
+  return 0;
+}
+
+void killSlot(ValueTable* table, WORD p, WORD q) {
+  int i;
+
+  for (i = 0; i < table->slotCount; i ++)
+    if ((table->slots[i].p == p) && (table->slots[i].q == q)) {
+      table->slots[i].version ++;
+      return;
+    }
+  GROW(table->slots, table->slotCount, table->maxSlots, SlotVersion);
+  table->slots[table->slotCount].p = p;
+  table->slots[table->slotCount].q = q;
+  table->slots[table->slotCount].version = 1;
+  table->slotCount ++;
+}
+
+int isCommutative(enum OpCode op) {
+  switch (op) {
+  case OP_AD:
+  case OP_ML:
+  case OP_EQ:
+  case OP_NE:
+  case OP_AND:
+  case OP_OR:
+  case OP_XOR:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+int findValue(ValueTable* table, enum ValueKind kind, enum OpCode op, int a, int b, WORD p, WORD q, int version, int epoch) {
+  Value* v;
+  int i, tmp;
+
+  if ((kind == VK_OP) && isCommutative(op) && (a > b)) {
+    tmp = a; a = b; b = tmp;
+  }
+
+  if (kind != VK_UNKNOWN)
+    for (i = 0; i < table->valueCount; i ++) {
+      v = table->values + i;
+      if ((v->kind == kind) && (v->op == op) && (v->a == a) && (v->b == b) &&
+	  (v->p == p) && (v->q == q) && (v->version == version) && (v->epoch == epoch))
+	return i;
+    }
+
+  GROW(table->values, table->valueCount, table->maxValues, Value);
+  v = table->values + table->valueCount;
+  v->kind = kind;
+  v->op = op;
+  v->a = a;
+  v->b = b;
+  v->p = p;
+  v->q = q;
+  v->version = version;
+  v->epoch = epoch;
+  return table->valueCount ++;
+}
+
+int unknownValue(ValueTable* table) {
+  return findValue(table, VK_UNKNOWN, OP_BP, 0, 0, 0, 0, 0, 0);
+}
+
+StackEntry popEntry(ValueTable* table) {
+  StackEntry entry;
+
+  if (table->top > 0)
+    return table->stack[-- table->top];
+  // A word pushed before the block started
+  entry.value = unknownValue(table);
+  entry.start = -1;
+  entry.end = -1;
+  return entry;
+}
+
+// Push the value computed by [start, end) and remember the occurrence
+void pushEntry(ValueTable* table, int value, CodeAddress start, CodeAddress end) {
+  Occurrence* occ;
+  int length = end - start;
+
+  if ((start >= 0) && ((length >= 2) || (table->values[value].kind == VK_LOAD))) {
+    GROW(table->occurrences, table->occurrenceCount, table->maxOccurrences, Occurrence);
+    occ = table->occurrences + table->occurrenceCount;
+    occ->value = value;
+    occ->start = start;
+    occ->end = end;
+    occ->adjacent = (table->top > 0) && (table->stack[table->top - 1].value == value);
+    table->occurrenceCount ++;
+  }
+
+  GROW(table->stack, table->top, table->maxStack, StackEntry);
+  table->stack[table->top].value = value;
+  table->stack[table->top].start = start;
+  table->stack[table->top].end = end;
+  table->top ++;
+}
+
+int isPureBinaryOp(enum OpCode op) {
+  switch (op) {
+  case OP_AD:
+  case OP_SB:
+  case OP_ML:
+  case OP_DV:
+  case OP_MOD:
+  case OP_SHL:
+  case OP_SHR:
+  case OP_SRZ:
+  case OP_AND:
+  case OP_OR:
+  case OP_XOR:
+  case OP_EQ:
+  case OP_NE:
+  case OP_GT:
+  case OP_LT:
+  case OP_GE:
+  case OP_LE:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+// Number the call of a pure function ending with DCT at i and a CALL,
+// whose frame and arguments are on the stack. The code from the INT
+// reserving the frame to the CALL can be recomputed if the arguments can.
+void numberPureCall(ValueTable* table, Instruction* code, CodeAddress i) {
+  int argCount = code[i].q - CALL_FRAME_WORDS;
+  StackEntry* args = (StackEntry*) malloc((argCount + 1) * sizeof(StackEntry));
+  StackEntry frame;
+  CodeAddress next;
+  int k, list = -1, recomputable;
+
+  for (k = argCount - 1; k >= 0; k --)
+    args[k] = popEntry(table);
+  for (k = 0; k < CALL_FRAME_WORDS; k ++)
+    frame = popEntry(table);
+
+  recomputable = (frame.start >= 0) && (frame.end == frame.start + 1) && (code[frame.start].op == OP_INT);
+  next = frame.end;
+  for (k = 0; k < argCount; k ++) {
+    recomputable = recomputable && (args[k].start == next);
+    next = args[k].end;
+    list = findValue(table, VK_ARGS, OP_BP, list, args[k].value, 0, 0, 0, 0);
+  }
+  recomputable = recomputable && (next == i);
+
+  pushEntry(table, findValue(table, VK_CALL, OP_CALL, list, 0, 0, code[i + 1].q, 0, 0),
+	    recomputable ? frame.start : -1, i + 2);
+  free(args);
+}
+
+// Tell whether the DCT at i ends the call of a pure function
+int isPureFunctionCall(Instruction* code, CodeAddress i, CodeAddress end) {
+  Summary* summary;
+
+  if ((i + 1 >= end) || (code[i + 1].op != OP_CALL) || (code[i].q < CALL_FRAME_WORDS)) return FALSE;
+  summary = findCallSummary(code + i + 1);
+  return (summary != NULL) && summary->isFunction && isPure(summary) &&
+    (code[i].q == CALL_FRAME_WORDS + summary->paramCount);
+}
+
+// Run the block [start, end) symbolically, collecting the occurrences of
+// recomputable values
+void numberBlock(ValueTable* table, Instruction* code, CodeAddress start, CodeAddress end) {
+  StackEntry a, b;
+  Value* v;
+  CodeAddress i;
+  int k, value;
+
+  resetValueTable(table);
+  for (i = start; i < end; i ++) {
+    Instruction* inst = code + i;
+
+    switch (inst->op) {
+    case OP_LC:
+      pushEntry(table, findValue(table, VK_CONST, OP_LC, 0, 0, 0, inst->q, 0, 0), i, i + 1);
+      break;
+    case OP_LA:
+      pushEntry(table, findValue(table, VK_ADDR, OP_LA, 0, 0, inst->p, inst->q, 0, 0), i, i + 1);
+      break;
+    case OP_LV:
+      value = findValue(table, VK_LOAD, OP_LV, 0, 0, inst->p, inst->q,
+			slotVersion(table, inst->p, inst->q), table->epoch);
+      pushEntry(table, value, i, i + 1);
+      break;
+    case OP_LI:
+      a = popEntry(table);
+      v = table->values + a.value;
+      if (v->kind == VK_ADDR)
+	value = findValue(table, VK_LOAD, OP_LV, 0, 0, v->p, v->q,
+			  slotVersion(table, v->p, v->q), table->epoch);
+      else value = findValue(table, VK_DEREF, OP_LI, a.value, 0, 0, 0, table->stores, table->epoch);
+      pushEntry(table, value, (a.end == i) ? a.start : -1, i + 1);
+      break;
+    case OP_NEG:
+      a = popEntry(table);
+      value = findValue(table, VK_OP, OP_NEG, a.value, 0, 0, 0, 0, 0);
+      pushEntry(table, value, (a.end == i) ? a.start : -1, i + 1);
+      break;
+    case OP_LD:
+      // The data segment is never written: the same address gives the same word
+      a = popEntry(table);
+      value = findValue(table, VK_OP, OP_LD, a.value, 0, 0, 0, 0, 0);
+      pushEntry(table, value, (a.end == i) ? a.start : -1, i + 1);
+      break;
+    case OP_BC:
+      // Checked once, the same index needs no other check
+      a = popEntry(table);
+      value = findValue(table, VK_OP, OP_BC, a.value, 0, 0, inst->q, 0, 0);
+      pushEntry(table, value, (a.end == i) ? a.start : -1, i + 1);
+      break;
+    case OP_CV:
+      // The copy is equal to the top, but not computed by code of its own
+      if (table->top == 0)
+	pushEntry(table, unknownValue(table), -1, -1);
+      pushEntry(table, table->stack[table->top - 1].value, -1, i + 1);
+      break;
+    case OP_ST:
+      b = popEntry(table);
+      a = popEntry(table);
+      v = table->values + a.value;
+      if (v->kind == VK_ADDR)
+	killSlot(table, v->p, v->q);
+      else table->epoch ++;
+      // A word read through an address may be the slot just written
+      table->stores ++;
+      break;
+    case OP_RC:
+    case OP_RI:
+      pushEntry(table, unknownValue(table), -1, i + 1);
+      break;
+    case OP_WRC:
+    case OP_WRI:
+    case OP_FJ:
+    case OP_JT:
+      popEntry(table);
+      break;
+    case OP_WLN:
+    case OP_BP:
+    case OP_J:
+      break;
+    case OP_INT:
+      // The frame of a call, which may be part of the computation
+      for (k = 0; k < inst->q; k ++)
+	pushEntry(table, unknownValue(table), (inst->q == CALL_FRAME_WORDS) ? i : -1, i + 1);
+      break;
+    case OP_DCT:
+      if (isPureFunctionCall(code, i, end)) {
+	numberPureCall(table, code, i);
+	i ++;
+	break;
+      }
+      for (k = 0; k < inst->q; k ++)
+	popEntry(table);
+      break;
+    default:
+      if (isPureBinaryOp(inst->op)) {
+	b = popEntry(table);
+	a = popEntry(table);
+	value = findValue(table, VK_OP, inst->op, a.value, b.value, 0, 0, 0, 0);
+	// Only code computing the operands one right after the other can be replaced
+	pushEntry(table, value, ((a.start >= 0) && (b.start == a.end) && (b.end == i)) ? a.start : -1, i + 1);
+      } else {
+	// Calls and anything else: forget the stack and every load
+	table->top = 0;
+	table->epoch ++;
+      }
+      break;
+    }
+  }
+}
+
+int overlapsClaimed(char* claimed, Occurrence* occ) {
+  CodeAddress i;
+
+  for (i = occ->start; i < occ->end; i ++)
+    if (claimed[i]) return TRUE;
+  return FALSE;
+}
+
+void claim(char* claimed, Occurrence* occ) {
+  memset(claimed + occ->start, TRUE, occ->end - occ->start);
+}
+
+// Replace the code of occ by a single instruction
+void replaceOccurrence(CodeEdits* edits, Occurrence* occ, enum OpCode op, WORD p, WORD q) {
+  CodeAddress i;
+
+  for (i = occ->start; i < occ->end; i ++)
+    edits->removed[i] = TRUE;
+  insertCodeBefore(edits, occ->start, op, p, q);
+}
+
+int compareOccurrenceLength(const void* o1, const void* o2) {
+  const Occurrence* a = *(const Occurrence**) o1;
+  const Occurrence* b = *(const Occurrence**) o2;
+
+  if ((a->end - a->start) != (b->end - b->start))
+    return (b->end - b->start) - (a->end - a->start);
+  return a->start - b->start;
+}
+
+// Choose the rewrites for the occurrences found in one block
+int eliminateInBlock(ValueTable* table, CodeEdits* edits, char* claimed, WORD* frameSize) {
+  Occurrence** firsts;
+  Occurrence* first;
+  Occurrence* occ;
+  int count = 0, changed = 0;
+  int i, j, saving, temp;
+
+  // The first occurrence of each value, longest first
+  firsts = (Occurrence**) malloc((table->occurrenceCount + 1) * sizeof(Occurrence*));
+  for (i = 0; i < table->occurrenceCount; i ++) {
+    for (j = 0; j < i; j ++)
+      if (table->occurrences[j].value == table->occurrences[i].value) break;
+    if (j == i) firsts[count++] = table->occurrences + i;
+  }
+  qsort(firsts, count, sizeof(Occurrence*), compareOccurrenceLength);
+
+  for (i = 0; i < count; i ++) {
+    first = firsts[i];
+    if (overlapsClaimed(claimed, first)) continue;
+
+    // Recomputations right on top of the value become CV
+    saving = 0;
+    for (occ = first + 1; occ < table->occurrences + table->occurrenceCount; occ ++) {
+      if ((occ->value != first->value) || overlapsClaimed(claimed, occ)) continue;
+      if (occ->adjacent) {
+	replaceOccurrence(edits, occ, OP_CV, DC_VALUE, DC_VALUE);
+	claim(claimed, occ);
+	changed ++;
+      } else saving += occ->end - occ->start - 1;
+    }
+
+    // The others reload a hidden slot, if that pays for LA, ST and LV. A
+    // call costs more than its code shows.
+    if ((saving == 0) || (first->end - first->start < 2)) continue;
+    if ((saving <= 3) && (table->values[first->value].kind != VK_CALL)) continue;
+    temp = (*frameSize) ++;
+    claim(claimed, first);
+    insertCodeBefore(edits, first->start, OP_LA, 0, temp);
+    insertCodeAfter(edits, first->end - 1, OP_ST, DC_VALUE, DC_VALUE);
+    insertCodeAfter(edits, first->end - 1, OP_LV, 0, temp);
+    for (occ = first + 1; occ < table->occurrences + table->occurrenceCount; occ ++)
+      if ((occ->value == first->value) && !overlapsClaimed(claimed, occ)) {
+	replaceOccurrence(edits, occ, OP_LV, 0, temp);
+	claim(claimed, occ);
+      }
+    changed ++;
+  }
+
+  free(firsts);
+  return changed;
+}
+
+int eliminateCommonSubexpressions(CodeBlock* codeBlock, CodeAddress start) {
+  Instruction* code;
+  ValueTable table;
+  CodeEdits* edits;
+  char* isTarget;
+  char* claimed;
+  CodeAddress blockStart, i;
+  WORD frameSize;
+  int changed, total = 0;
+
+  if (codeBlock->code[start].op != OP_INT) return 0;
+
+  memset(&table, 0, sizeof(ValueTable));
+  do {
+    code = codeBlock->code;
+    frameSize = code[start].q;
+    edits = createCodeEdits(codeBlock);
+    isTarget = (char*) malloc(codeBlock->codeSize + 1);
+    claimed = (char*) calloc(codeBlock->codeSize + 1, 1);
+    markJumpTargets(codeBlock, isTarget);
+
+    changed = 0;
+    blockStart = start;
+    for (i = start; i < codeBlock->codeSize; i ++)
+      if ((i + 1 == codeBlock->codeSize) || isTarget[i + 1] || isBlockTerminator(code[i].op)) {
+	numberBlock(&table, code, blockStart, i + 1);
+	changed += eliminateInBlock(&table, edits, claimed, &frameSize);
+	blockStart = i + 1;
+      }
+
+    if ((changed > 0) && applyCodeEdits(codeBlock, edits)) {
+      codeBlock->code[start].q = frameSize;
+      total += changed;
+    } else changed = 0;
+
+    freeCodeEdits(edits);
+    free(isTarget);
+    free(claimed);
+  } while (changed > 0);
+
+  free(table.values);
+  free(table.stack);
+  free(table.occurrences);
+  free(table.slots);
+  return total;
+}
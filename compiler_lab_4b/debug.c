@@ -31,11 +31,15 @@ void printType(Type* type) {
 void printConstantValue(ConstantValue* value) {
   switch (value->type) {
   case TP_INT:
-    printf("%d",value->intValue);
+    printf(WORD_FORMAT, value->intValue);
     break;
   case TP_CHAR:
     printf("\'%c\'",value->charValue);
     break;
+  case TP_ARRAY:
+    printType(value->arrayType);
+    printf(" at data address %d", value->dataAddress);
+    break;
   default:
     break;
   }
@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "cfg.h"
+#include "slots.h"
+
+// Dead store elimination. The backward liveness of the frame slots of the
+// body finds the stores whose value is never read again; those are deleted
+// together with the code computing the address and the value, when that
+// code has no side effects.
+//
+// A load through an unknown address may read any slot that is not private
+// to the body (see slots.h), and so may a call, unless the summary of the
+// callee tells which (see summary.h). Slots of outer frames are live at
+// the end of a procedure, and so is the result slot of a function.
+
+struct StoreEntry_ {
+  CodeAddress start;      // -1 if the word cannot be recomputed
+  CodeAddress end;
+  int isAddress;          // pushed by a lone LA
+  int isConstant;
+};
+
+typedef struct StoreEntry_ StoreEntry;
+
+// Mark the stores to dead slots
+void findDeadStores(SlotAnalysis* analysis, char* dead) {
+  ControlFlowGraph* cfg = analysis->cfg;
+  char* liveIn = computeLiveness(analysis);
+  char* live = (char*) malloc(analysis->slotCount + 1);
+  CodeAddress i;
+  int n;
+
+  for (n = 0; n < cfg->blockCount; n ++) {
+    if (!cfg->blocks[n].reachable) continue;
+    computeLiveOut(analysis, liveIn, n, live);
+    for (i = cfg->blocks[n].end - 1; i >= cfg->blocks[n].start; i --)
+      dead[i] = stepLiveness(analysis, i, live);
+  }
+
+  free(liveIn);
+  free(live);
+}
+
+void pushStoreEntry(StoreEntry* stack, int* top, CodeAddress start, CodeAddress end) {
+  stack[*top].start = start;
+  stack[*top].end = end;
+  stack[*top].isAddress = FALSE;
+  stack[*top].isConstant = FALSE;
+  (*top) ++;
+}
+
+StoreEntry popStoreEntry(StoreEntry* stack, int* top) {
+  StoreEntry entry;
+
+  if (*top > 0) return stack[-- (*top)];
+  memset(&entry, 0, sizeof(StoreEntry));
+  entry.start = -1;
+  entry.end = -1;
+  return entry;
+}
+
+// Within block n, mark for removal each dead store with the side-effect
+// free code feeding it: LA p,q; value; ST
+int removeDeadStores(ControlFlowGraph* cfg, int n, char* dead, char* removed) {
+  BasicBlock* block = cfg->blocks + n;
+  Instruction* code = cfg->codeBlock->code;
+  StoreEntry* stack;
+  StoreEntry a, b;
+  CodeAddress i, k;
+  int top = 0, count = 0, safe;
+
+  stack = (StoreEntry*) malloc(2 * (block->end - block->start + 1) * sizeof(StoreEntry));
+  for (i = block->start; i < block->end; i ++) {
+    Instruction* inst = code + i;
+
+    switch (inst->op) {
+    case OP_LC:
+      pushStoreEntry(stack, &top, i, i + 1);
+      stack[top - 1].isConstant = TRUE;
+      break;
+    case OP_LA:
+      pushStoreEntry(stack, &top, i, i + 1);
+      stack[top - 1].isAddress = TRUE;
+      break;
+    case OP_LV:
+      pushStoreEntry(stack, &top, i, i + 1);
+      break;
+    case OP_LI:
+    case OP_NEG:
+    case OP_LD:
+      a = popStoreEntry(stack, &top);
+      pushStoreEntry(stack, &top, (a.end == i) ? a.start : -1, i + 1);
+      break;
+    case OP_AD:
+    case OP_SB:
+    case OP_ML:
+    case OP_DV:
+    case OP_MOD:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_SRZ:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GT:
+    case OP_LT:
+    case OP_GE:
+    case OP_LE:
+      b = popStoreEntry(stack, &top);
+      a = popStoreEntry(stack, &top);
+      // A division that may fail is a side effect
+      safe = ((inst->op != OP_DV) && (inst->op != OP_MOD)) ||
+	(b.isConstant && (code[b.start].q != 0) && (code[b.start].q != -1));
+      pushStoreEntry(stack, &top, (safe && (a.start >= 0) && (b.start == a.end) && (b.end == i)) ? a.start : -1, i + 1);
+      break;
+    case OP_CV:
+      if (top == 0)
+	pushStoreEntry(stack, &top, -1, -1);
+      pushStoreEntry(stack, &top, -1, i + 1);
+      break;
+    case OP_RC:
+    case OP_RI:
+      pushStoreEntry(stack, &top, -1, i + 1);
+      break;
+    case OP_ST:
+      b = popStoreEntry(stack, &top);
+      a = popStoreEntry(stack, &top);
+      if (dead[i] && a.isAddress && (b.start >= 0) && (b.start == a.end) && (b.end == i)) {
+	for (k = a.start; k <= i; k ++)
+	  removed[k] = TRUE;
+	count ++;
+      }
+      break;
+    case OP_WRC:
+    case OP_WRI:
+    case OP_FJ:
+    case OP_JT:
+      popStoreEntry(stack, &top);
+      break;
+    default:
+      top = 0;
+      break;
+    }
+  }
+  free(stack);
+  return count;
+}
+
+int eliminateDeadStores(CodeBlock* codeBlock, CodeAddress start) {
+  ControlFlowGraph* cfg;
+  SlotAnalysis* analysis;
+  char* dead;
+  char* removed;
+  int n, count, total = 0;
+
+  do {
+    cfg = buildCFG(codeBlock, start, codeBlock->codeSize);
+    if (cfg == NULL) break;
+    analysis = analyseSlots(cfg);
+
+    dead = (char*) calloc(codeBlock->codeSize + 1, 1);
+    removed = (char*) calloc(codeBlock->codeSize + 1, 1);
+    findDeadStores(analysis, dead);
+
+    count = 0;
+    for (n = 0; n < cfg->blockCount; n ++)
+      if (cfg->blocks[n].reachable)
+	count += removeDeadStores(cfg, n, dead, removed);
+    if (count > 0)
+      removeCode(codeBlock, removed);
+    total += count;
+
+    free(dead);
+    free(removed);
+    freeSlotAnalysis(analysis);
+    freeCFG(cfg);
+  } while (count > 0);
+
+  return total;
+}
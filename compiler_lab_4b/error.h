@@ -37,7 +37,11 @@ typedef enum {
   ERR_UNDECLARED_PROCEDURE,
   ERR_DUPLICATE_IDENT,
   ERR_TYPE_INCONSISTENCY,
-  ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY
+  ERR_PARAMETERS_ARGUMENTS_INCONSISTENCY,
+  ERR_INDEX_OUT_OF_RANGE,
+  ERR_EMPTY_CASE_RANGE,
+  ERR_DUPLICATE_CASE_LABEL,
+  ERR_NUMBER_TOO_LARGE
 } ErrorCode;
 
 void error(ErrorCode err, int lineNo, int colNo);
@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "summary.h"
+
+// Evaluation of calls at compile time. A call to a pure function whose
+// arguments are all constants,
+//
+//    INT 4; LC a1; ... LC an; DCT 4+n; CALL p,callee
+//
+// always gives the same result, which the compiler works out by running
+// the code of the callee, and the call becomes LC result. The evaluator
+// is a small copy of the VM working on a stack of its own; it gives up,
+// leaving the call alone, on anything the VM would do differently at run
+// time: a run time error, input or output, a word outside of the frames
+// it built, or more than EVAL_STEP_LIMIT instructions.
+
+#define EVAL_STEP_LIMIT 100000    // instructions run for one call
+#define EVAL_STACK_WORDS 4096
+#define CALL_FRAME_WORDS 4        // return value, dynamic link, return address, static link
+#define NO_FRAME -1               // links of the frame of the evaluated call
+
+struct Evaluator_ {
+  Instruction* code;
+  CodeAddress codeSize;
+  WORD* data;
+  int dataSize;
+  WORD* stack;
+  int t, b, pc;
+};
+
+typedef struct Evaluator_ Evaluator;
+
+int isStackAddress(Evaluator* ev, WORD address) {
+  return (address >= 0) && (address <= ev->t) && (address < EVAL_STACK_WORDS);
+}
+
+// Follow p static links; FALSE if they lead out of the evaluated frames
+int evaluateBase(Evaluator* ev, WORD p, WORD* base) {
+  WORD frame = ev->b;
+
+  for (; p > 0; p --) {
+    frame = ev->stack[frame + 3];
+    if (frame == NO_FRAME) return FALSE;
+  }
+  *base = frame;
+  return TRUE;
+}
+
+// Run one instruction. Returns FALSE to give up the evaluation.
+int evaluateStep(Evaluator* ev) {
+  Instruction* inst = ev->code + ev->pc;
+  WORD* s = ev->stack;
+  WORD k, base, returnAddress, staticLink;
+  int i;
+
+  switch (inst->op) {
+  case OP_LA:
+  case OP_LV:
+    if (!evaluateBase(ev, inst->p, &base)) return FALSE;
+    ev->t ++;
+    if (inst->op == OP_LA)
+      s[ev->t] = base + inst->q;
+    else if (isStackAddress(ev, base + inst->q))
+      s[ev->t] = s[base + inst->q];
+    else return FALSE;
+    break;
+  case OP_LC:
+    s[++ ev->t] = inst->q;
+    break;
+  case OP_LI:
+    if (!isStackAddress(ev, s[ev->t])) return FALSE;
+    s[ev->t] = s[s[ev->t]];
+    break;
+  case OP_INT:
+    // The words keep what they held, as in the VM: the parameters of a
+    // tail call are already there
+    if ((inst->q < 0) || (ev->t + inst->q >= EVAL_STACK_WORDS - CALL_FRAME_WORDS)) return FALSE;
+    ev->t += inst->q;
+    break;
+  case OP_DCT:
+    ev->t -= inst->q;
+    break;
+  case OP_J:
+    ev->pc = inst->q - 1;
+    break;
+  case OP_FJ:
+    if (s[ev->t] == FALSE)
+      ev->pc = inst->q - 1;
+    ev->t --;
+    break;
+  case OP_ST:
+    if (!isStackAddress(ev, s[ev->t - 1])) return FALSE;
+    s[s[ev->t - 1]] = s[ev->t];
+    ev->t -= 2;
+    break;
+  case OP_CALL:
+    if (!evaluateBase(ev, inst->p, &base)) base = NO_FRAME;
+    s[ev->t + 2] = ev->b;
+    s[ev->t + 3] = ev->pc;
+    s[ev->t + 4] = base;
+    ev->b = ev->t + 1;
+    ev->pc = inst->q - 1;
+    break;
+  case OP_EP:
+  case OP_EF:
+    ev->t = (inst->op == OP_EP) ? ev->b - 1 : ev->b;
+    ev->pc = s[ev->b + 2];
+    ev->b = s[ev->b + 1];
+    break;
+  case OP_AD:
+  case OP_SB:
+  case OP_ML:
+  case OP_DV:
+  case OP_MOD:
+  case OP_EQ:
+  case OP_NE:
+  case OP_GT:
+  case OP_LT:
+  case OP_GE:
+  case OP_LE:
+  case OP_AND:
+  case OP_OR:
+  case OP_XOR:
+  case OP_SHL:
+  case OP_SHR:
+    if (!foldConstants(inst->op, s[ev->t - 1], s[ev->t], &k)) return FALSE;
+    ev->t --;
+    s[ev->t] = k;
+    break;
+  case OP_SRZ:
+    k = s[ev->t];
+    ev->t --;
+    if ((k < 0) || (k >= WORD_BITS)) return FALSE;
+    if (s[ev->t] < 0)
+      s[ev->t] += (WORD) (((UWORD) 1 << k) - 1);
+    s[ev->t] = s[ev->t] >> k;
+    break;
+  case OP_NEG:
+    if (s[ev->t] == WORD_MIN) return FALSE;
+    s[ev->t] = - s[ev->t];
+    break;
+  case OP_JT:
+    if ((s[ev->t] >= inst->p) && ((UWORD) s[ev->t] - (UWORD) inst->p < (UWORD) inst->q))
+      k = s[ev->t] - inst->p;
+    else k = inst->q;
+    ev->t --;
+    if ((inst->q < 0) || (ev->pc + 1 + inst->q >= ev->codeSize)) return FALSE;
+    ev->pc = ev->code[ev->pc + 1 + k].q - 1;
+    break;
+  case OP_LD:
+    if ((s[ev->t] < 0) || (s[ev->t] >= ev->dataSize)) return FALSE;
+    s[ev->t] = ev->data[s[ev->t]];
+    break;
+  case OP_BC:
+    // The error is left to the run time
+    if ((s[ev->t] < 1) || (s[ev->t] > inst->q)) return FALSE;
+    break;
+  case OP_CV:
+    s[ev->t + 1] = s[ev->t];
+    ev->t ++;
+    break;
+  case OP_TC:
+    if (!evaluateBase(ev, inst->p, &base)) base = NO_FRAME;
+    for (i = 0; i < inst->q; i ++)
+      s[ev->b + 4 + i] = s[ev->t - inst->q + 1 + i];
+    s[ev->b + 3] = base;
+    ev->t = ev->b - 1;
+    break;
+  case OP_CS:
+    if ((inst->p < 0) || !evaluateBase(ev, inst->p, &base)) base = NO_FRAME;
+    s[ev->t + 1] = ev->pc;
+    s[ev->t + 2] = base;
+    ev->t += 2;
+    ev->pc = inst->q - 1;
+    break;
+  case OP_EN:
+    returnAddress = s[ev->t - 1];
+    staticLink = s[ev->t];
+    k = ev->t - inst->p - 1;
+    for (i = inst->p - 1; i >= 0; i --)
+      s[k + 4 + i] = s[k + i];
+    s[k + 1] = ev->b;
+    s[k + 2] = returnAddress;
+    s[k + 3] = staticLink;
+    ev->b = k;
+    ev->t = k + inst->q - 1;
+    if (ev->t >= EVAL_STACK_WORDS - CALL_FRAME_WORDS) return FALSE;
+    break;
+  case OP_MC:
+  case OP_MS:
+  case OP_BP:
+    // The memo table is left to the run time
+    break;
+  default:
+    return FALSE;
+  }
+  ev->pc ++;
+  return (ev->t >= -1) && (ev->t < EVAL_STACK_WORDS - CALL_FRAME_WORDS);
+}
+
+// Run the function whose leading jump is at callee on the given arguments
+int evaluateCall(CodeBlock* codeBlock, CodeAddress callee, WORD* args, int argCount, WORD* result) {
+  Evaluator ev;
+  int steps, i, done = FALSE;
+
+  ev.code = codeBlock->code;
+  ev.codeSize = codeBlock->codeSize;
+  ev.data = codeBlock->data;
+  ev.dataSize = codeBlock->dataSize;
+  ev.stack = (WORD*) calloc(EVAL_STACK_WORDS, sizeof(WORD));
+  ev.stack[1] = NO_FRAME;
+  ev.stack[2] = NO_FRAME;
+  ev.stack[3] = NO_FRAME;
+  for (i = 0; i < argCount; i ++)
+    ev.stack[CALL_FRAME_WORDS + i] = args[i];
+  ev.t = CALL_FRAME_WORDS + argCount - 1;
+  ev.b = 0;
+  ev.pc = callee;
+
+  for (steps = 0; steps < EVAL_STEP_LIMIT; steps ++) {
+    if ((ev.pc < 0) || (ev.pc >= ev.codeSize)) break;
+    if (!evaluateStep(&ev)) break;
+    // Back from the evaluated call
+    if (ev.b == NO_FRAME) {
+      done = (ev.t == 0) && (ev.pc == NO_FRAME + 1);
+      *result = ev.stack[0];
+      break;
+    }
+  }
+
+  free(ev.stack);
+  return done;
+}
+
+// Tell whether the call at address call has a pure function compiled
+// earlier as callee and constant arguments; the INT reserving its frame
+// is at frame
+int isConstantCall(CodeBlock* codeBlock, CodeAddress start, CodeAddress call, char* isTarget, CodeAddress* frame) {
+  Instruction* code = codeBlock->code;
+  CompiledBlock* callee;
+  Summary* summary;
+  int n, k;
+
+  if ((code[call].op != OP_CALL) || (code[call - 1].op != OP_DCT)) return FALSE;
+  n = code[call - 1].q - CALL_FRAME_WORDS;
+  callee = findCompiledBlock(code[call].q);
+  if ((n < 0) || (callee == NULL) || (callee->end == 0) || (callee->paramCount != n)) return FALSE;
+  summary = findCallSummary(code + call);
+  if ((summary == NULL) || !summary->isFunction || !isPure(summary)) return FALSE;
+
+  *frame = call - 2 - n;
+  if ((*frame <= start) || (code[*frame].op != OP_INT) || (code[*frame].q != CALL_FRAME_WORDS)) return FALSE;
+  for (k = 1; k <= n; k ++)
+    if (code[*frame + k].op != OP_LC) return FALSE;
+  return !hasJumpTargetInside(isTarget, *frame, n + 3);
+}
+
+int evaluateConstantCalls(CodeBlock* codeBlock, CodeAddress start) {
+  Instruction* code = codeBlock->code;
+  char* isTarget;
+  char* removed;
+  WORD* args;
+  CodeAddress i, frame;
+  WORD result;
+  int k, n, changed, total = 0;
+
+  // Again after each round: the result of a call may be the argument of
+  // another one
+  do {
+    isTarget = (char*) malloc(codeBlock->codeSize + 1);
+    removed = (char*) calloc(codeBlock->codeSize + 1, 1);
+    args = (WORD*) malloc((codeBlock->codeSize + 1) * sizeof(WORD));
+    markJumpTargets(codeBlock, isTarget);
+
+    changed = 0;
+    for (i = start + 1; i < codeBlock->codeSize; i ++) {
+      if (!isConstantCall(codeBlock, start, i, isTarget, &frame)) continue;
+      n = code[i - 1].q - CALL_FRAME_WORDS;
+      for (k = 0; k < n; k ++)
+	args[k] = code[frame + 1 + k].q;
+      if (!evaluateCall(codeBlock, code[i].q, args, n, &result)) continue;
+
+      for (k = frame; k < i; k ++)
+	removed[k] = TRUE;
+      code[i].op = OP_LC;
+      code[i].p = DC_VALUE;
+      code[i].q = result;
+      changed ++;
+    }
+
+    if (changed > 0)
+      removeCode(codeBlock, removed);
+    total += changed;
+    free(isTarget);
+    free(removed);
+    free(args);
+  } while (changed > 0);
+
+  return total;
+}
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "slots.h"
+
+// Inlining. A call to a small procedure or function compiled earlier,
+//
+//    INT 4; arguments; DCT 4+n; CALL level,callee
+//
+// is replaced with a copy of the body of the callee working in the frame
+// of the caller. The frame of the callee becomes a group of hidden slots
+// at the top of the frame of the caller, each argument is stored to the
+// slot of its parameter, and the result of a function is loaded from the
+// slot of its return value after the body.
+//
+// A reference parameter holds the address of the variable, as it does
+// in a call. A parameter the body never writes nor takes the address of,
+// whose argument is a constant or the address of a variable, is replaced
+// with the argument itself.
+//
+// The (*$INLINE*) and (*$NOINLINE*) directives written before a procedure
+// or a function lift the size limit, or forbid inlining its calls.
+
+#define INLINE_SIZE_LIMIT 40      // longest body inlined without a directive
+#define INLINE_GROWTH_LIMIT 1000  // instructions a body may grow by inlining
+#define CALL_FRAME_WORDS 4        // return value, dynamic link, return address, static link
+
+struct CallSite_ {
+  CodeAddress frame;      // the INT reserving the frame of the callee
+  CodeAddress call;
+  int argCount;
+  CompiledBlock* callee;
+  int length;             // of the body to copy
+};
+
+typedef struct CallSite_ CallSite;
+
+// Length of the body of a callee that can be inlined, leaving out the
+// frame allocation and the exit; -1 if it cannot
+int inlinableLength(CodeBlock* codeBlock, CompiledBlock* callee) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+
+  if ((callee->end == 0) || (callee->inlineHint == INLINE_NEVER)) return -1;
+  if (code[callee->bodyStart].op != OP_INT) return -1;
+  if ((code[callee->end - 1].op != OP_EP) && (code[callee->end - 1].op != OP_EF)) return -1;
+
+  for (i = firstBodyAddress(callee); i < callee->end - 1; i ++)
+    switch (code[i].op) {
+    case OP_CALL:
+      // Recursion, and the nested procedures, need the frame of the callee
+      if ((code[i].p == 0) || (code[i].q == callee->blockAddress)) return -1;
+      break;
+    case OP_J:
+    case OP_FJ:
+      if ((code[i].q < firstBodyAddress(callee)) || (code[i].q >= callee->end)) return -1;
+      break;
+    case OP_CS:
+    case OP_TC:
+    case OP_MC:
+    case OP_MS:
+    case OP_HL:
+      // Compact calls and the memo table work on the frame of the callee
+      return -1;
+    default:
+      break;
+    }
+  return callee->end - 1 - firstBodyAddress(callee);
+}
+
+// Start of the expression whose code ends at address end, found by
+// walking back until the words it pushes are accounted for. Returns -1
+// on code that is not an expression.
+CodeAddress expressionStart(CodeBlock* codeBlock, CodeAddress low, CodeAddress end) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+  int need = 1, pops, pushes;
+
+  for (i = end; i >= low; i --) {
+    switch (code[i].op) {
+    case OP_LA:
+    case OP_LV:
+    case OP_LC:
+      pops = 0; pushes = 1;
+      break;
+    case OP_LI:
+    case OP_NEG:
+    case OP_BC:
+    case OP_LD:
+      pops = 1; pushes = 1;
+      break;
+    case OP_AD:
+    case OP_SB:
+    case OP_ML:
+    case OP_DV:
+    case OP_MOD:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GT:
+    case OP_LT:
+    case OP_GE:
+    case OP_LE:
+      pops = 2; pushes = 1;
+      break;
+    case OP_INT:
+      if (code[i].q != CALL_FRAME_WORDS) return -1;
+      pops = 0; pushes = CALL_FRAME_WORDS;
+      break;
+    case OP_CALL:
+      // Taken together with the DCT dropping its frame
+      if ((i == low) || (code[i - 1].op != OP_DCT)) return -1;
+      pushes = callResultCount(codeBlock, code + i);
+      if (pushes < 0) return -1;
+      pops = code[i - 1].q;
+      i --;
+      break;
+    default:
+      return -1;
+    }
+    if (pushes > need) return -1;
+    need += pops - pushes;
+    if (need == 0) return i;
+  }
+  return -1;
+}
+
+// Find where each argument of the call starts; argStart[n] is the DCT.
+// Returns FALSE if the arguments are not all plain expressions.
+int splitArguments(CodeBlock* codeBlock, CodeAddress frame, CodeAddress call, int n, CodeAddress* argStart) {
+  CodeAddress end = call - 2;
+  int k;
+
+  for (k = n - 1; k >= 0; k --) {
+    argStart[k] = expressionStart(codeBlock, frame + 1, end);
+    if (argStart[k] < 0) return FALSE;
+    end = argStart[k] - 1;
+  }
+  argStart[n] = call - 1;
+  return end == frame;
+}
+
+// Find a call in the body that is worth inlining. The outermost calls
+// go first: once inlined, the calls in their arguments have plain
+// expressions as arguments again, whereas the arguments of a call around
+// an inlined body would hold statements.
+int findCallSite(CodeBlock* codeBlock, CodeAddress start, int growth, CallSite* site) {
+  Instruction* code = codeBlock->code;
+  char* isTarget = (char*) malloc(codeBlock->codeSize + 1);
+  CodeAddress* open = (CodeAddress*) malloc((codeBlock->codeSize + 1) * sizeof(CodeAddress));
+  CodeAddress* argStart = (CodeAddress*) malloc((codeBlock->codeSize + 1) * sizeof(CodeAddress));
+  CompiledBlock* callee;
+  CodeAddress i;
+  int top = 0, length, found = FALSE;
+
+  markJumpTargets(codeBlock, isTarget);
+  for (i = start + 1; i < codeBlock->codeSize; i ++) {
+    if (isTarget[i]) top = 0;
+    switch (code[i].op) {
+    case OP_INT:
+      if (code[i].q == CALL_FRAME_WORDS)
+	open[top++] = i;
+      else top = 0;
+      break;
+    case OP_CALL:
+      if ((top == 0) || (code[i - 1].op != OP_DCT) || (code[i - 1].q < CALL_FRAME_WORDS)) {
+	top = 0;
+	break;
+      }
+      top --;
+      callee = findCompiledBlock(code[i].q);
+      if (callee == NULL) break;
+      length = inlinableLength(codeBlock, callee);
+      if (length < 0) break;
+      if ((callee->inlineHint != INLINE_ALWAYS) && (length > INLINE_SIZE_LIMIT)) break;
+      if (growth + length > INLINE_GROWTH_LIMIT) break;
+      if (found && (site->frame < open[top])) break;
+      if (!splitArguments(codeBlock, open[top], i, code[i - 1].q - CALL_FRAME_WORDS, argStart)) break;
+
+      site->frame = open[top];
+      site->call = i;
+      site->argCount = code[i - 1].q - CALL_FRAME_WORDS;
+      site->callee = callee;
+      site->length = length;
+      found = TRUE;
+      break;
+    case OP_J:
+    case OP_FJ:
+    case OP_EP:
+    case OP_EF:
+    case OP_HL:
+      top = 0;
+      break;
+    default:
+      break;
+    }
+  }
+
+  free(isTarget);
+  free(open);
+  free(argStart);
+  return found;
+}
+
+// Tell whether the body of the callee never stores to, nor takes the
+// address of, the word at offset q of its frame
+int isReadOnlySlot(CodeBlock* codeBlock, CompiledBlock* callee, WORD q) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+
+  for (i = firstBodyAddress(callee); i < callee->end - 1; i ++)
+    if ((code[i].op == OP_LA) && (code[i].p == 0) && (code[i].q == q))
+      return FALSE;
+  return TRUE;
+}
+
+int inlineCallSite(CodeBlock* codeBlock, CodeAddress start, CallSite* site) {
+  Instruction* code = codeBlock->code;
+  CompiledBlock* callee = site->callee;
+  int n = site->argCount;
+  CodeAddress* argStart = (CodeAddress*) malloc((n + 1) * sizeof(CodeAddress));
+  Instruction* substitute = (Instruction*) malloc((n + 1) * sizeof(Instruction));
+  char* isSubstituted = (char*) calloc(n + 1, 1);
+  Instruction* newCode;
+  char* isLocal;
+  CodeAddress i, first = firstBodyAddress(callee);
+  WORD base, level, q;
+  int k, count, done;
+
+  splitArguments(codeBlock, site->frame, site->call, n, argStart);
+
+  for (k = 0; k < n; k ++)
+    if ((argStart[k + 1] - argStart[k] == 1) &&
+	((code[argStart[k]].op == OP_LC) || (code[argStart[k]].op == OP_LA)) &&
+	isReadOnlySlot(codeBlock, callee, CALL_FRAME_WORDS + k)) {
+      isSubstituted[k] = TRUE;
+      substitute[k] = code[argStart[k]];
+    }
+
+  count = (site->call - site->frame) + 2 * n + site->length + 1;
+  newCode = (Instruction*) malloc((count + 1) * sizeof(Instruction));
+  isLocal = (char*) calloc(count + 1, 1);
+  base = code[start].q;
+  level = code[site->call].p;
+
+  // Store the arguments to the parameters
+  count = 0;
+  for (k = 0; k < n; k ++) {
+    if (isSubstituted[k]) continue;
+    newCode[count].op = OP_LA;
+    newCode[count].p = 0;
+    newCode[count].q = base + CALL_FRAME_WORDS + k;
+    count ++;
+    for (i = argStart[k]; i < argStart[k + 1]; i ++)
+      newCode[count++] = code[i];
+    newCode[count].op = OP_ST;
+    newCode[count].p = DC_VALUE;
+    newCode[count].q = DC_VALUE;
+    count ++;
+  }
+
+  // Copy the body, moving it to the frame of the caller. Jumps are made
+  // relative to the new code, and an early exit jumps past the body.
+  for (i = first; i < callee->end - 1; i ++) {
+    Instruction* inst = newCode + count;
+
+    *inst = code[i];
+    switch (inst->op) {
+    case OP_LV:
+      q = inst->q - CALL_FRAME_WORDS;
+      if ((inst->p == 0) && (q >= 0) && (q < n) && isSubstituted[q]) {
+	*inst = substitute[q];
+	break;
+      }
+      // Fall through
+    case OP_LA:
+      if (inst->p == 0) inst->q += base;
+      else inst->p += level - 1;
+      break;
+    case OP_CALL:
+      inst->p += level - 1;
+      break;
+    case OP_J:
+    case OP_FJ:
+      inst->q = (count - (i - first)) + (inst->q - first);
+      isLocal[count] = TRUE;
+      break;
+    case OP_EP:
+    case OP_EF:
+      inst->op = OP_J;
+      inst->p = DC_VALUE;
+      inst->q = (count - (i - first)) + site->length;
+      isLocal[count] = TRUE;
+      break;
+    default:
+      break;
+    }
+    count ++;
+  }
+
+  if (code[callee->end - 1].op == OP_EF) {
+    newCode[count].op = OP_LV;
+    newCode[count].p = 0;
+    newCode[count].q = base;
+    count ++;
+  }
+
+  done = replaceCode(codeBlock, site->frame, site->call, newCode, isLocal, count);
+  if (done)
+    code[start].q += code[callee->bodyStart].q;
+
+  free(argStart);
+  free(substitute);
+  free(isSubstituted);
+  free(newCode);
+  free(isLocal);
+  return done;
+}
+
+int inlineCalls(CodeBlock* codeBlock, CodeAddress start) {
+  CallSite site;
+  int growth = 0, count = 0, oldSize;
+
+  if (codeBlock->code[start].op != OP_INT) return 0;
+
+  // One call at a time, since the code moves. Calls inside an inlined
+  // body are candidates too, within the growth limit.
+  while (findCallSite(codeBlock, start, growth, &site)) {
+    oldSize = codeBlock->codeSize;
+    if (!inlineCallSite(codeBlock, start, &site)) break;
+    growth += codeBlock->codeSize - oldSize;
+    count ++;
+  }
+  return count;
+}
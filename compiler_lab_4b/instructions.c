@@ -7,19 +7,25 @@
 #include <stdlib.h>
 #include "instructions.h"
 
-#define MAX_BLOCK 50
-
 CodeBlock* createCodeBlock(int maxSize) {
   CodeBlock* codeBlock = (CodeBlock*) malloc(sizeof(CodeBlock));
 
   codeBlock->code = (Instruction*) malloc(maxSize * sizeof(Instruction));
   codeBlock->codeSize = 0;
   codeBlock->maxSize = maxSize;
+  codeBlock->data = NULL;
+  codeBlock->dataSize = 0;
+  codeBlock->maxDataSize = 0;
+  codeBlock->wordSize = sizeof(WORD);
+  codeBlock->lines = (int*) calloc(maxSize, sizeof(int));
+  codeBlock->line = 0;
   return codeBlock;
 }
 
 void freeCodeBlock(CodeBlock* codeBlock) {
   free(codeBlock->code);
+  free(codeBlock->data);
+  free(codeBlock->lines);
   free(codeBlock);
 }
 
@@ -31,10 +37,24 @@ int emitCode(CodeBlock* codeBlock, enum OpCode op, WORD p, WORD q) {
   bottom->op = op;
   bottom->p = p;
   bottom->q = q;
+  codeBlock->lines[codeBlock->codeSize] = codeBlock->line;
   codeBlock->codeSize ++;
   return 1;
 }
 
+int emitData(CodeBlock* codeBlock, WORD value) {
+  WORD* data;
+
+  if (codeBlock->dataSize == codeBlock->maxDataSize) {
+    data = (WORD*) realloc(codeBlock->data, (2 * codeBlock->maxDataSize + 64) * sizeof(WORD));
+    if (data == NULL) return 0;
+    codeBlock->data = data;
+    codeBlock->maxDataSize = 2 * codeBlock->maxDataSize + 64;
+  }
+  codeBlock->data[codeBlock->dataSize ++] = value;
+  return 1;
+}
+
 int emitLA(CodeBlock* codeBlock, WORD p, WORD q) { return emitCode(codeBlock, OP_LA, p, q); }
 int emitLV(CodeBlock* codeBlock, WORD p, WORD q) { return emitCode(codeBlock, OP_LV, p, q); }
 int emitLC(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_LC, DC_VALUE, q); }
@@ -65,23 +85,118 @@ int emitGT(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_GT, DC_VALUE, D
 int emitLT(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LT, DC_VALUE, DC_VALUE); }
 int emitGE(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_GE, DC_VALUE, DC_VALUE); }
 int emitLE(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LE, DC_VALUE, DC_VALUE); }
+int emitSHL(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_SHL, DC_VALUE, DC_VALUE); }
+int emitSHR(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_SHR, DC_VALUE, DC_VALUE); }
+int emitSRZ(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_SRZ, DC_VALUE, DC_VALUE); }
+int emitMOD(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_MOD, DC_VALUE, DC_VALUE); }
+int emitTC(CodeBlock* codeBlock, WORD p, WORD q) { return emitCode(codeBlock, OP_TC, p, q); }
+int emitCS(CodeBlock* codeBlock, WORD p, WORD q) { return emitCode(codeBlock, OP_CS, p, q); }
+int emitEN(CodeBlock* codeBlock, WORD p, WORD q) { return emitCode(codeBlock, OP_EN, p, q); }
+int emitMC(CodeBlock* codeBlock, WORD p, WORD q) { return emitCode(codeBlock, OP_MC, p, q); }
+int emitMS(CodeBlock* codeBlock, WORD p, WORD q) { return emitCode(codeBlock, OP_MS, p, q); }
+int emitVAD(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_VAD, DC_VALUE, DC_VALUE); }
+int emitVSB(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_VSB, DC_VALUE, DC_VALUE); }
+int emitVML(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_VML, DC_VALUE, DC_VALUE); }
+int emitVFL(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_VFL, DC_VALUE, DC_VALUE); }
+int emitVCP(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_VCP, DC_VALUE, DC_VALUE); }
+int emitVSM(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_VSM, DC_VALUE, DC_VALUE); }
+int emitVDT(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_VDT, DC_VALUE, DC_VALUE); }
+int emitBC(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_BC, DC_VALUE, q); }
+int emitBM(CodeBlock* codeBlock, WORD q) { return emitCode(codeBlock, OP_BM, DC_VALUE, q); }
+int emitLD(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_LD, DC_VALUE, DC_VALUE); }
+int emitJT(CodeBlock* codeBlock, WORD p, WORD q) { return emitCode(codeBlock, OP_JT, p, q); }
+int emitAND(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_AND, DC_VALUE, DC_VALUE); }
+int emitOR(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_OR, DC_VALUE, DC_VALUE); }
+int emitXOR(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_XOR, DC_VALUE, DC_VALUE); }
 
 int emitBP(CodeBlock* codeBlock) { return emitCode(codeBlock, OP_BP, DC_VALUE, DC_VALUE); }
 
 
+char* opCodeToString(enum OpCode op) {
+  switch (op) {
+  case OP_LA: return "LA";
+  case OP_LV: return "LV";
+  case OP_LC: return "LC";
+  case OP_LI: return "LI";
+  case OP_INT: return "INT";
+  case OP_DCT: return "DCT";
+  case OP_J: return "J";
+  case OP_FJ: return "FJ";
+  case OP_HL: return "HL";
+  case OP_ST: return "ST";
+  case OP_CALL: return "CALL";
+  case OP_EP: return "EP";
+  case OP_EF: return "EF";
+  case OP_RC: return "RC";
+  case OP_RI: return "RI";
+  case OP_WRC: return "WRC";
+  case OP_WRI: return "WRI";
+  case OP_WLN: return "WLN";
+  case OP_AD: return "AD";
+  case OP_SB: return "SB";
+  case OP_ML: return "ML";
+  case OP_DV: return "DV";
+  case OP_NEG: return "NEG";
+  case OP_CV: return "CV";
+  case OP_EQ: return "EQ";
+  case OP_NE: return "NE";
+  case OP_GT: return "GT";
+  case OP_LT: return "LT";
+  case OP_GE: return "GE";
+  case OP_LE: return "LE";
+  case OP_SHL: return "SHL";
+  case OP_SHR: return "SHR";
+  case OP_SRZ: return "SRZ";
+  case OP_MOD: return "MOD";
+  case OP_TC: return "TC";
+  case OP_CS: return "CS";
+  case OP_EN: return "EN";
+  case OP_MC: return "MC";
+  case OP_MS: return "MS";
+  case OP_VAD: return "VAD";
+  case OP_VSB: return "VSB";
+  case OP_VML: return "VML";
+  case OP_VFL: return "VFL";
+  case OP_VCP: return "VCP";
+  case OP_VSM: return "VSM";
+  case OP_VDT: return "VDT";
+  case OP_BC: return "BC";
+  case OP_BM: return "BM";
+  case OP_LD: return "LD";
+  case OP_JT: return "JT";
+  case OP_AND: return "AND";
+  case OP_OR: return "OR";
+  case OP_XOR: return "XOR";
+  case OP_CAD: return "CAD";
+  case OP_CSB: return "CSB";
+  case OP_CML: return "CML";
+  case OP_CDV: return "CDV";
+  case OP_CMOD: return "CMOD";
+  case OP_CNEG: return "CNEG";
+  case OP_CSHL: return "CSHL";
+  case OP_CVAD: return "CVAD";
+  case OP_CVSB: return "CVSB";
+  case OP_CVML: return "CVML";
+  case OP_CVSM: return "CVSM";
+  case OP_CVDT: return "CVDT";
+  case OP_BP: return "BP";
+  default: return "";
+  }
+}
+
 void printInstruction(Instruction* inst) {
   switch (inst->op) {
-  case OP_LA: printf("LA %d,%d", inst->p, inst->q); break;
-  case OP_LV: printf("LV %d,%d", inst->p, inst->q); break;
-  case OP_LC: printf("LC %d", inst->q); break;
+  case OP_LA: printf("LA " WORD_FORMAT "," WORD_FORMAT, inst->p, inst->q); break;
+  case OP_LV: printf("LV " WORD_FORMAT "," WORD_FORMAT, inst->p, inst->q); break;
+  case OP_LC: printf("LC " WORD_FORMAT, inst->q); break;
   case OP_LI: printf("LI"); break;
-  case OP_INT: printf("INT %d", inst->q); break;
-  case OP_DCT: printf("DCT %d", inst->q); break;
-  case OP_J: printf("J %d", inst->q); break;
-  case OP_FJ: printf("FJ %d", inst->q); break;
+  case OP_INT: printf("INT " WORD_FORMAT, inst->q); break;
+  case OP_DCT: printf("DCT " WORD_FORMAT, inst->q); break;
+  case OP_J: printf("J " WORD_FORMAT, inst->q); break;
+  case OP_FJ: printf("FJ " WORD_FORMAT, inst->q); break;
   case OP_HL: printf("HL"); break;
   case OP_ST: printf("ST"); break;
-  case OP_CALL: printf("CALL %d,%d", inst->p, inst->q); break;
+  case OP_CALL: printf("CALL " WORD_FORMAT "," WORD_FORMAT, inst->p, inst->q); break;
   case OP_EP: printf("EP"); break;
   case OP_EF: printf("EF"); break;
   case OP_RC: printf("RC"); break;
@@ -101,6 +216,41 @@ void printInstruction(Instruction* inst) {
   case OP_LT: printf("LT"); break;
   case OP_GE: printf("GE"); break;
   case OP_LE: printf("LE"); break;
+  case OP_SHL: printf("SHL"); break;
+  case OP_SHR: printf("SHR"); break;
+  case OP_SRZ: printf("SRZ"); break;
+  case OP_MOD: printf("MOD"); break;
+  case OP_TC: printf("TC " WORD_FORMAT "," WORD_FORMAT, inst->p, inst->q); break;
+  case OP_CS: printf("CS " WORD_FORMAT "," WORD_FORMAT, inst->p, inst->q); break;
+  case OP_EN: printf("EN " WORD_FORMAT "," WORD_FORMAT, inst->p, inst->q); break;
+  case OP_MC: printf("MC " WORD_FORMAT "," WORD_FORMAT, inst->p, inst->q); break;
+  case OP_MS: printf("MS " WORD_FORMAT "," WORD_FORMAT, inst->p, inst->q); break;
+  case OP_VAD: printf("VAD"); break;
+  case OP_VSB: printf("VSB"); break;
+  case OP_VML: printf("VML"); break;
+  case OP_VFL: printf("VFL"); break;
+  case OP_VCP: printf("VCP"); break;
+  case OP_VSM: printf("VSM"); break;
+  case OP_VDT: printf("VDT"); break;
+  case OP_BC: printf("BC " WORD_FORMAT, inst->q); break;
+  case OP_BM: printf("BM " WORD_FORMAT, inst->q); break;
+  case OP_LD: printf("LD"); break;
+  case OP_JT: printf("JT " WORD_FORMAT "," WORD_FORMAT, inst->p, inst->q); break;
+  case OP_AND: printf("AND"); break;
+  case OP_OR: printf("OR"); break;
+  case OP_XOR: printf("XOR"); break;
+  case OP_CAD: printf("CAD"); break;
+  case OP_CSB: printf("CSB"); break;
+  case OP_CML: printf("CML"); break;
+  case OP_CDV: printf("CDV"); break;
+  case OP_CMOD: printf("CMOD"); break;
+  case OP_CNEG: printf("CNEG"); break;
+  case OP_CSHL: printf("CSHL"); break;
+  case OP_CVAD: printf("CVAD"); break;
+  case OP_CVSB: printf("CVSB"); break;
+  case OP_CVML: printf("CVML"); break;
+  case OP_CVSM: printf("CVSM"); break;
+  case OP_CVDT: printf("CVDT"); break;
 
   case OP_BP: printf("BP"); break;
   default: break;
@@ -116,22 +266,84 @@ void printCodeBlock(CodeBlock* codeBlock) {
     printf("\n");
     pc ++;
   }
+  for (i = 0; i < codeBlock->dataSize; i ++)
+    printf("d%d:  " WORD_FORMAT "\n", i, codeBlock->data[i]);
 }
 
 
-void loadCode(CodeBlock* codeBlock, FILE* f) {
-  Instruction* code = codeBlock->code;
-  int n;
+int loadCode(CodeBlock* codeBlock, FILE* f) {
+  ExecutableHeader header;
 
   codeBlock->codeSize = 0;
-  while (!feof(f)) {
-    n = fread(code, sizeof(Instruction), MAX_BLOCK, f);
-    code += n;
-    codeBlock->codeSize += n;
+  codeBlock->dataSize = 0;
+  if (fread(&header, sizeof(ExecutableHeader), 1, f) != 1) return 0;
+  codeBlock->wordSize = header.wordSize;
+  if (header.wordSize != sizeof(WORD)) return 0;
+  if ((header.codeSize < 0) || (header.codeSize > codeBlock->maxSize) || (header.dataSize < 0))
+    return 0;
+
+  codeBlock->codeSize = fread(codeBlock->code, sizeof(Instruction), header.codeSize, f);
+  if (codeBlock->codeSize != header.codeSize) return 0;
+
+  // The data segment is read into place at once
+  codeBlock->data = (WORD*) malloc((header.dataSize + 1) * sizeof(WORD));
+  if (codeBlock->data == NULL) return 0;
+  codeBlock->maxDataSize = header.dataSize;
+  codeBlock->dataSize = fread(codeBlock->data, sizeof(WORD), header.dataSize, f);
+  if (codeBlock->dataSize != header.dataSize) return 0;
+  return loadLineTable(codeBlock, f);
+}
+
+// Read the line table that may follow the data segment into the line of
+// each instruction. Returns 0 if the table is there but broken.
+int loadLineTable(CodeBlock* codeBlock, FILE* f) {
+  LineEntry entry;
+  CodeAddress next = 0;
+  int count, line = 0;
+
+  if (fread(&count, sizeof(int), 1, f) != 1) return 1;
+  if (count < 0) return 0;
+  for (; count > 0; count --) {
+    if (fread(&entry, sizeof(LineEntry), 1, f) != 1) return 0;
+    if ((entry.address < next) || (entry.address > codeBlock->codeSize)) return 0;
+    for (; next < entry.address; next ++)
+      codeBlock->lines[next] = line;
+    line = entry.line;
   }
+  for (; next < codeBlock->codeSize; next ++)
+    codeBlock->lines[next] = line;
+  return 1;
 }
 
 
 void saveCode(CodeBlock* codeBlock, FILE* f) {
+  ExecutableHeader header;
+
+  header.wordSize = sizeof(WORD);
+  header.codeSize = codeBlock->codeSize;
+  header.dataSize = codeBlock->dataSize;
+  fwrite(&header, sizeof(ExecutableHeader), 1, f);
   fwrite(codeBlock->code, sizeof(Instruction), codeBlock->codeSize, f);
+  if (codeBlock->dataSize > 0)
+    fwrite(codeBlock->data, sizeof(WORD), codeBlock->dataSize, f);
+}
+
+// Write the line table, one entry where the line changes
+void saveLineTable(CodeBlock* codeBlock, FILE* f) {
+  LineEntry entry;
+  CodeAddress i;
+  int count = 0, line = 0;
+
+  for (i = 0; i < codeBlock->codeSize; i ++)
+    if ((i == 0) || (codeBlock->lines[i] != line)) {
+      line = codeBlock->lines[i];
+      count ++;
+    }
+  fwrite(&count, sizeof(int), 1, f);
+  for (i = 0; i < codeBlock->codeSize; i ++)
+    if ((i == 0) || (codeBlock->lines[i] != line)) {
+      entry.address = i;
+      entry.line = line = codeBlock->lines[i];
+      fwrite(&entry, sizeof(LineEntry), 1, f);
+    }
 }
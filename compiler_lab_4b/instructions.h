@@ -8,14 +8,33 @@
 #define __INSTRUCTIONS_H__
 
 #include <stdio.h>
+#include <limits.h>
 
 #define TRUE 1
 #define FALSE 0
 #define DC_VALUE 0
 #define INT_SIZE 1
 #define CHAR_SIZE 1
-
+#define MEMO_KEY_WORDS 4    // most arguments of a function called through the memo table
+
+// Words are 32 bits wide, or 64 bits when built with WORD64 (make
+// WORD64=1). The code of one size does not run on a VM of the other.
+#ifdef WORD64
+typedef long long WORD;
+typedef unsigned long long UWORD;
+#define WORD_MIN LLONG_MIN
+#define WORD_MAX LLONG_MAX
+#define WORD_FORMAT "%lld"
+#else
 typedef int WORD;
+typedef unsigned int UWORD;
+#define WORD_MIN INT_MIN
+#define WORD_MAX INT_MAX
+#define WORD_FORMAT "%d"
+#endif
+
+#define WORD_BITS ((int) (8 * sizeof(WORD)))
+#define SHIFT_MASK (WORD_BITS - 1)  // shift counts are taken modulo the bits of a WORD
 
 enum OpCode {
   OP_LA,   // Load Address:    t := t + 1; s[t] := base(p) + q;
@@ -48,6 +67,47 @@ enum OpCode {
   OP_LT,   // Less             t := t - 1;  if s[t] < s[t+1] then s[t] := 1 else s[t] := 0;
   OP_GE,   // Greater or Equal t := t - 1;  if s[t] >= s[t+1] then s[t] := 1 else s[t] := 0;
   OP_LE,   // Less or Equal    t := t - 1;  if s[t] >= s[t+1] then s[t] := 1 else s[t] := 0;
+  OP_SHL,  // Shift Left       t := t-1;  s[t] := s[t] << s[t+1];  (the count taken modulo WORD_BITS)
+  OP_SHR,  // Shift Right      t := t-1;  s[t] := s[t] >> s[t+1];  (arithmetic, rounds toward -oo; the count modulo WORD_BITS)
+  OP_SRZ,  // Shift Right Zero t := t-1;  s[t] := s[t] / 2^s[t+1];  (rounds toward 0, as OP_DV)
+  OP_MOD,  // Remainder        t := t-1;  s[t] := s[t] - (s[t] / s[t+1]) * s[t+1];
+  OP_TC,   // Tail Call        s[b+4..b+3+q] := s[t-q+1..t]; s[b+3] := base(p); t := b-1;  (then J to the callee)
+  OP_CS,   // Call Short       s[t+1] := pc; s[t+2] := base(p) (0 if p = -1); t := t+2; pc := q;
+  OP_EN,   // Enter            b' := t-p-1; s[b'+4..b'+3+p] := s[b'..b'+p-1]; s[b'+1] := b; s[b'+2] := s[t-1];
+           //                  s[b'+3] := s[t]; b := b'; t := b'+q-1;
+  OP_MC,   // Memo Check       if memo(q, s[b+4..b+3+p]) is known then s[b] := memo(q, ...); exit as EF
+  OP_MS,   // Memo Store       memo(q, s[b+4..b+3+p]) := s[b];
+  OP_VAD,  // Vector Add       n := s[t]; s[s[t-3]+k] := s[s[t-2]+k] + s[s[t-1]+k] for 0 <= k < n; t := t-4;
+  OP_VSB,  // Vector Subtract  n := s[t]; s[s[t-3]+k] := s[s[t-2]+k] - s[s[t-1]+k] for 0 <= k < n; t := t-4;
+  OP_VML,  // Vector Multiply  n := s[t]; s[s[t-3]+k] := s[s[t-2]+k] * s[s[t-1]+k] for 0 <= k < n; t := t-4;
+  OP_VFL,  // Vector Fill      n := s[t]; s[s[t-2]+k] := s[t-1] for 0 <= k < n; t := t-3;
+  OP_VCP,  // Vector Copy      n := s[t]; s[s[t-2]+k] := s[s[t-1]+k] for k = 0, 1, ..., n-1; t := t-3;
+  OP_VSM,  // Vector Sum       t := t-1; s[t] := s[s[t]] + s[s[t]+1] + ... + s[s[t]+s[t+1]-1];
+  OP_VDT,  // Vector Dot       t := t-2; s[t] := s[s[t]] * s[s[t+1]] + ... + s[s[t]+n-1] * s[s[t+1]+n-1], n = s[t+2];
+  OP_BC,   // Bounds Check     if s[t] < 1 or s[t] > q then stop with an error;
+  OP_BM,   // Block Move       s[s[t-1]..s[t-1]+q-1] := s[s[t]..s[t]+q-1];  t := t-2;  (as memmove)
+  OP_LD,   // Load Data        s[t] := d[s[t]];  (d the read-only data segment)
+  OP_JT,   // Jump Table       k := s[t] - p;  t := t-1;  if k < 0 or k >= q then k := q;
+           //                  pc := the target of the J at pc+1+k;  (q+1 J follow, the last one the default)
+  OP_AND,  // Bitwise And      t := t-1;  s[t] := s[t] & s[t+1];
+  OP_OR,   // Bitwise Or       t := t-1;  s[t] := s[t] | s[t+1];
+  OP_XOR,  // Bitwise Xor      t := t-1;  s[t] := s[t] ^ s[t+1];
+  // The checked variants of the arithmetic instructions stop with an
+  // error where the result does not fit in a word. The compiler never
+  // emits them: kplrun -checked puts them in place of AD, SB, ML, DV,
+  // MOD, NEG, SHL and the vector arithmetic when it loads the code.
+  OP_CAD,  // Checked Add      as OP_AD
+  OP_CSB,  // Checked Subtract as OP_SB
+  OP_CML,  // Checked Multiply as OP_ML
+  OP_CDV,  // Checked Divide   as OP_DV;  WORD_MIN / -1 overflows
+  OP_CMOD, // Checked Remainder as OP_MOD;  WORD_MIN Mod -1 is 0
+  OP_CNEG, // Checked Negative as OP_NEG
+  OP_CSHL, // Checked Shift Left as OP_SHL;  shifting out a significant bit overflows
+  OP_CVAD, // Checked Vector Add      as OP_VAD, one word at a time
+  OP_CVSB, // Checked Vector Subtract as OP_VSB, one word at a time
+  OP_CVML, // Checked Vector Multiply as OP_VML, one word at a time
+  OP_CVSM, // Checked Vector Sum      as OP_VSM, one word at a time
+  OP_CVDT, // Checked Vector Dot      as OP_VDT, one word at a time
 
   OP_BP    // Break point. Just for debugging
 };
@@ -65,14 +125,41 @@ struct CodeBlock_ {
   Instruction* code;
   int codeSize;
   int maxSize;
+  WORD* data;             // the read-only data segment, read by LD
+  int dataSize;
+  int maxDataSize;
+  int wordSize;           // of the executable loaded
+  int* lines;             // source line of each instruction, 0 if not known
+  int line;               // of the instructions emitted next
 };
 
 typedef struct CodeBlock_ CodeBlock;
 
+// An executable starts with the size of its words in bytes, and the
+// sizes of its code and of its data segment, which follow in that order
+struct ExecutableHeader_ {
+  int wordSize;
+  int codeSize;
+  int dataSize;
+};
+
+typedef struct ExecutableHeader_ ExecutableHeader;
+
+// The data segment may be followed by a line table: its number of
+// entries, then for each one the address of an instruction and the
+// source line of the instructions from there up to the next entry
+struct LineEntry_ {
+  int address;
+  int line;
+};
+
+typedef struct LineEntry_ LineEntry;
+
 CodeBlock* createCodeBlock(int maxSize);
 void freeCodeBlock(CodeBlock* codeBlock);
 
 int emitCode(CodeBlock* codeBlock, enum OpCode op, WORD p, WORD q);
+int emitData(CodeBlock* codeBlock, WORD value);
 
 int emitLA(CodeBlock* codeBlock, WORD p, WORD q);
 int emitLV(CodeBlock* codeBlock, WORD p, WORD q);
@@ -104,13 +191,39 @@ int emitGT(CodeBlock* codeBlock);
 int emitLT(CodeBlock* codeBlock);
 int emitGE(CodeBlock* codeBlock);
 int emitLE(CodeBlock* codeBlock);
+int emitSHL(CodeBlock* codeBlock);
+int emitSHR(CodeBlock* codeBlock);
+int emitSRZ(CodeBlock* codeBlock);
+int emitMOD(CodeBlock* codeBlock);
+int emitTC(CodeBlock* codeBlock, WORD p, WORD q);
+int emitCS(CodeBlock* codeBlock, WORD p, WORD q);
+int emitEN(CodeBlock* codeBlock, WORD p, WORD q);
+int emitMC(CodeBlock* codeBlock, WORD p, WORD q);
+int emitMS(CodeBlock* codeBlock, WORD p, WORD q);
+int emitVAD(CodeBlock* codeBlock);
+int emitVSB(CodeBlock* codeBlock);
+int emitVML(CodeBlock* codeBlock);
+int emitVFL(CodeBlock* codeBlock);
+int emitVCP(CodeBlock* codeBlock);
+int emitVSM(CodeBlock* codeBlock);
+int emitVDT(CodeBlock* codeBlock);
+int emitBC(CodeBlock* codeBlock, WORD q);
+int emitBM(CodeBlock* codeBlock, WORD q);
+int emitLD(CodeBlock* codeBlock);
+int emitJT(CodeBlock* codeBlock, WORD p, WORD q);
+int emitAND(CodeBlock* codeBlock);
+int emitOR(CodeBlock* codeBlock);
+int emitXOR(CodeBlock* codeBlock);
 
 int emitBP(CodeBlock* codeBlock);
 
+char* opCodeToString(enum OpCode op);
 void printInstruction(Instruction* instruction);
 void printCodeBlock(CodeBlock* codeBlock);
 
-void loadCode(CodeBlock* codeBlock, FILE* f);
+int loadCode(CodeBlock* codeBlock, FILE* f);
+int loadLineTable(CodeBlock* codeBlock, FILE* f);
 void saveCode(CodeBlock* codeBlock, FILE* f);
+void saveLineTable(CodeBlock* codeBlock, FILE* f);
 
 #endif
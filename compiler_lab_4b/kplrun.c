@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vm.h"
+
+int vmStackSize = DEFAULT_STACK_SIZE;
+int dumpCode = 0;
+int showStatistics = 0;
+int checkArithmetic = 0;
+
+void printUsage(void) {
+  printf("Usage: kplrun input [-s=stack-size] [-dump] [-stat] [-checked]\n");
+  printf("   input: kpl executable\n");
+  printf("   -s=stack-size: size of the vm stack in words\n");
+  printf("   -dump: code dump\n");
+  printf("   -stat: print executed instruction counts and peak stack\n");
+  printf("   -checked: stop with an error on integer overflow\n");
+}
+
+int analyseParam(char* param) {
+  if (strncmp(param, "-s=", 3) == 0) {
+    vmStackSize = atoi(param + 3);
+    return (vmStackSize > 0);
+  }
+  if (strcmp(param, "-dump") == 0) {
+    dumpCode = 1;
+    return 1;
+  }
+  if (strcmp(param, "-stat") == 0) {
+    showStatistics = 1;
+    return 1;
+  }
+  if (strcmp(param, "-checked") == 0) {
+    checkArithmetic = 1;
+    return 1;
+  }
+  return 0;
+}
+
+/******************************************************************/
+
+int main(int argc, char *argv[]) {
+  FILE* f;
+  int i;
+  int status;
+
+  if (argc <= 1) {
+    printf("kplrun: no input file.\n");
+    printUsage();
+    return -1;
+  }
+
+  for (i = 2; i < argc; i ++)
+    if (!analyseParam(argv[i])) {
+      printf("kplrun: invalid option %s.\n", argv[i]);
+      printUsage();
+      return -1;
+    }
+
+  if (!initVM(vmStackSize)) {
+    printf("Can\'t allocate the stack!\n");
+    return -1;
+  }
+
+  f = fopen(argv[1], "rb");
+  if (f == NULL) {
+    printf("Can\'t read input file!\n");
+    return -1;
+  }
+
+  if (!loadExecutable(f)) {
+    printf("Invalid executable!\n");
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+
+  if (checkArithmetic) enableCheckedArithmetic();
+
+  if (dumpCode) {
+    dumpExecutable();
+    cleanVM();
+    return 0;
+  }
+
+  if (showStatistics) enableStatistics();
+  status = run();
+  printStatus();
+  if (showStatistics) printStatistics();
+
+  cleanVM();
+  return (status == PS_NORMAL_EXIT) ? 0 : status;
+}
@@ -0,0 +1,817 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "cfg.h"
+#include "slots.h"
+#include "summary.h"
+
+// Loop-invariant code motion. Natural loops are found from the back edges
+// of the control flow graph. Side-effect free code in a loop that only
+// loads slots the loop never writes is computed once, before the loop
+// header, into a hidden frame slot. Stores through unknown addresses
+// write every slot that is not private (see slots.h); a call writes the
+// slots named by the summary of its callee (see summary.h).
+//
+// Induction variables. In a FOR loop (see ForStatement in optimizer.h),
+// code computing v * c + e, v the variable of the loop and e invariant,
+// such as the address of the element of an array at index v, is computed
+// once before the loop into a hidden frame slot. The slot grows by c
+// with v, right before the latch, and the code in the loop loads it.
+
+#define INDUCTION_STEP_LENGTH 5   // LA 0,t; LV 0,t; LC c; AD; ST
+
+struct Loop_ {
+  int header;
+  char* inLoop;           // the blocks of the loop
+  int size;               // number of instructions, to handle inner loops first
+  int killsShared;        // a call, or a store through an unknown address
+  SlotAccess* kills;      // the slots written in the loop
+  int killCount;
+  SlotAnalysis* analysis;
+};
+
+typedef struct Loop_ Loop;
+
+struct LoopEntry_ {
+  CodeAddress start;      // -1 if the word cannot be recomputed
+  CodeAddress end;
+  int invariant;
+  int isAddress;          // pushed by LA p,q
+  int isConstant;
+  WORD p, q;
+};
+
+typedef struct LoopEntry_ LoopEntry;
+
+struct Candidate_ {
+  CodeAddress start;
+  CodeAddress end;
+  WORD step;              // of an induction variable
+};
+
+typedef struct Candidate_ Candidate;
+
+/******************* Loops ******************************/
+
+// dom[n * count + m] tells whether block m dominates block n
+char* computeDominators(ControlFlowGraph* cfg) {
+  int count = cfg->blockCount;
+  char* dom = (char*) malloc(count * count);
+  char* meet = (char*) malloc(count);
+  int changed, n, m, pred, first;
+
+  memset(dom, TRUE, count * count);
+  memset(dom, FALSE, count);
+  dom[0] = TRUE;
+
+  do {
+    changed = FALSE;
+    for (n = 1; n < count; n ++) {
+      if (!cfg->blocks[n].reachable) continue;
+      first = TRUE;
+      memset(meet, FALSE, count);
+      for (pred = 0; pred < count; pred ++) {
+	if (!cfg->blocks[pred].reachable) continue;
+	if ((cfg->blocks[pred].fallThrough != n) && (cfg->blocks[pred].jumpTarget != n)) continue;
+	for (m = 0; m < count; m ++)
+	  meet[m] = first ? dom[pred * count + m] : (meet[m] && dom[pred * count + m]);
+	first = FALSE;
+      }
+      meet[n] = TRUE;
+      if (memcmp(meet, dom + n * count, count) != 0) {
+	memcpy(dom + n * count, meet, count);
+	changed = TRUE;
+      }
+    }
+  } while (changed);
+
+  free(meet);
+  return dom;
+}
+
+int isPredecessor(ControlFlowGraph* cfg, int pred, int n) {
+  return cfg->blocks[pred].reachable &&
+    ((cfg->blocks[pred].fallThrough == n) || (cfg->blocks[pred].jumpTarget == n));
+}
+
+// Add to the loop of header h the blocks reaching the back edge source n
+void collectLoop(ControlFlowGraph* cfg, Loop* loop, int n) {
+  int* work = (int*) malloc(cfg->blockCount * sizeof(int));
+  int top = 0;
+  int pred;
+
+  if (!loop->inLoop[n]) {
+    loop->inLoop[n] = TRUE;
+    work[top++] = n;
+  }
+  while (top > 0) {
+    n = work[--top];
+    for (pred = 0; pred < cfg->blockCount; pred ++)
+      if (!loop->inLoop[pred] && isPredecessor(cfg, pred, n)) {
+	loop->inLoop[pred] = TRUE;
+	work[top++] = pred;
+      }
+  }
+  free(work);
+}
+
+void addKill(Loop* loop, SlotAccess* access) {
+  int i;
+
+  for (i = 0; i < loop->killCount; i ++)
+    if ((loop->kills[i].p == access->p) && (loop->kills[i].q == access->q))
+      return;
+  loop->kills = (SlotAccess*) realloc(loop->kills, (loop->killCount + 1) * sizeof(SlotAccess));
+  loop->kills[loop->killCount++] = *access;
+}
+
+int isKilled(Loop* loop, WORD p, WORD q) {
+  int i;
+
+  if (loop->killsShared && !isPrivateSlot(loop->analysis, p, q)) return TRUE;
+  for (i = 0; i < loop->killCount; i ++)
+    if ((loop->kills[i].p == p) && (loop->kills[i].q == q))
+      return TRUE;
+  return FALSE;
+}
+
+// The slots a call writes, seen from the caller
+void addCallKills(Loop* loop, Instruction* call) {
+  Summary* summary = findCallSummary(call);
+  SlotAccess access;
+  Effect* effect;
+  int i;
+
+  if ((summary == NULL) || summary->effects.writesAny) {
+    loop->killsShared = TRUE;
+    return;
+  }
+  for (i = 0; i < summary->effects.count; i ++) {
+    effect = summary->effects.effects + i;
+    if (effect->kind != EFFECT_WRITE) continue;
+    if (effect->indirect || effect->indexed) {
+      loop->killsShared = TRUE;
+      return;
+    }
+    access.kind = SA_WRITE;
+    access.known = TRUE;
+    access.p = call->p + effect->p - 1;
+    access.q = effect->q;
+    addKill(loop, &access);
+  }
+}
+
+void findKills(ControlFlowGraph* cfg, Loop* loop, SlotAnalysis* analysis) {
+  Instruction* code = cfg->codeBlock->code;
+  CodeAddress i;
+  int n;
+
+  loop->analysis = analysis;
+  loop->size = 0;
+  for (n = 0; n < cfg->blockCount; n ++) {
+    if (!loop->inLoop[n]) continue;
+    for (i = cfg->blocks[n].start; i < cfg->blocks[n].end; i ++) {
+      SlotAccess* access = analysis->accesses + (i - cfg->start);
+
+      loop->size ++;
+      if (code[i].op == OP_CALL)
+	addCallKills(loop, code + i);
+      else if (access->kind == SA_WRITE) {
+	if (access->known) addKill(loop, access);
+	else loop->killsShared = TRUE;
+      }
+    }
+  }
+}
+
+int compareLoopSize(const void* l1, const void* l2) {
+  return ((const Loop*) l1)->size - ((const Loop*) l2)->size;
+}
+
+// Find the natural loops of the graph, inner loops first
+Loop* findLoops(ControlFlowGraph* cfg, SlotAnalysis* analysis, int* loopCount) {
+  char* dom = computeDominators(cfg);
+  Loop* loops = NULL;
+  int count = 0;
+  int n, h, j, k, succ[2];
+
+  for (n = 0; n < cfg->blockCount; n ++) {
+    if (!cfg->blocks[n].reachable) continue;
+    succ[0] = cfg->blocks[n].fallThrough;
+    succ[1] = cfg->blocks[n].jumpTarget;
+    for (k = 0; k < 2; k ++) {
+      h = succ[k];
+      if ((h == NO_BLOCK) || !dom[n * cfg->blockCount + h]) continue;
+
+      // A back edge: join the loops sharing a header
+      for (j = 0; j < count; j ++)
+	if (loops[j].header == h) break;
+      if (j == count) {
+	loops = (Loop*) realloc(loops, (count + 1) * sizeof(Loop));
+	memset(loops + count, 0, sizeof(Loop));
+	loops[count].header = h;
+	loops[count].inLoop = (char*) calloc(cfg->blockCount, 1);
+	loops[count].inLoop[h] = TRUE;
+	count ++;
+      }
+      collectLoop(cfg, loops + j, n);
+    }
+  }
+
+  for (k = 0; k < count; k ++)
+    findKills(cfg, loops + k, analysis);
+  if (count > 0)
+    qsort(loops, count, sizeof(Loop), compareLoopSize);
+
+  free(dom);
+  *loopCount = count;
+  return loops;
+}
+
+void freeLoops(Loop* loops, int count) {
+  int k;
+
+  for (k = 0; k < count; k ++) {
+    free(loops[k].inLoop);
+    free(loops[k].kills);
+  }
+  free(loops);
+}
+
+// The block that the preheader code is appended to: the header must be
+// entered from outside the loop only by falling through from the block
+// just above it
+int findPreheader(ControlFlowGraph* cfg, Loop* loop) {
+  BasicBlock* header = cfg->blocks + loop->header;
+  int above, pred;
+
+  if (header->start == cfg->start) return NO_BLOCK;
+  above = cfg->blockOf[header->start - 1 - cfg->start];
+  if (loop->inLoop[above] || !cfg->blocks[above].reachable ||
+      (cfg->blocks[above].fallThrough != loop->header) ||
+      (cfg->blocks[above].jumpTarget == loop->header))
+    return NO_BLOCK;
+
+  for (pred = 0; pred < cfg->blockCount; pred ++)
+    if ((pred != above) && !loop->inLoop[pred] && isPredecessor(cfg, pred, loop->header))
+      return NO_BLOCK;
+  return above;
+}
+
+/******************* Invariant code ******************************/
+
+void pushLoopEntry(LoopEntry* stack, int* top, CodeAddress start, CodeAddress end, int invariant) {
+  stack[*top].start = start;
+  stack[*top].end = end;
+  stack[*top].invariant = invariant && (start >= 0);
+  stack[*top].isAddress = FALSE;
+  stack[*top].isConstant = FALSE;
+  (*top) ++;
+}
+
+LoopEntry popLoopEntry(LoopEntry* stack, int* top) {
+  LoopEntry entry;
+
+  if (*top > 0) return stack[-- (*top)];
+  memset(&entry, 0, sizeof(LoopEntry));
+  entry.start = -1;
+  entry.end = -1;
+  return entry;
+}
+
+// A read of the data segment stops the program outside of it: only a
+// constant index inside it cannot fail
+int isSafeDataIndex(CodeBlock* codeBlock, CodeAddress start, CodeAddress end) {
+  Instruction* index;
+
+  if ((start < 0) || (end != start + 1)) return FALSE;
+  index = codeBlock->code + start;
+  return (index->op == OP_LC) && (index->q >= 0) && (index->q < codeBlock->dataSize);
+}
+
+// Only a division by a constant other than 0 and -1, or a read of the data
+// segment at a constant index inside it, cannot fail, and so may run
+// before a loop that would not have run it. operand is the divisor or the
+// index.
+int cannotFail(CodeBlock* codeBlock, enum OpCode op, LoopEntry* operand) {
+  Instruction* code = codeBlock->code;
+
+  if (op == OP_LD) return isSafeDataIndex(codeBlock, operand->start, operand->end);
+  if ((op != OP_DV) && (op != OP_MOD)) return TRUE;
+  return operand->isConstant && (code[operand->start].q != 0) && (code[operand->start].q != -1);
+}
+
+// Collect the invariant code of one block of the loop
+void findInvariants(ControlFlowGraph* cfg, Loop* loop, int n, Candidate** candidates, int* count) {
+  BasicBlock* block = cfg->blocks + n;
+  Instruction* code = cfg->codeBlock->code;
+  LoopEntry* stack;
+  LoopEntry a, b;
+  CodeAddress i;
+  int top = 0, invariant;
+
+  // A block pushes at most two words per instruction
+  stack = (LoopEntry*) malloc(2 * (block->end - block->start + 1) * sizeof(LoopEntry));
+  for (i = block->start; i < block->end; i ++) {
+    Instruction* inst = code + i;
+
+    switch (inst->op) {
+    case OP_LC:
+      pushLoopEntry(stack, &top, i, i + 1, TRUE);
+      stack[top - 1].isConstant = TRUE;
+      break;
+    case OP_LA:
+      pushLoopEntry(stack, &top, i, i + 1, TRUE);
+      stack[top - 1].isAddress = TRUE;
+      stack[top - 1].p = inst->p;
+      stack[top - 1].q = inst->q;
+      break;
+    case OP_LV:
+      pushLoopEntry(stack, &top, i, i + 1, !isKilled(loop, inst->p, inst->q));
+      break;
+    case OP_LI:
+      a = popLoopEntry(stack, &top);
+      invariant = a.invariant && a.isAddress && !isKilled(loop, a.p, a.q);
+      pushLoopEntry(stack, &top, (a.end == i) ? a.start : -1, i + 1, invariant);
+      break;
+    case OP_NEG:
+      a = popLoopEntry(stack, &top);
+      pushLoopEntry(stack, &top, (a.end == i) ? a.start : -1, i + 1, a.invariant);
+      break;
+    case OP_LD:
+      // The data segment is never written
+      a = popLoopEntry(stack, &top);
+      invariant = a.invariant && cannotFail(cfg->codeBlock, inst->op, &a);
+      pushLoopEntry(stack, &top, (a.end == i) ? a.start : -1, i + 1, invariant);
+      break;
+    case OP_AD:
+    case OP_SB:
+    case OP_ML:
+    case OP_DV:
+    case OP_MOD:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_SRZ:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GT:
+    case OP_LT:
+    case OP_GE:
+    case OP_LE:
+      b = popLoopEntry(stack, &top);
+      a = popLoopEntry(stack, &top);
+      invariant = a.invariant && b.invariant && cannotFail(cfg->codeBlock, inst->op, &b);
+      pushLoopEntry(stack, &top, ((b.start == a.end) && (b.end == i)) ? a.start : -1, i + 1, invariant);
+      break;
+    case OP_CV:
+      if (top == 0)
+	pushLoopEntry(stack, &top, -1, -1, FALSE);
+      pushLoopEntry(stack, &top, -1, i + 1, FALSE);
+      break;
+    case OP_RC:
+    case OP_RI:
+      pushLoopEntry(stack, &top, -1, i + 1, FALSE);
+      break;
+    case OP_ST:
+      popLoopEntry(stack, &top);
+      popLoopEntry(stack, &top);
+      break;
+    case OP_WRC:
+    case OP_WRI:
+    case OP_FJ:
+    case OP_JT:
+      popLoopEntry(stack, &top);
+      break;
+    default:
+      // Anything that moves the stack in other ways ends the block for us
+      top = 0;
+      break;
+    }
+
+    if ((top > 0) && stack[top - 1].invariant && (stack[top - 1].end - stack[top - 1].start >= 2)) {
+      *candidates = (Candidate*) realloc(*candidates, (*count + 1) * sizeof(Candidate));
+      (*candidates)[*count].start = stack[top - 1].start;
+      (*candidates)[*count].end = stack[top - 1].end;
+      (*count) ++;
+    }
+  }
+  free(stack);
+}
+
+int compareCandidateLength(const void* c1, const void* c2) {
+  const Candidate* a = (const Candidate*) c1;
+  const Candidate* b = (const Candidate*) c2;
+
+  if ((a->end - a->start) != (b->end - b->start))
+    return (b->end - b->start) - (a->end - a->start);
+  return a->start - b->start;
+}
+
+int isClaimed(char* claimed, Candidate* candidate) {
+  CodeAddress i;
+
+  for (i = candidate->start; i < candidate->end; i ++)
+    if (claimed[i]) return TRUE;
+  return FALSE;
+}
+
+// Hoist the largest invariant code of the loop. Returns the number of
+// pieces of code moved.
+int hoistInvariants(ControlFlowGraph* cfg, Loop* loop, CodeEdits* edits, WORD* frameSize) {
+  Instruction* code = cfg->codeBlock->code;
+  Candidate* candidates = NULL;
+  Candidate* c;
+  Candidate* other;
+  CodeAddress preheaderEnd, i;
+  char* claimed;
+  int count = 0, hoisted = 0;
+  int n, length;
+  WORD temp;
+
+  n = findPreheader(cfg, loop);
+  if (n == NO_BLOCK) return 0;
+  preheaderEnd = cfg->blocks[n].end - 1;
+
+  for (n = 0; n < cfg->blockCount; n ++)
+    if (loop->inLoop[n])
+      findInvariants(cfg, loop, n, &candidates, &count);
+  if (count == 0) return 0;
+
+  qsort(candidates, count, sizeof(Candidate), compareCandidateLength);
+  claimed = (char*) calloc(cfg->codeBlock->codeSize + 1, 1);
+
+  for (c = candidates; c < candidates + count; c ++) {
+    if (isClaimed(claimed, c)) continue;
+    length = c->end - c->start;
+
+    // Compute it once before the header ...
+    temp = (*frameSize) ++;
+    insertCodeAfter(edits, preheaderEnd, OP_LA, 0, temp);
+    for (i = c->start; i < c->end; i ++)
+      insertCodeAfter(edits, preheaderEnd, code[i].op, code[i].p, code[i].q);
+    insertCodeAfter(edits, preheaderEnd, OP_ST, DC_VALUE, DC_VALUE);
+
+    // ... and load it wherever the same code appears in the loop
+    for (other = c; other < candidates + count; other ++) {
+      if ((other->end - other->start != length) || isClaimed(claimed, other) ||
+	  !sameCode(cfg->codeBlock, c->start, other->start, length))
+	continue;
+      memset(claimed + other->start, TRUE, length);
+      for (i = other->start; i < other->end; i ++)
+	edits->removed[i] = TRUE;
+      insertCodeBefore(edits, other->start, OP_LV, 0, temp);
+    }
+    hoisted ++;
+  }
+
+  free(claimed);
+  free(candidates);
+  return hoisted;
+}
+
+int hoistLoopInvariants(CodeBlock* codeBlock, CodeAddress start) {
+  ControlFlowGraph* cfg;
+  SlotAnalysis* analysis;
+  CodeEdits* edits;
+  Loop* loops;
+  int loopCount, k, hoisted, total = 0;
+  WORD frameSize;
+
+  if (codeBlock->code[start].op != OP_INT) return 0;
+
+  do {
+    cfg = buildCFG(codeBlock, start, codeBlock->codeSize);
+    if (cfg == NULL) break;
+
+    // One loop at a time: code moved out of an inner loop lands in the
+    // outer loop, which is looked at again on the next round
+    analysis = analyseSlots(cfg);
+    loops = findLoops(cfg, analysis, &loopCount);
+    frameSize = codeBlock->code[start].q;
+    edits = createCodeEdits(codeBlock);
+    hoisted = 0;
+    for (k = 0; (k < loopCount) && (hoisted == 0); k ++)
+      hoisted = hoistInvariants(cfg, loops + k, edits, &frameSize);
+
+    if ((hoisted > 0) && applyCodeEdits(codeBlock, edits)) {
+      codeBlock->code[start].q = frameSize;
+      total += hoisted;
+    } else hoisted = 0;
+
+    freeCodeEdits(edits);
+    freeLoops(loops, loopCount);
+    freeSlotAnalysis(analysis);
+    freeCFG(cfg);
+  } while (hoisted > 0);
+
+  return total;
+}
+
+/******************* Induction variables ******************************/
+
+enum InductionKind {
+  IV_NONE,
+  IV_INVARIANT,
+  IV_INDUCTION            // grows by step with the variable of the loop
+};
+
+struct InductionEntry_ {
+  CodeAddress start;      // -1 if the word cannot be recomputed
+  CodeAddress end;
+  enum InductionKind kind;
+  int isConstant;
+  WORD step;
+};
+
+typedef struct InductionEntry_ InductionEntry;
+
+void pushInduction(InductionEntry* stack, int* top, CodeAddress start, CodeAddress end, enum InductionKind kind, WORD step) {
+  stack[*top].start = start;
+  stack[*top].end = end;
+  stack[*top].kind = (start >= 0) ? kind : IV_NONE;
+  stack[*top].isConstant = FALSE;
+  stack[*top].step = step;
+  (*top) ++;
+}
+
+InductionEntry popInduction(InductionEntry* stack, int* top) {
+  InductionEntry entry;
+
+  if (*top > 0) return stack[-- (*top)];
+  memset(&entry, 0, sizeof(InductionEntry));
+  entry.start = -1;
+  entry.end = -1;
+  entry.kind = IV_NONE;
+  return entry;
+}
+
+// Kind and step of a op b, for the operators that keep v * c + e
+enum InductionKind combineInductions(Instruction* code, enum OpCode op, InductionEntry* a, InductionEntry* b, WORD* step) {
+  if ((a->kind == IV_NONE) || (b->kind == IV_NONE)) return IV_NONE;
+  if ((a->kind == IV_INVARIANT) && (b->kind == IV_INVARIANT)) {
+    *step = 0;
+    return ((op == OP_AD) || (op == OP_SB) || (op == OP_ML)) ? IV_INVARIANT : IV_NONE;
+  }
+  switch (op) {
+  case OP_AD:
+    *step = (WORD) ((UWORD) a->step + (UWORD) b->step);
+    break;
+  case OP_SB:
+    *step = (WORD) ((UWORD) a->step - (UWORD) b->step);
+    break;
+  case OP_ML:
+    if (b->isConstant)
+      *step = (WORD) ((UWORD) a->step * (UWORD) code[b->start].q);
+    else if (a->isConstant)
+      *step = (WORD) ((UWORD) b->step * (UWORD) code[a->start].q);
+    else return IV_NONE;
+    break;
+  case OP_SHL:
+    if ((a->kind != IV_INDUCTION) || !b->isConstant || (code[b->start].q < 0) || (code[b->start].q > 30))
+      return IV_NONE;
+    *step = (WORD) ((UWORD) a->step << code[b->start].q);
+    break;
+  default:
+    return IV_NONE;
+  }
+  return (*step != 0) ? IV_INDUCTION : IV_NONE;
+}
+
+// Collect the code of one block of the loop computing v * c + e in the
+// body of the statement, where v holds the value of the trip
+void findInductions(ControlFlowGraph* cfg, Loop* loop, int n, ForStatement* statement, Candidate** candidates, int* count) {
+  BasicBlock* block = cfg->blocks + n;
+  Instruction* code = cfg->codeBlock->code;
+  InductionEntry* stack;
+  InductionEntry a, b;
+  enum InductionKind kind;
+  CodeAddress i;
+  int top = 0;
+  WORD step;
+
+  stack = (InductionEntry*) malloc(2 * (block->end - block->start + 1) * sizeof(InductionEntry));
+  for (i = block->start; i < block->end; i ++) {
+    Instruction* inst = code + i;
+
+    switch (inst->op) {
+    case OP_LC:
+      pushInduction(stack, &top, i, i + 1, IV_INVARIANT, 0);
+      stack[top - 1].isConstant = TRUE;
+      break;
+    case OP_LA:
+      pushInduction(stack, &top, i, i + 1, IV_INVARIANT, 0);
+      break;
+    case OP_LV:
+      if ((inst->p == 0) && (inst->q == statement->q))
+	pushInduction(stack, &top, i, i + 1, IV_INDUCTION, 1);
+      else pushInduction(stack, &top, i, i + 1, isKilled(loop, inst->p, inst->q) ? IV_NONE : IV_INVARIANT, 0);
+      break;
+    case OP_NEG:
+      a = popInduction(stack, &top);
+      pushInduction(stack, &top, (a.end == i) ? a.start : -1, i + 1, a.kind, (WORD) (- (UWORD) a.step));
+      break;
+    case OP_AD:
+    case OP_SB:
+    case OP_ML:
+    case OP_DV:
+    case OP_MOD:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_SRZ:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GT:
+    case OP_LT:
+    case OP_GE:
+    case OP_LE:
+      b = popInduction(stack, &top);
+      a = popInduction(stack, &top);
+      kind = combineInductions(code, inst->op, &a, &b, &step);
+      pushInduction(stack, &top, ((b.start == a.end) && (b.end == i)) ? a.start : -1, i + 1, kind, step);
+      break;
+    case OP_LI:
+      popInduction(stack, &top);
+      pushInduction(stack, &top, -1, i + 1, IV_NONE, 0);
+      break;
+    case OP_LD:
+      a = popInduction(stack, &top);
+      if ((a.kind == IV_INVARIANT) && isSafeDataIndex(cfg->codeBlock, a.start, a.end))
+	pushInduction(stack, &top, (a.end == i) ? a.start : -1, i + 1, IV_INVARIANT, 0);
+      else pushInduction(stack, &top, -1, i + 1, IV_NONE, 0);
+      break;
+    case OP_CV:
+      if (top == 0)
+	pushInduction(stack, &top, -1, -1, IV_NONE, 0);
+      pushInduction(stack, &top, -1, i + 1, IV_NONE, 0);
+      break;
+    case OP_RC:
+    case OP_RI:
+      pushInduction(stack, &top, -1, i + 1, IV_NONE, 0);
+      break;
+    case OP_ST:
+      popInduction(stack, &top);
+      popInduction(stack, &top);
+      break;
+    case OP_WRC:
+    case OP_WRI:
+    case OP_FJ:
+    case OP_JT:
+      popInduction(stack, &top);
+      break;
+    default:
+      top = 0;
+      break;
+    }
+
+    if ((top > 0) && (stack[top - 1].kind == IV_INDUCTION) && (stack[top - 1].end - stack[top - 1].start >= 2) &&
+	(stack[top - 1].start >= statement->body) && (stack[top - 1].end <= statement->latch)) {
+      *candidates = (Candidate*) realloc(*candidates, (*count + 1) * sizeof(Candidate));
+      (*candidates)[*count].start = stack[top - 1].start;
+      (*candidates)[*count].end = stack[top - 1].end;
+      (*candidates)[*count].step = stack[top - 1].step;
+      (*count) ++;
+    }
+  }
+  free(stack);
+}
+
+// Tell whether the body of the statement may write its variable. The
+// last block of the body runs on into the latch, which does.
+int writesForVariable(ControlFlowGraph* cfg, ForStatement* statement, SlotAnalysis* analysis) {
+  Instruction* code = cfg->codeBlock->code;
+  Loop body;
+  CodeAddress i;
+  int written;
+
+  memset(&body, 0, sizeof(Loop));
+  body.analysis = analysis;
+  for (i = statement->body; i < statement->latch; i ++) {
+    SlotAccess* access = analysis->accesses + (i - cfg->start);
+
+    if (code[i].op == OP_CALL)
+      addCallKills(&body, code + i);
+    else if (access->kind == SA_WRITE) {
+      if (access->known) addKill(&body, access);
+      else body.killsShared = TRUE;
+    }
+  }
+  written = isKilled(&body, 0, statement->q);
+  free(body.kills);
+  return written;
+}
+
+// Give the largest pieces of code of the loop computing v * c + e a slot
+// of their own, when it saves instructions on each trip. Returns the
+// number of slots.
+int reduceInductions(ControlFlowGraph* cfg, Loop* loop, ForStatement* statement, CodeEdits* edits, WORD* frameSize) {
+  Instruction* code = cfg->codeBlock->code;
+  Candidate* candidates = NULL;
+  Candidate* c;
+  Candidate* other;
+  CodeAddress i;
+  char* claimed;
+  int count = 0, reduced = 0;
+  int n, length, uses;
+  WORD temp;
+
+  for (n = 0; n < cfg->blockCount; n ++)
+    if (loop->inLoop[n])
+      findInductions(cfg, loop, n, statement, &candidates, &count);
+  if (count == 0) return 0;
+
+  qsort(candidates, count, sizeof(Candidate), compareCandidateLength);
+  claimed = (char*) calloc(cfg->codeBlock->codeSize + 1, 1);
+
+  for (c = candidates; c < candidates + count; c ++) {
+    if (isClaimed(claimed, c)) continue;
+    length = c->end - c->start;
+    uses = 0;
+    for (other = c; other < candidates + count; other ++)
+      if ((other->end - other->start == length) && !isClaimed(claimed, other) &&
+	  sameCode(cfg->codeBlock, c->start, other->start, length))
+	uses ++;
+    if (uses * (length - 1) <= INDUCTION_STEP_LENGTH) continue;
+
+    // Compute it with the first value of the variable ...
+    temp = (*frameSize) ++;
+    insertCodeAfter(edits, statement->head - 1, OP_LA, 0, temp);
+    for (i = c->start; i < c->end; i ++)
+      insertCodeAfter(edits, statement->head - 1, code[i].op, code[i].p, code[i].q);
+    insertCodeAfter(edits, statement->head - 1, OP_ST, DC_VALUE, DC_VALUE);
+
+    // ... step it with the variable ...
+    insertCodeBefore(edits, statement->latch, OP_LA, 0, temp);
+    insertCodeBefore(edits, statement->latch, OP_LV, 0, temp);
+    insertCodeBefore(edits, statement->latch, OP_LC, DC_VALUE, c->step);
+    insertCodeBefore(edits, statement->latch, OP_AD, DC_VALUE, DC_VALUE);
+    insertCodeBefore(edits, statement->latch, OP_ST, DC_VALUE, DC_VALUE);
+
+    // ... and load it wherever the same code appears in the loop
+    for (other = c; other < candidates + count; other ++) {
+      if ((other->end - other->start != length) || isClaimed(claimed, other) ||
+	  !sameCode(cfg->codeBlock, c->start, other->start, length))
+	continue;
+      memset(claimed + other->start, TRUE, length);
+      for (i = other->start; i < other->end; i ++)
+	edits->removed[i] = TRUE;
+      insertCodeBefore(edits, other->start, OP_LV, 0, temp);
+    }
+    reduced ++;
+  }
+
+  free(claimed);
+  free(candidates);
+  return reduced;
+}
+
+int reduceInductionVariables(CodeBlock* codeBlock, CodeAddress start) {
+  ControlFlowGraph* cfg;
+  SlotAnalysis* analysis;
+  CodeEdits* edits;
+  ForStatement statement;
+  Loop* loops;
+  CodeAddress i;
+  int loopCount, k, header, reduced, total = 0;
+  WORD frameSize;
+
+  if (codeBlock->code[start].op != OP_INT) return 0;
+
+  do {
+    cfg = buildCFG(codeBlock, start, codeBlock->codeSize);
+    if (cfg == NULL) break;
+
+    // One statement at a time, the inner ones first, as in
+    // hoistLoopInvariants
+    analysis = analyseSlots(cfg);
+    loops = findLoops(cfg, analysis, &loopCount);
+    frameSize = codeBlock->code[start].q;
+    edits = createCodeEdits(codeBlock);
+    reduced = 0;
+    for (i = codeBlock->codeSize - 1; (i > start) && (reduced == 0); i --) {
+      if (!matchForStatement(codeBlock, i, &statement)) continue;
+      header = cfg->blockOf[statement.head - cfg->start];
+      for (k = 0; (k < loopCount) && (loops[k].header != header); k ++);
+      if ((k == loopCount) || writesForVariable(cfg, &statement, analysis)) continue;
+      reduced = reduceInductions(cfg, loops + k, &statement, edits, &frameSize);
+    }
+
+    if ((reduced > 0) && applyCodeEdits(codeBlock, edits)) {
+      codeBlock->code[start].q = frameSize;
+      total += reduced;
+    } else reduced = 0;
+
+    freeCodeEdits(edits);
+    freeLoops(loops, loopCount);
+    freeSlotAnalysis(analysis);
+    freeCFG(cfg);
+  } while (reduced > 0);
+
+  return total;
+}
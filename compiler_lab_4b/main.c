@@ -11,15 +11,39 @@
 #include "reader.h"
 #include "parser.h"
 #include "codegen.h"
+#include "optimizer.h"
 
 
 int dumpCode = 0;
+int showFrameSizes = 0;
+int showSummaries = 0;
 
 void printUsage(void) {
-  printf("Usage: kplc input output [-dump]\n");
+  printf("Usage: kplc input output [-dump] [-frame-sizes] [-dump-summaries] [-O] [-fstrength-reduce] [-fcontrol-flow] [-fcse] [-flicm] [-fdse] [-fslot-coloring] [-finline] [-ftail-calls] [-fcompact-calls] [-fmemoize] [-feval-calls] [-fclone] [-funroll-loops] [-funroll-factor=N] [-fvectorize] [-finduction-vars] [-fbounds-check] [-g]\n");
   printf("   input: input kpl program\n");
   printf("   output: executable\n");
   printf("   -dump: code dump\n");
+  printf("   -frame-sizes: print the frame size of every block\n");
+  printf("   -dump-summaries: print what every procedure and function reads and writes\n");
+  printf("   -O: enable all optimizations\n");
+  printf("   -fstrength-reduce: replace multiplications and divisions by constants\n");
+  printf("   -fcontrol-flow: remove unreachable code, thread jumps and reorder basic blocks\n");
+  printf("   -fcse: reuse values computed earlier in the same basic block\n");
+  printf("   -flicm: move loop-invariant code out of loops\n");
+  printf("   -fdse: remove stores to variables that are not read again\n");
+  printf("   -fslot-coloring: share frame slots between variables not live at the same time\n");
+  printf("   -finline: replace calls to small procedures and functions with their body\n");
+  printf("   -ftail-calls: reuse the frame for calls in tail position\n");
+  printf("   -fcompact-calls: call procedures and functions through their short entry\n");
+  printf("   -fmemoize: keep the results of pure recursive functions in a memo table\n");
+  printf("   -feval-calls: compute calls to pure functions with constant arguments at compile time\n");
+  printf("   -fclone: call copies of procedures and functions specialized for constant arguments\n");
+  printf("   -funroll-loops: unroll FOR loops with constant bounds\n");
+  printf("   -funroll-factor=N: copies of the body per trip of a loop unrolled partially (default 4)\n");
+  printf("   -fvectorize: replace FOR loops over the elements of arrays with vector instructions\n");
+  printf("   -finduction-vars: step the addresses of array elements indexed by FOR variables instead of computing them\n");
+  printf("   -fbounds-check: stop with an error on indexes out of the bounds of arrays\n");
+  printf("   -g: save the source line of each instruction, for the errors of kplrun\n");
 }
 
 int analyseParam(char* param) {
@@ -27,6 +51,90 @@ int analyseParam(char* param) {
     dumpCode = 1;
     return 1;
   } 
+  if (strcmp(param, "-frame-sizes") == 0) {
+    showFrameSizes = 1;
+    return 1;
+  }
+  if (strcmp(param, "-dump-summaries") == 0) {
+    showSummaries = 1;
+    return 1;
+  }
+  if (strcmp(param, "-O") == 0) {
+    enableAllOptimizations();
+    return 1;
+  }
+  if (strcmp(param, "-fstrength-reduce") == 0) {
+    optStrengthReduce = 1;
+    return 1;
+  }
+  if (strcmp(param, "-fcontrol-flow") == 0) {
+    optControlFlow = 1;
+    return 1;
+  }
+  if (strcmp(param, "-fcse") == 0) {
+    optCommonSubexpressions = 1;
+    return 1;
+  }
+  if (strcmp(param, "-flicm") == 0) {
+    optLoopInvariants = 1;
+    return 1;
+  }
+  if (strcmp(param, "-fdse") == 0) {
+    optDeadStores = 1;
+    return 1;
+  }
+  if (strcmp(param, "-fslot-coloring") == 0) {
+    optSlotColoring = 1;
+    return 1;
+  }
+  if (strcmp(param, "-finline") == 0) {
+    optInlining = 1;
+    return 1;
+  }
+  if (strcmp(param, "-ftail-calls") == 0) {
+    optTailCalls = 1;
+    return 1;
+  }
+  if (strcmp(param, "-fcompact-calls") == 0) {
+    optCompactCalls = 1;
+    return 1;
+  }
+  if (strcmp(param, "-fmemoize") == 0) {
+    optMemoize = 1;
+    return 1;
+  }
+  if (strcmp(param, "-feval-calls") == 0) {
+    optEvaluateCalls = 1;
+    return 1;
+  }
+  if (strcmp(param, "-fclone") == 0) {
+    optCloning = 1;
+    return 1;
+  }
+  if (strcmp(param, "-funroll-loops") == 0) {
+    optUnrolling = 1;
+    return 1;
+  }
+  if (strncmp(param, "-funroll-factor=", 16) == 0) {
+    unrollFactor = atoi(param + 16);
+    return 1;
+  }
+  if (strcmp(param, "-fvectorize") == 0) {
+    optVectorize = 1;
+    return 1;
+  }
+  if (strcmp(param, "-finduction-vars") == 0) {
+    optInductionVariables = 1;
+    return 1;
+  }
+  if (strcmp(param, "-fbounds-check") == 0) {
+    checkBounds = 1;
+    return 1;
+  }
+  if (strcmp(param, "-g") == 0) {
+    saveLines = 1;
+    return 1;
+  }
   return 0;
 }
 
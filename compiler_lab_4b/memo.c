@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "summary.h"
+
+// Memoization. The result of a pure function depends on its arguments
+// only, and the VM can keep it in its memo table:
+//
+//    INT F; MC n,id; body; MS n,id; EF
+//
+// MC looks the n arguments up in the table and, when they are found,
+// leaves with the result stored for them as EF would. MS stores the
+// result before the exit. The table is direct mapped, so that a result
+// may be dropped for another one, never mixed up with it.
+//
+// A function is memoized if (*$MEMO*) is written before it, or with
+// -fmemoize if it calls itself more than once other than in tail
+// position, as a recursion on the arguments usually does. Self calls in
+// tail position only make a chain with nothing to reuse, and MS before EF
+// would keep -ftail-calls from running them in constant stack. A function
+// must be pure, take at most MEMO_KEY_WORDS parameters and never store to
+// them, since MS reads the arguments from the parameter slots.
+
+#define CALL_FRAME_WORDS 4        // return value, dynamic link, return address, static link
+#define MEMO_SELF_CALLS 2         // self calls making a function worth memoizing
+
+// Count the self calls not in tail position
+int countSelfCalls(CodeBlock* codeBlock, CompiledBlock* block) {
+  Instruction* code = codeBlock->code;
+  int* depth = computeStackDepths(codeBlock, block->bodyStart, block->end);
+  CodeAddress i;
+  int count = 0;
+
+  for (i = block->bodyStart; i < block->end; i ++)
+    if ((code[i].op == OP_CALL) && (code[i].p == 1) && (code[i].q == block->blockAddress) &&
+	!isTailCall(codeBlock, block->bodyStart, depth, i))
+      count ++;
+  free(depth);
+  return count;
+}
+
+int writesParameters(CodeBlock* codeBlock, CompiledBlock* block) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+
+  for (i = block->bodyStart; i < block->end; i ++)
+    if ((code[i].op == OP_LA) && (code[i].p == 0) && (code[i].q >= CALL_FRAME_WORDS) &&
+	(code[i].q < CALL_FRAME_WORDS + block->paramCount))
+      return TRUE;
+  return FALSE;
+}
+
+int canMemoize(CodeBlock* codeBlock, CompiledBlock* block) {
+  Summary* summary = block->summary;
+
+  if ((summary == NULL) || !summary->isFunction || !isPure(summary)) return FALSE;
+  if ((block->paramCount < 0) || (block->paramCount > MEMO_KEY_WORDS)) return FALSE;
+  if (codeBlock->code[block->bodyStart].op != OP_INT) return FALSE;
+  return !writesParameters(codeBlock, block);
+}
+
+int memoizeBlock(CodeBlock* codeBlock, CompiledBlock* block) {
+  Instruction* code = codeBlock->code;
+  CodeEdits* edits;
+  CodeAddress i;
+  int count = 0, done;
+
+  if (!canMemoize(codeBlock, block)) return FALSE;
+  if (!block->memoHint && !(optMemoize && (countSelfCalls(codeBlock, block) >= MEMO_SELF_CALLS)))
+    return FALSE;
+
+  // The address of the block tells its results apart in the table
+  edits = createCodeEdits(codeBlock);
+  insertCodeAfter(edits, block->bodyStart, OP_MC, block->paramCount, block->blockAddress);
+  for (i = block->bodyStart + 1; i < block->end; i ++)
+    if (code[i].op == OP_EF) {
+      insertCodeBefore(edits, i, OP_MS, block->paramCount, block->blockAddress);
+      count ++;
+    }
+  done = applyCodeEdits(codeBlock, edits);
+  if (done)
+    block->end += 1 + count;
+  freeCodeEdits(edits);
+  return done;
+}
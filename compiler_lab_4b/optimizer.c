@@ -0,0 +1,996 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "optimizer.h"
+#include "cfg.h"
+#include "slots.h"
+#include "summary.h"
+
+int optStrengthReduce = FALSE;
+int optControlFlow = FALSE;
+int optCommonSubexpressions = FALSE;
+int optLoopInvariants = FALSE;
+int optDeadStores = FALSE;
+int optSlotColoring = FALSE;
+int optInlining = FALSE;
+int optTailCalls = FALSE;
+int optCompactCalls = FALSE;
+int optMemoize = FALSE;
+int optEvaluateCalls = FALSE;
+int optCloning = FALSE;
+int optUnrolling = FALSE;
+int optVectorize = FALSE;
+int optInductionVariables = FALSE;
+
+CompiledBlock* compiledBlocks = NULL;
+int compiledBlockCount = 0;
+int maxCompiledBlocks = 0;
+
+void enableAllOptimizations(void) {
+  optStrengthReduce = TRUE;
+  optControlFlow = TRUE;
+  optCommonSubexpressions = TRUE;
+  optLoopInvariants = TRUE;
+  optDeadStores = TRUE;
+  optSlotColoring = TRUE;
+  optInlining = TRUE;
+  optTailCalls = TRUE;
+  optCompactCalls = TRUE;
+  optMemoize = TRUE;
+  optEvaluateCalls = TRUE;
+  optCloning = TRUE;
+  optUnrolling = TRUE;
+  optVectorize = TRUE;
+  optInductionVariables = TRUE;
+}
+
+void optimizeBlock(CodeBlock* codeBlock, CodeAddress blockAddress) {
+  CodeAddress bodyAddress = codeBlock->code[blockAddress].q;
+  CompiledBlock* block;
+  int i;
+
+  // Before inlining spreads the callees over the body, on the arguments
+  // folded to constants
+  if (optEvaluateCalls) {
+    if (optStrengthReduce)
+      strengthReduce(codeBlock, bodyAddress);
+    evaluateConstantCalls(codeBlock, bodyAddress);
+  }
+  // The copies go in front of the body, which moves
+  if (optCloning && (cloneCalls(codeBlock, blockAddress) > 0))
+    bodyAddress = codeBlock->code[blockAddress].q;
+  // First, so that the other passes see the inlined code in context
+  if (optInlining)
+    inlineCalls(codeBlock, bodyAddress);
+  if (optStrengthReduce)
+    strengthReduce(codeBlock, bodyAddress);
+  // Whatever the switches, on the constants folded above, and before the
+  // loop passes, which leave the checked indexes alone
+  eliminateBoundsChecks(codeBlock, bodyAddress);
+  // Before unrolling takes the loops apart
+  if (optVectorize)
+    vectorizeLoops(codeBlock, bodyAddress);
+  // On the folded bounds, and the copies are folded in turn
+  if (optUnrolling && (unrollLoops(codeBlock, bodyAddress) > 0) && optStrengthReduce)
+    strengthReduce(codeBlock, bodyAddress);
+  // Before the invariant parts of the addresses are hoisted one by one
+  if (optInductionVariables)
+    reduceInductionVariables(codeBlock, bodyAddress);
+  if (optLoopInvariants)
+    hoistLoopInvariants(codeBlock, bodyAddress);
+  // Before value numbering, which would make the dead code feed live code
+  if (optDeadStores)
+    eliminateDeadStores(codeBlock, bodyAddress);
+  if (optCommonSubexpressions)
+    eliminateCommonSubexpressions(codeBlock, bodyAddress);
+  // Last, to pack the hidden slots added by the passes above
+  if (optSlotColoring)
+    colorFrameSlots(codeBlock, bodyAddress);
+  if (optControlFlow)
+    optimizeControlFlow(codeBlock, bodyAddress);
+
+  block = enterCompiledBlock(blockAddress);
+  block->bodyStart = codeBlock->code[blockAddress].q;
+  block->end = codeBlock->codeSize;
+  // Before the calls are rewritten below
+  summarizeBlock(codeBlock, block);
+  // Before the tail calls: the calls before the MS of a memoized function
+  // are no longer in tail position
+  memoizeBlock(codeBlock, block);
+
+  // Last, since a jump to another block ends the graph based passes. The
+  // tail calls of the nested blocks to this one can be seen now too.
+  if (optTailCalls) {
+    eliminateTailCalls(codeBlock, bodyAddress, codeBlock->codeSize);
+    for (i = 0; i < compiledBlockCount; i ++)
+      if ((compiledBlocks[i].blockAddress > blockAddress) && (compiledBlocks[i].blockAddress < bodyAddress))
+	eliminateTailCalls(codeBlock, compiledBlocks[i].bodyStart, compiledBlocks[i].end);
+  }
+  if (optCompactCalls) {
+    compactEntry(codeBlock, enterCompiledBlock(blockAddress));
+    compactCalls(codeBlock, bodyAddress);
+  }
+}
+
+/******************* Compiled blocks ******************************/
+
+CompiledBlock* findCompiledBlock(CodeAddress blockAddress) {
+  int i;
+
+  for (i = 0; i < compiledBlockCount; i ++)
+    if (compiledBlocks[i].blockAddress == blockAddress)
+      return compiledBlocks + i;
+  return NULL;
+}
+
+// Find the entry of a block, adding it if needed
+CompiledBlock* enterCompiledBlock(CodeAddress blockAddress) {
+  CompiledBlock* block = findCompiledBlock(blockAddress);
+
+  if (block != NULL) return block;
+
+  if (compiledBlockCount == maxCompiledBlocks) {
+    maxCompiledBlocks = 2 * maxCompiledBlocks + 8;
+    compiledBlocks = (CompiledBlock*) realloc(compiledBlocks, maxCompiledBlocks * sizeof(CompiledBlock));
+  }
+  block = compiledBlocks + (compiledBlockCount++);
+  block->blockAddress = blockAddress;
+  block->bodyStart = 0;
+  block->end = 0;
+  block->inlineHint = INLINE_DEFAULT;
+  block->paramCount = -1;
+  block->entry = 0;
+  block->needsStaticLink = TRUE;
+  block->summary = NULL;
+  block->memoHint = FALSE;
+  block->original = 0;
+  return block;
+}
+
+void setInlineHint(CodeAddress blockAddress, enum InlineHint hint) {
+  enterCompiledBlock(blockAddress)->inlineHint = hint;
+}
+
+void setMemoHint(CodeAddress blockAddress) {
+  enterCompiledBlock(blockAddress)->memoHint = TRUE;
+}
+
+void setParamCount(CodeAddress blockAddress, int paramCount) {
+  enterCompiledBlock(blockAddress)->paramCount = paramCount;
+}
+
+CompiledBlock* compiledBlockAt(int index) {
+  return (index < compiledBlockCount) ? compiledBlocks + index : NULL;
+}
+
+CodeAddress firstBodyAddress(CompiledBlock* block) {
+  return (block->entry != 0) ? block->entry + 1 : block->bodyStart + 1;
+}
+
+/******************* Code utilities ******************************/
+
+int isPowerOfTwo(WORD value) {
+  return (value > 0) && ((value & (value - 1)) == 0);
+}
+
+int log2OfPowerOfTwo(WORD value) {
+  int k = 0;
+  while (value > 1) {
+    value >>= 1;
+    k ++;
+  }
+  return k;
+}
+
+// Length of the side-effect free code pushing one operand at address:
+// a constant, a variable value, or an address followed by an indirect load
+int pureOperandLength(CodeBlock* codeBlock, CodeAddress address, CodeAddress end) {
+  Instruction* code = codeBlock->code;
+
+  if (address >= end) return 0;
+  switch (code[address].op) {
+  case OP_LC:
+  case OP_LV:
+    return 1;
+  case OP_LA:
+    if ((address + 1 < end) && (code[address + 1].op == OP_LI))
+      return 2;
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+int sameCode(CodeBlock* codeBlock, CodeAddress a1, CodeAddress a2, int length) {
+  Instruction* code = codeBlock->code;
+  int i;
+
+  for (i = 0; i < length; i ++)
+    if ((code[a1 + i].op != code[a2 + i].op) ||
+	(code[a1 + i].p != code[a2 + i].p) ||
+	(code[a1 + i].q != code[a2 + i].q))
+      return FALSE;
+  return TRUE;
+}
+
+void markJumpTargets(CodeBlock* codeBlock, char* isTarget) {
+  Instruction* code = codeBlock->code;
+  int i;
+
+  memset(isTarget, FALSE, codeBlock->codeSize + 1);
+  for (i = 0; i < codeBlock->codeSize; i ++)
+    switch (code[i].op) {
+    case OP_J:
+    case OP_FJ:
+    case OP_CALL:
+    case OP_CS:
+      if ((code[i].q >= 0) && (code[i].q <= codeBlock->codeSize))
+	isTarget[code[i].q] = TRUE;
+      break;
+    default:
+      break;
+    }
+}
+
+// Check that control can only enter the window [address, address + length)
+// through its first instruction
+int hasJumpTargetInside(char* isTarget, CodeAddress address, int length) {
+  int i;
+
+  for (i = 1; i < length; i ++)
+    if (isTarget[address + i]) return TRUE;
+  return FALSE;
+}
+
+// Delete the marked instructions and relocate every jump and call.
+// A jump to a deleted instruction lands on the next remaining one.
+void removeCode(CodeBlock* codeBlock, char* removed) {
+  Instruction* code = codeBlock->code;
+  int* lines = codeBlock->lines;
+  CodeAddress* newAddress;
+  int i, n;
+
+  newAddress = (CodeAddress*) malloc((codeBlock->codeSize + 1) * sizeof(CodeAddress));
+  n = 0;
+  for (i = 0; i < codeBlock->codeSize; i ++) {
+    newAddress[i] = n;
+    if (!removed[i]) n ++;
+  }
+  newAddress[codeBlock->codeSize] = n;
+
+  n = 0;
+  for (i = 0; i < codeBlock->codeSize; i ++)
+    if (!removed[i]) {
+      code[n] = code[i];
+      lines[n] = lines[i];
+      switch (code[n].op) {
+      case OP_J:
+      case OP_FJ:
+      case OP_CALL:
+      case OP_CS:
+	if ((code[n].q >= 0) && (code[n].q <= codeBlock->codeSize))
+	  code[n].q = newAddress[code[n].q];
+	break;
+      default:
+	break;
+      }
+      n ++;
+    }
+  codeBlock->codeSize = n;
+  free(newAddress);
+}
+
+// Replace the instructions from..to (included) with count new ones, and
+// relocate every jump and call. The targets of the new jumps marked in
+// isLocal are relative to the first new instruction, and all of them
+// take the source line of the instruction at from. Returns FALSE,
+// leaving the code untouched, if the result would not fit.
+int replaceCode(CodeBlock* codeBlock, CodeAddress from, CodeAddress to,
+		Instruction* newCode, char* isLocal, int count) {
+  Instruction* code = codeBlock->code;
+  int* lines = codeBlock->lines;
+  int delta = count - (to - from + 1);
+  int i, line = lines[from];
+
+  if (codeBlock->codeSize + delta > codeBlock->maxSize) return FALSE;
+
+  memmove(code + to + 1 + delta, code + to + 1, (codeBlock->codeSize - to - 1) * sizeof(Instruction));
+  memmove(lines + to + 1 + delta, lines + to + 1, (codeBlock->codeSize - to - 1) * sizeof(int));
+  codeBlock->codeSize += delta;
+  for (i = 0; i < codeBlock->codeSize; i ++) {
+    if ((i >= from) && (i < from + count)) continue;
+    switch (code[i].op) {
+    case OP_J:
+    case OP_FJ:
+    case OP_CALL:
+    case OP_CS:
+      if (code[i].q > to)
+	code[i].q += delta;
+      else if (code[i].q > from)
+	code[i].q = from;
+      break;
+    default:
+      break;
+    }
+  }
+
+  for (i = 0; i < count; i ++) {
+    code[from + i] = newCode[i];
+    lines[from + i] = line;
+    if (isLocal[i])
+      code[from + i].q += from;
+  }
+  return TRUE;
+}
+
+// Number of words an instruction adds to the stack, negative if it takes
+// words off, when control goes on to the next instruction or to the
+// target of a FJ. Returns FALSE if it is not known.
+int stackEffect(CodeBlock* codeBlock, Instruction* inst, int* effect) {
+  switch (inst->op) {
+  case OP_LA:
+  case OP_LV:
+  case OP_LC:
+  case OP_CV:
+  case OP_RC:
+  case OP_RI:
+    *effect = 1;
+    return TRUE;
+  case OP_LI:
+  case OP_NEG:
+  case OP_LD:
+  case OP_WLN:
+  case OP_BC:
+  case OP_BP:
+  case OP_J:
+  case OP_MC:
+  case OP_MS:
+    *effect = 0;
+    return TRUE;
+  case OP_INT:
+    *effect = inst->q;
+    return TRUE;
+  case OP_DCT:
+    *effect = - inst->q;
+    return TRUE;
+  case OP_ST:
+    *effect = -2;
+    return TRUE;
+  case OP_FJ:
+  case OP_JT:
+  case OP_WRC:
+  case OP_WRI:
+  case OP_AD:
+  case OP_SB:
+  case OP_ML:
+  case OP_DV:
+  case OP_EQ:
+  case OP_NE:
+  case OP_GT:
+  case OP_LT:
+  case OP_GE:
+  case OP_LE:
+  case OP_SHL:
+  case OP_SHR:
+  case OP_SRZ:
+  case OP_AND:
+  case OP_OR:
+  case OP_XOR:
+  case OP_MOD:
+  case OP_VSM:
+    *effect = -1;
+    return TRUE;
+  case OP_VDT:
+  case OP_BM:
+    *effect = -2;
+    return TRUE;
+  case OP_VFL:
+  case OP_VCP:
+    *effect = -3;
+    return TRUE;
+  case OP_VAD:
+  case OP_VSB:
+  case OP_VML:
+    *effect = -4;
+    return TRUE;
+  case OP_CALL:
+    // The frame of the callee was dropped by the DCT before the call
+    *effect = callResultCount(codeBlock, inst);
+    return *effect >= 0;
+  default:
+    return FALSE;
+  }
+}
+
+int isVectorInstruction(enum OpCode op) {
+  switch (op) {
+  case OP_VAD:
+  case OP_VSB:
+  case OP_VML:
+  case OP_VFL:
+  case OP_VCP:
+  case OP_VSM:
+  case OP_VDT:
+  case OP_BM:
+    return TRUE;
+  default:
+    return FALSE;
+  }
+}
+
+// Depth of the stack above the frame before each instruction of the body
+// [start, end), indexed by address - start; -1 where it is not known
+int* computeStackDepths(CodeBlock* codeBlock, CodeAddress start, CodeAddress end) {
+  Instruction* code = codeBlock->code;
+  int* depth = (int*) malloc((end - start + 1) * sizeof(int));
+  CodeAddress* work = (CodeAddress*) malloc((end - start + 1) * sizeof(CodeAddress));
+  CodeAddress i, next[2];
+  int top = 0, count, k, d;
+
+  for (i = start; i <= end; i ++)
+    depth[i - start] = -1;
+  depth[1] = 0;
+  work[top++] = start + 1;
+
+  while (top > 0) {
+    i = work[--top];
+    if (!stackEffect(codeBlock, code + i, &d)) continue;
+    d += depth[i - start];
+
+    if (code[i].op == OP_JT) {
+      // Each J of the table is taken as it would be from here
+      for (k = 0; k <= code[i].q; k ++)
+	if ((i + 1 + k < end) && (depth[i + 1 + k - start] < 0)) {
+	  depth[i + 1 + k - start] = d;
+	  work[top++] = i + 1 + k;
+	}
+      continue;
+    }
+
+    count = 0;
+    if ((code[i].op == OP_J) || (code[i].op == OP_FJ))
+      next[count++] = code[i].q;
+    if (code[i].op != OP_J)
+      next[count++] = i + 1;
+    for (k = 0; k < count; k ++)
+      if ((next[k] > start) && (next[k] < end) && (depth[next[k] - start] < 0)) {
+	depth[next[k] - start] = d;
+	work[top++] = next[k];
+      }
+  }
+
+  free(work);
+  return depth;
+}
+
+/******************* Code edits ******************************/
+
+CodeEdits* createCodeEdits(CodeBlock* codeBlock) {
+  CodeEdits* edits = (CodeEdits*) malloc(sizeof(CodeEdits));
+
+  edits->codeSize = codeBlock->codeSize;
+  edits->removed = (char*) calloc(codeBlock->codeSize + 1, 1);
+  edits->insertionCount = 0;
+  edits->maxInsertions = 16;
+  edits->insertions = (CodeInsertion*) malloc(edits->maxInsertions * sizeof(CodeInsertion));
+  return edits;
+}
+
+void freeCodeEdits(CodeEdits* edits) {
+  free(edits->removed);
+  free(edits->insertions);
+  free(edits);
+}
+
+void insertCode(CodeEdits* edits, CodeAddress address, int after, enum OpCode op, WORD p, WORD q) {
+  CodeInsertion* insertion;
+
+  if (edits->insertionCount == edits->maxInsertions) {
+    edits->maxInsertions *= 2;
+    edits->insertions = (CodeInsertion*) realloc(edits->insertions, edits->maxInsertions * sizeof(CodeInsertion));
+  }
+  insertion = edits->insertions + edits->insertionCount;
+  insertion->address = address;
+  insertion->after = after;
+  insertion->order = edits->insertionCount;
+  insertion->inst.op = op;
+  insertion->inst.p = p;
+  insertion->inst.q = q;
+  edits->insertionCount ++;
+}
+
+void insertCodeBefore(CodeEdits* edits, CodeAddress address, enum OpCode op, WORD p, WORD q) {
+  insertCode(edits, address, FALSE, op, p, q);
+}
+
+void insertCodeAfter(CodeEdits* edits, CodeAddress address, enum OpCode op, WORD p, WORD q) {
+  insertCode(edits, address, TRUE, op, p, q);
+}
+
+int compareInsertions(const void* i1, const void* i2) {
+  const CodeInsertion* a = (const CodeInsertion*) i1;
+  const CodeInsertion* b = (const CodeInsertion*) i2;
+
+  if (a->address != b->address) return a->address - b->address;
+  if (a->after != b->after) return a->after - b->after;
+  return a->order - b->order;
+}
+
+// Rebuild the code with the recorded insertions and removals. A jump to an
+// address lands on the first instruction inserted before it, or on the next
+// remaining instruction if it was removed. An inserted instruction takes
+// the source line of the one at its address. Returns FALSE, leaving the
+// code untouched, if the result would not fit in the code block.
+int applyCodeEdits(CodeBlock* codeBlock, CodeEdits* edits) {
+  Instruction* code = codeBlock->code;
+  Instruction* newCode;
+  CodeAddress* newAddress;
+  int* newLines;
+  int i, k, n, size;
+
+  qsort(edits->insertions, edits->insertionCount, sizeof(CodeInsertion), compareInsertions);
+
+  size = edits->insertionCount;
+  for (i = 0; i < edits->codeSize; i ++)
+    if (!edits->removed[i]) size ++;
+  if (size > codeBlock->maxSize) return FALSE;
+
+  newCode = (Instruction*) malloc((size + 1) * sizeof(Instruction));
+  newAddress = (CodeAddress*) malloc((edits->codeSize + 1) * sizeof(CodeAddress));
+  newLines = (int*) malloc((size + 1) * sizeof(int));
+
+  n = 0;
+  k = 0;
+  for (i = 0; i < edits->codeSize; i ++) {
+    newAddress[i] = n;
+    while ((k < edits->insertionCount) && (edits->insertions[k].address == i) && !edits->insertions[k].after) {
+      newLines[n] = codeBlock->lines[i];
+      newCode[n++] = edits->insertions[k++].inst;
+    }
+    if (!edits->removed[i]) {
+      newLines[n] = codeBlock->lines[i];
+      newCode[n++] = code[i];
+    }
+    while ((k < edits->insertionCount) && (edits->insertions[k].address == i)) {
+      newLines[n] = codeBlock->lines[i];
+      newCode[n++] = edits->insertions[k++].inst;
+    }
+  }
+  newAddress[edits->codeSize] = n;
+
+  for (i = 0; i < n; i ++)
+    switch (newCode[i].op) {
+    case OP_J:
+    case OP_FJ:
+    case OP_CALL:
+    case OP_CS:
+      if ((newCode[i].q >= 0) && (newCode[i].q <= edits->codeSize))
+	newCode[i].q = newAddress[newCode[i].q];
+      break;
+    default:
+      break;
+    }
+
+  memcpy(code, newCode, n * sizeof(Instruction));
+  memcpy(codeBlock->lines, newLines, n * sizeof(int));
+  codeBlock->codeSize = n;
+  free(newCode);
+  free(newAddress);
+  free(newLines);
+  return TRUE;
+}
+
+/******************* Loops over arrays ******************************/
+
+CodeAddress invariantStart(CodeBlock* codeBlock, CodeAddress low, CodeAddress end) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+  int need = 1;
+
+  for (i = end; i >= low; i --) {
+    switch (code[i].op) {
+    case OP_LA:
+    case OP_LV:
+    case OP_LC:
+      need --;
+      break;
+    case OP_AD:
+    case OP_SB:
+    case OP_ML:
+      need ++;
+      break;
+    case OP_NEG:
+    case OP_LD:
+      // The data segment is never written
+      break;
+    default:
+      return -1;
+    }
+    if (need == 0) return i;
+  }
+  return -1;
+}
+
+int readsSlot(CodeBlock* codeBlock, CodeAddress start, CodeAddress end, WORD p, WORD q) {
+  CodeAddress i;
+
+  for (i = start; i < end; i ++)
+    if ((codeBlock->code[i].op == OP_LV) && (codeBlock->code[i].p == p) && (codeBlock->code[i].q == q))
+      return TRUE;
+  return FALSE;
+}
+
+int matchForStatement(CodeBlock* codeBlock, CodeAddress start, ForStatement* loop) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i, store, compare, exit, latch;
+
+  if ((code[start].op != OP_LA) || (code[start].p != 0) ||
+      (start + 2 >= codeBlock->codeSize) || (code[start + 1].op != OP_CV))
+    return FALSE;
+  for (store = start + 2; (store < codeBlock->codeSize) && (code[store].op != OP_ST); store ++);
+  if ((store + 3 >= codeBlock->codeSize) || (invariantStart(codeBlock, start + 2, store - 1) != start + 2) ||
+      (code[store + 1].op != OP_CV) || (code[store + 2].op != OP_LI))
+    return FALSE;
+  for (compare = store + 3; (compare + 1 < codeBlock->codeSize) && (code[compare].op != OP_LE); compare ++);
+  if ((compare + 1 >= codeBlock->codeSize) || (code[compare + 1].op != OP_FJ) ||
+      (invariantStart(codeBlock, store + 3, compare - 1) != store + 3))
+    return FALSE;
+
+  exit = code[compare + 1].q;
+  latch = exit - FOR_LATCH_LENGTH;
+  if ((latch < compare + 2) || (exit >= codeBlock->codeSize)) return FALSE;
+  if ((code[latch].op != OP_CV) || (code[latch + 1].op != OP_CV) ||
+      (code[latch + 2].op != OP_LI) ||
+      (code[latch + 3].op != OP_LC) || (code[latch + 3].q != 1) ||
+      (code[latch + 4].op != OP_AD) || (code[latch + 5].op != OP_ST) ||
+      (code[latch + 6].op != OP_CV) || (code[latch + 7].op != OP_LI) ||
+      (code[latch + 8].op != OP_J) || (code[latch + 8].q != store + 3) ||
+      (code[exit].op != OP_DCT) || (code[exit].q != 1))
+    return FALSE;
+
+  loop->start = start;
+  loop->lo = start + 2;
+  loop->head = store + 3;
+  loop->body = compare + 2;
+  loop->latch = latch;
+  loop->exit = exit;
+  loop->q = code[start].q;
+
+  // Jumps in the body stay in it or go to the latch, and jumps from
+  // elsewhere go to the head or past the loop
+  for (i = 0; i < codeBlock->codeSize; i ++) {
+    if ((code[i].op != OP_J) && (code[i].op != OP_FJ)) continue;
+    if ((i >= loop->body) && (i < latch)) {
+      if ((code[i].q < loop->body) || (code[i].q > latch)) return FALSE;
+    } else if ((code[i].q > start) && (code[i].q <= exit) && (i != compare + 1) && (i != latch + 8))
+      return FALSE;
+  }
+  return !readsSlot(codeBlock, loop->lo, loop->head - 3, 0, loop->q) &&
+    !readsSlot(codeBlock, loop->head, loop->body - 2, 0, loop->q);
+}
+
+int matchElementAddress(CodeBlock* codeBlock, CodeAddress low, CodeAddress end, WORD q, ElementAddress* element) {
+  Instruction* code = codeBlock->code;
+  CodeAddress k = end;
+
+  // The constant offset
+  if ((k - 2 >= low) && ((code[k].op == OP_AD) || (code[k].op == OP_SB)) &&
+      (code[k - 1].op == OP_LC) && (code[k - 2].op == OP_AD))
+    k -= 2;
+  if ((k - 1 < low) || (code[k].op != OP_AD)) return FALSE;
+  k --;
+
+  // The size of the elements, which may have become a shift
+  element->stride = 1;
+  if ((k - 1 >= low) && (code[k - 1].op == OP_LC) && (code[k].op == OP_ML)) {
+    element->stride = code[k - 1].q;
+    k -= 2;
+  } else if ((k - 1 >= low) && (code[k - 1].op == OP_LC) && (code[k].op == OP_SHL) &&
+	     (code[k - 1].q >= 0) && (code[k - 1].q < 31)) {
+    element->stride = 1 << code[k - 1].q;
+    k -= 2;
+  }
+
+  // The index: v, v + d or v - d
+  if ((k - 2 >= low) && ((code[k].op == OP_AD) || (code[k].op == OP_SB)) && (code[k - 1].op == OP_LC))
+    k -= 2;
+  if ((k - 1 < low) || (code[k].op != OP_LV) || (code[k].p != 0) || (code[k].q != q)) return FALSE;
+
+  element->index = k;
+  element->end = end;
+  element->start = invariantStart(codeBlock, low, k - 1);
+  return (element->start >= 0) && !readsSlot(codeBlock, element->start, element->index, 0, q);
+}
+
+/******************* Strength reduction ******************************/
+
+int foldConstants(enum OpCode op, WORD a, WORD b, WORD* result) {
+  switch (op) {
+  case OP_AD: return !__builtin_add_overflow(a, b, result);
+  case OP_SB: return !__builtin_sub_overflow(a, b, result);
+  case OP_ML: return !__builtin_mul_overflow(a, b, result);
+  case OP_DV:
+  case OP_MOD:
+    // Leave the run time error to the VM
+    if ((b == 0) || ((a == WORD_MIN) && (b == -1))) return FALSE;
+    *result = (op == OP_DV) ? a / b : a % b;
+    return TRUE;
+  case OP_EQ: *result = (a == b); return TRUE;
+  case OP_NE: *result = (a != b); return TRUE;
+  case OP_GT: *result = (a > b); return TRUE;
+  case OP_LT: *result = (a < b); return TRUE;
+  case OP_GE: *result = (a >= b); return TRUE;
+  case OP_LE: *result = (a <= b); return TRUE;
+  case OP_AND: *result = a & b; return TRUE;
+  case OP_OR: *result = a | b; return TRUE;
+  case OP_XOR: *result = a ^ b; return TRUE;
+  case OP_SHL:
+    // As for ML, a shift losing significant bits is left to the VM
+    *result = (WORD) ((UWORD) a << (b & SHIFT_MASK));
+    return (*result >> (b & SHIFT_MASK)) == a;
+  case OP_SHR: *result = a >> (b & SHIFT_MASK); return TRUE;
+  default: return FALSE;
+  }
+}
+
+// Try the rewriting rules at address. Returns the length of the rewritten
+// window, or 0 if nothing matched.
+int reduceAt(CodeBlock* codeBlock, CodeAddress address, char* isTarget, char* removed) {
+  Instruction* code = codeBlock->code;
+  CodeAddress end = codeBlock->codeSize;
+  CodeAddress y;
+  int n, m, i, length;
+  WORD value, folded;
+
+  // a - (a / c) * c  ==>  a c MOD
+  n = pureOperandLength(codeBlock, address, end);
+  if ((n > 0) && (address + 2 * n < end) && sameCode(codeBlock, address, address + n, n)) {
+    y = address + 2 * n;
+    m = pureOperandLength(codeBlock, y, end);
+    length = 2 * n + 2 * m + 3;
+    if ((m > 0) && (address + length <= end) &&
+	(code[y + m].op == OP_DV) &&
+	sameCode(codeBlock, y, y + m + 1, m) &&
+	(code[y + 2 * m + 1].op == OP_ML) &&
+	(code[y + 2 * m + 2].op == OP_SB) &&
+	!hasJumpTargetInside(isTarget, address, length)) {
+      for (i = 0; i < m; i ++)
+	code[address + n + i] = code[y + i];
+      code[address + n + m].op = OP_MOD;
+      code[address + n + m].p = DC_VALUE;
+      code[address + n + m].q = DC_VALUE;
+      for (i = n + m + 1; i < length; i ++)
+	removed[address + i] = TRUE;
+      return length;
+    }
+  }
+
+  if ((code[address].op != OP_LC) || (address + 1 >= end))
+    return 0;
+  value = code[address].q;
+
+  // Constant folding
+  if ((code[address + 1].op == OP_NEG) && (value != WORD_MIN) && !hasJumpTargetInside(isTarget, address, 2)) {
+    code[address].q = - value;
+    removed[address + 1] = TRUE;
+    return 2;
+  }
+  if ((address + 2 < end) && (code[address + 1].op == OP_LC) &&
+      !hasJumpTargetInside(isTarget, address, 3) &&
+      foldConstants(code[address + 2].op, value, code[address + 1].q, &folded)) {
+    code[address].q = folded;
+    removed[address + 1] = TRUE;
+    removed[address + 2] = TRUE;
+    return 3;
+  }
+
+  if (hasJumpTargetInside(isTarget, address, 2))
+    return 0;
+
+  switch (code[address + 1].op) {
+  case OP_LD:
+    // An element of a constant array at a constant index
+    if ((value < 0) || (value >= codeBlock->dataSize)) break;
+    code[address].q = codeBlock->data[value];
+    removed[address + 1] = TRUE;
+    return 2;
+  case OP_AD:
+  case OP_SB:
+    // x + 0, x - 0
+    if (value == 0) {
+      removed[address] = TRUE;
+      removed[address + 1] = TRUE;
+      return 2;
+    }
+    break;
+  case OP_ML:
+  case OP_DV:
+    if (!isPowerOfTwo(value)) break;
+    if (value == 1) {
+      // x * 1, x / 1
+      removed[address] = TRUE;
+      removed[address + 1] = TRUE;
+    } else {
+      // x * 2^k  ==>  x k SHL,  x / 2^k  ==>  x k SRZ
+      code[address].q = log2OfPowerOfTwo(value);
+      code[address + 1].op = (code[address + 1].op == OP_ML) ? OP_SHL : OP_SRZ;
+    }
+    return 2;
+  default:
+    break;
+  }
+
+  // 2^k * x  ==>  x k SHL
+  n = pureOperandLength(codeBlock, address + 1, end);
+  if ((n > 0) && isPowerOfTwo(value) && (value > 1) &&
+      (address + n + 1 < end) && (code[address + n + 1].op == OP_ML) &&
+      !hasJumpTargetInside(isTarget, address, n + 2)) {
+    for (i = 0; i < n; i ++)
+      code[address + i] = code[address + i + 1];
+    code[address + n].op = OP_LC;
+    code[address + n].p = DC_VALUE;
+    code[address + n].q = log2OfPowerOfTwo(value);
+    code[address + n + 1].op = OP_SHL;
+    return n + 2;
+  }
+
+  return 0;
+}
+
+int strengthReduce(CodeBlock* codeBlock, CodeAddress start) {
+  char* isTarget;
+  char* removed;
+  CodeAddress address;
+  int length, changed, total = 0;
+
+  do {
+    isTarget = (char*) malloc(codeBlock->codeSize + 1);
+    removed = (char*) calloc(codeBlock->codeSize + 1, 1);
+    markJumpTargets(codeBlock, isTarget);
+
+    changed = 0;
+    address = start;
+    while (address < codeBlock->codeSize) {
+      length = reduceAt(codeBlock, address, isTarget, removed);
+      if (length > 0) {
+	changed ++;
+	address += length;
+      } else address ++;
+    }
+
+    if (changed > 0)
+      removeCode(codeBlock, removed);
+    total += changed;
+    free(isTarget);
+    free(removed);
+  } while (changed > 0);
+
+  return total;
+}
+
+/******************* Control flow ******************************/
+
+// LC c; FJ l  ==>  J l  when c = 0, nothing otherwise
+// LC c; JT p,n  ==>  the J of the table taken for c
+int foldConstantBranches(CodeBlock* codeBlock, CodeAddress start) {
+  Instruction* code = codeBlock->code;
+  char* isTarget;
+  char* removed;
+  CodeAddress address;
+  WORD k;
+  int changed = 0;
+
+  isTarget = (char*) malloc(codeBlock->codeSize + 1);
+  removed = (char*) calloc(codeBlock->codeSize + 1, 1);
+  markJumpTargets(codeBlock, isTarget);
+
+  for (address = start; address + 1 < codeBlock->codeSize; address ++)
+    if ((code[address].op == OP_LC) && (code[address + 1].op == OP_JT) &&
+	!isTarget[address + 1] && (address + 2 + code[address + 1].q < codeBlock->codeSize)) {
+      // The table is left unreachable
+      if ((code[address].q >= code[address + 1].p) &&
+	  ((UWORD) code[address].q - (UWORD) code[address + 1].p < (UWORD) code[address + 1].q))
+	k = code[address].q - code[address + 1].p;
+      else k = code[address + 1].q;
+      code[address] = code[address + 2 + k];
+      removed[address + 1] = TRUE;
+      changed ++;
+      address ++;
+    } else if ((code[address].op == OP_LC) && (code[address + 1].op == OP_FJ) &&
+	!isTarget[address + 1]) {
+      if (code[address].q == FALSE) {
+	code[address] = code[address + 1];
+	code[address].op = OP_J;
+	removed[address + 1] = TRUE;
+      } else {
+	removed[address] = TRUE;
+	removed[address + 1] = TRUE;
+      }
+      changed ++;
+      address ++;
+    }
+
+  if (changed > 0)
+    removeCode(codeBlock, removed);
+  free(isTarget);
+  free(removed);
+  return changed;
+}
+
+// Follow a chain of blocks that consist of a single J
+int finalTarget(ControlFlowGraph* cfg, int block) {
+  int steps = 0;
+
+  while ((block != NO_BLOCK) && (steps < cfg->blockCount) &&
+	 (cfg->blocks[block].end - cfg->blocks[block].start == 1) &&
+	 (lastInstruction(cfg, block)->op == OP_J)) {
+    block = cfg->blocks[block].jumpTarget;
+    steps ++;
+  }
+  return block;
+}
+
+int threadJumps(ControlFlowGraph* cfg) {
+  BasicBlock* block;
+  Instruction* last;
+  Instruction* target;
+  int n, changed = 0;
+
+  for (n = 0; n < cfg->blockCount; n ++) {
+    block = cfg->blocks + n;
+    if (!block->reachable) continue;
+    last = lastInstruction(cfg, n);
+
+    if (block->jumpTarget != NO_BLOCK) {
+      if (finalTarget(cfg, block->jumpTarget) != block->jumpTarget) {
+	block->jumpTarget = finalTarget(cfg, block->jumpTarget);
+	changed ++;
+      }
+
+      // A jump to a lone HL, EP or EF is replaced by a copy of it
+      target = lastInstruction(cfg, block->jumpTarget);
+      if ((last->op == OP_J) && !block->inTable &&
+	  (cfg->blocks[block->jumpTarget].end - cfg->blocks[block->jumpTarget].start == 1) &&
+	  ((target->op == OP_HL) || (target->op == OP_EP) || (target->op == OP_EF))) {
+	*last = *target;
+	block->jumpTarget = NO_BLOCK;
+	changed ++;
+      }
+    }
+
+    // The Js of a table stay where they are
+    if ((block->fallThrough != NO_BLOCK) && (last->op != OP_JT) && !block->inTable) {
+      if (finalTarget(cfg, block->fallThrough) != block->fallThrough) {
+	block->fallThrough = finalTarget(cfg, block->fallThrough);
+	changed ++;
+      }
+    }
+
+    // Both ways of an FJ lead to the same place: just drop the condition
+    if ((last->op == OP_FJ) && (block->jumpTarget == block->fallThrough)) {
+      last->op = OP_DCT;
+      last->q = 1;
+      block->jumpTarget = NO_BLOCK;
+      changed ++;
+    }
+  }
+
+  computeReachability(cfg);
+  return changed;
+}
+
+int optimizeControlFlow(CodeBlock* codeBlock, CodeAddress start) {
+  ControlFlowGraph* cfg;
+  int oldSize = codeBlock->codeSize;
+
+  foldConstantBranches(codeBlock, start);
+
+  cfg = buildCFG(codeBlock, start, codeBlock->codeSize);
+  if (cfg == NULL) return 0;
+  threadJumps(cfg);
+  linearizeCFG(cfg);
+  freeCFG(cfg);
+
+  return oldSize - codeBlock->codeSize;
+}
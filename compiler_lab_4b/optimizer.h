@@ -0,0 +1,184 @@
+#ifndef __OPTIMIZER_H__
+#define __OPTIMIZER_H__
+
+#include "instructions.h"
+
+// Optimization switches, set from the command line
+extern int optStrengthReduce;
+extern int optControlFlow;
+extern int optCommonSubexpressions;
+extern int optLoopInvariants;
+extern int optDeadStores;
+extern int optSlotColoring;
+extern int optInlining;
+extern int optTailCalls;
+extern int optCompactCalls;
+extern int optMemoize;
+extern int optEvaluateCalls;
+extern int optCloning;
+extern int optUnrolling;
+extern int optVectorize;
+extern int optInductionVariables;
+extern int unrollFactor;      // copies of the body per trip of a loop unrolled partially
+
+void enableAllOptimizations(void);
+
+// Optimize the body of the block whose leading jump is at blockAddress.
+// The body runs from the target of that jump up to the end of the code.
+void optimizeBlock(CodeBlock* codeBlock, CodeAddress blockAddress);
+
+// Blocks already compiled and optimized, for the passes working across
+// procedures
+enum InlineHint {
+  INLINE_DEFAULT,
+  INLINE_ALWAYS,
+  INLINE_NEVER
+};
+
+struct CompiledBlock_ {
+  CodeAddress blockAddress;  // the leading jump
+  CodeAddress bodyStart;
+  CodeAddress end;           // the body runs up to end - 1, 0 until compiled
+  enum InlineHint inlineHint;
+  int paramCount;            // -1 for the program
+  CodeAddress entry;         // the EN of a block called with CS, 0 if none
+  int needsStaticLink;
+  struct Summary_* summary;  // see summary.h, NULL until compiled
+  int memoHint;              // (*$MEMO*) was written before it
+  CodeAddress original;      // the block it is a specialized copy of, 0 if none
+};
+
+typedef struct CompiledBlock_ CompiledBlock;
+
+// NULL if the block is not known yet
+CompiledBlock* findCompiledBlock(CodeAddress blockAddress);
+// Find the entry of a block, adding it if needed
+CompiledBlock* enterCompiledBlock(CodeAddress blockAddress);
+void setInlineHint(CodeAddress blockAddress, enum InlineHint hint);
+void setParamCount(CodeAddress blockAddress, int paramCount);
+void setMemoHint(CodeAddress blockAddress);
+// The blocks in the order they were entered, NULL past the last one
+CompiledBlock* compiledBlockAt(int index);
+// First instruction of the body after the frame is set up
+CodeAddress firstBodyAddress(CompiledBlock* block);
+
+int isPowerOfTwo(WORD value);
+// FALSE if the VM would stop on it with a run time error, checked
+// arithmetic included
+int foldConstants(enum OpCode op, WORD a, WORD b, WORD* result);
+int log2OfPowerOfTwo(WORD value);
+int pureOperandLength(CodeBlock* codeBlock, CodeAddress address, CodeAddress end);
+int sameCode(CodeBlock* codeBlock, CodeAddress a1, CodeAddress a2, int length);
+
+// Insertions and removals to be applied to a code block in one go
+struct CodeInsertion_ {
+  CodeAddress address;
+  int after;              // inserted after the instruction at address, not before
+  int order;
+  Instruction inst;
+};
+
+typedef struct CodeInsertion_ CodeInsertion;
+
+struct CodeEdits_ {
+  int codeSize;
+  char* removed;
+  CodeInsertion* insertions;
+  int insertionCount;
+  int maxInsertions;
+};
+
+typedef struct CodeEdits_ CodeEdits;
+
+CodeEdits* createCodeEdits(CodeBlock* codeBlock);
+void freeCodeEdits(CodeEdits* edits);
+void insertCodeBefore(CodeEdits* edits, CodeAddress address, enum OpCode op, WORD p, WORD q);
+void insertCodeAfter(CodeEdits* edits, CodeAddress address, enum OpCode op, WORD p, WORD q);
+int applyCodeEdits(CodeBlock* codeBlock, CodeEdits* edits);
+
+void markJumpTargets(CodeBlock* codeBlock, char* isTarget);
+int hasJumpTargetInside(char* isTarget, CodeAddress address, int length);
+void removeCode(CodeBlock* codeBlock, char* removed);
+int replaceCode(CodeBlock* codeBlock, CodeAddress from, CodeAddress to,
+		Instruction* newCode, char* isLocal, int count);
+int stackEffect(CodeBlock* codeBlock, Instruction* inst, int* effect);
+// VAD, VSB, VML, VFL, VCP, VSM, VDT and BM, which read or write whole arrays
+int isVectorInstruction(enum OpCode op);
+int* computeStackDepths(CodeBlock* codeBlock, CodeAddress start, CodeAddress end);
+
+// The code the parser emits for a FOR statement over a local variable,
+//
+//    LA 0,q; CV; lo; ST; CV; LI
+//    head: hi; LE; FJ exit
+//    body
+//    latch: CV; CV; LI; LC 1; AD; ST; CV; LI; J head
+//    exit: DCT 1
+//
+// when the bounds are computed from constants, addresses and variables
+// other than its own (see invariantStart), and no jump from outside
+// lands inside
+#define FOR_LATCH_LENGTH 9
+
+struct ForStatement_ {
+  CodeAddress start;      // the LA of the variable
+  CodeAddress lo;
+  CodeAddress head;       // the code of hi
+  CodeAddress body;
+  CodeAddress latch;
+  CodeAddress exit;       // the DCT
+  WORD q;                 // offset of the variable
+};
+
+typedef struct ForStatement_ ForStatement;
+
+// The address of an element of an array, at an index v, v + d or v - d,
+// v the local variable at offset q, as the parser emits it:
+//
+//    base; index; [LC size; ML]; AD; [LC c; AD|SB]
+//
+// The base, the code from start to index - 1, is an expression as in
+// invariantStart, which does not read v
+struct ElementAddress_ {
+  CodeAddress start;
+  CodeAddress index;      // the LV of v
+  CodeAddress end;        // the last instruction
+  WORD stride;            // the address moves by stride when v grows by 1
+};
+
+typedef struct ElementAddress_ ElementAddress;
+
+// Start of the expression whose code ends at address end, made of
+// loads of constants, addresses and variables and of arithmetic on
+// them; -1 if the code is not one
+CodeAddress invariantStart(CodeBlock* codeBlock, CodeAddress low, CodeAddress end);
+// Tell whether the code from start to end - 1 loads the variable (p,q)
+int readsSlot(CodeBlock* codeBlock, CodeAddress start, CodeAddress end, WORD p, WORD q);
+int matchForStatement(CodeBlock* codeBlock, CodeAddress start, ForStatement* loop);
+// The address whose code ends at address end, and starts at low or later
+int matchElementAddress(CodeBlock* codeBlock, CodeAddress low, CodeAddress end, WORD q, ElementAddress* element);
+
+int strengthReduce(CodeBlock* codeBlock, CodeAddress start);
+int foldConstantBranches(CodeBlock* codeBlock, CodeAddress start);
+int optimizeControlFlow(CodeBlock* codeBlock, CodeAddress start);
+int eliminateCommonSubexpressions(CodeBlock* codeBlock, CodeAddress start);
+int hoistLoopInvariants(CodeBlock* codeBlock, CodeAddress start);
+int reduceInductionVariables(CodeBlock* codeBlock, CodeAddress start);
+int eliminateDeadStores(CodeBlock* codeBlock, CodeAddress start);
+int colorFrameSlots(CodeBlock* codeBlock, CodeAddress start);
+int inlineCalls(CodeBlock* codeBlock, CodeAddress start);
+int splitArguments(CodeBlock* codeBlock, CodeAddress frame, CodeAddress call, int n, CodeAddress* argStart);
+int isReadOnlySlot(CodeBlock* codeBlock, CompiledBlock* callee, WORD q);
+int eliminateTailCalls(CodeBlock* codeBlock, CodeAddress start, CodeAddress end);
+int isTailCall(CodeBlock* codeBlock, CodeAddress start, int* depth, CodeAddress call);
+void compactEntry(CodeBlock* codeBlock, CompiledBlock* block);
+int compactCalls(CodeBlock* codeBlock, CodeAddress start);
+int memoizeBlock(CodeBlock* codeBlock, CompiledBlock* block);
+int evaluateConstantCalls(CodeBlock* codeBlock, CodeAddress start);
+int cloneCalls(CodeBlock* codeBlock, CodeAddress blockAddress);
+int unrollLoops(CodeBlock* codeBlock, CodeAddress start);
+int vectorizeLoops(CodeBlock* codeBlock, CodeAddress start);
+// Tell whether a call may store to the word at offset q of the frame
+int callWritesVariable(Instruction* call, WORD q);
+int eliminateBoundsChecks(CodeBlock* codeBlock, CodeAddress start);
+
+#endif
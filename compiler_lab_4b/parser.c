@@ -16,15 +16,22 @@
 
 Token *currentToken;
 Token *lookAhead;
+enum Directive lookAheadDirective;
+// On the right side of a comparison, AND and OR join conditions instead
+// of being operators on integers (see compileComparison)
+int rightOfComparison = FALSE;
 
 extern Type* intType;
 extern Type* charType;
 extern SymTab* symtab;
+extern int showFrameSizes;
+extern int showSummaries;
 
 void scan(void) {
   Token* tmp = currentToken;
   currentToken = lookAhead;
   lookAhead = getValidToken();
+  lookAheadDirective = takeDirective();
   free(tmp);
 }
 
@@ -43,6 +50,7 @@ void compileProgram(void) {
 
   program = createProgramObject(currentToken->string);
   program->progAttrs->codeAddress = getCurrentCodeAddress();
+  setBlockName(program->progAttrs->codeAddress, program->name);
   enterBlock(program->progAttrs->scope);
 
   eat(SB_SEMICOLON);
@@ -52,6 +60,9 @@ void compileProgram(void) {
 
   // Halt the program
   genHL();
+  optimizeCodeBuffer(program->progAttrs->codeAddress);
+  if (showFrameSizes) printFrameSize(program);
+  if (showSummaries) printSummaries(program);
 
   exitBlock();
 }
@@ -69,7 +80,9 @@ void compileConstDecls(void) {
       declareObject(constObj);
       
       eat(SB_EQ);
-      constValue = compileConstant();
+      if (lookAhead->tokenType == SB_LSEL)
+	constValue = compileArrayConstant();
+      else constValue = compileConstant();
       constObj->constAttrs->value = constValue;
       
       eat(SB_SEMICOLON);
@@ -146,9 +159,27 @@ void compileSubDecls(void) {
   }
 }
 
+// Pass a directive written before a subroutine on to the optimizer
+void declareDirective(CodeAddress blockAddress, enum Directive directive) {
+  switch (directive) {
+  case DIR_INLINE:
+    setInlineDirective(blockAddress, TRUE);
+    break;
+  case DIR_NOINLINE:
+    setInlineDirective(blockAddress, FALSE);
+    break;
+  case DIR_MEMO:
+    setMemoDirective(blockAddress);
+    break;
+  default:
+    break;
+  }
+}
+
 void compileFuncDecl(void) {
   Object* funcObj;
   Type* returnType;
+  enum Directive directive = lookAheadDirective;
 
   eat(KW_FUNCTION);
   eat(TK_IDENT);
@@ -157,6 +188,8 @@ void compileFuncDecl(void) {
   funcObj = createFunctionObject(currentToken->string);
   funcObj->funcAttrs->codeAddress = getCurrentCodeAddress();
   declareObject(funcObj);
+  declareDirective(funcObj->funcAttrs->codeAddress, directive);
+  setBlockName(funcObj->funcAttrs->codeAddress, funcObj->name);
 
   enterBlock(funcObj->funcAttrs->scope);
   
@@ -169,6 +202,10 @@ void compileFuncDecl(void) {
   eat(SB_SEMICOLON);
 
   compileBlock();
+  genEF();
+  setBlockParamCount(funcObj->funcAttrs->codeAddress, FUNCTION_PARAM_COUNT(funcObj));
+  optimizeCodeBuffer(funcObj->funcAttrs->codeAddress);
+  if (showFrameSizes) printFrameSize(funcObj);
 
   eat(SB_SEMICOLON);
 
@@ -177,6 +214,7 @@ void compileFuncDecl(void) {
 
 void compileProcDecl(void) {
   Object* procObj;
+  enum Directive directive = lookAheadDirective;
 
   eat(KW_PROCEDURE);
   eat(TK_IDENT);
@@ -185,6 +223,8 @@ void compileProcDecl(void) {
   procObj = createProcedureObject(currentToken->string);
   procObj->procAttrs->codeAddress = getCurrentCodeAddress();
   declareObject(procObj);
+  declareDirective(procObj->procAttrs->codeAddress, directive);
+  setBlockName(procObj->procAttrs->codeAddress, procObj->name);
 
   enterBlock(procObj->procAttrs->scope);
 
@@ -192,6 +232,10 @@ void compileProcDecl(void) {
 
   eat(SB_SEMICOLON);
   compileBlock();
+  genEP();
+  setBlockParamCount(procObj->procAttrs->codeAddress, PROCEDURE_PARAM_COUNT(procObj));
+  optimizeCodeBuffer(procObj->procAttrs->codeAddress);
+  if (showFrameSizes) printFrameSize(procObj);
 
   eat(SB_SEMICOLON);
 
@@ -273,6 +317,53 @@ ConstantValue* compileConstant2(void) {
   return constValue;
 }
 
+ConstantValue* compileArrayConstant(void) {
+  // The elements go to the data segment as they are read, laid out as
+  // those of an array variable are in a frame
+  WORD dataAddress = getCurrentDataAddress();
+  Type* arrayType = compileArrayInitializer();
+
+  return makeArrayConstant(arrayType, dataAddress);
+}
+
+Type* compileArrayInitializer(void) {
+  // (. e1, e2, ... .), each element a constant or an initializer of its own
+  Type* elementType;
+  Type* type;
+  int size = 1;
+
+  eat(SB_LSEL);
+  elementType = compileInitializerElement();
+  while (lookAhead->tokenType == SB_COMMA) {
+    eat(SB_COMMA);
+    type = compileInitializerElement();
+    checkTypeEquality(elementType, type);
+    freeType(type);
+    size ++;
+  }
+  eat(SB_RSEL);
+  return makeArrayType(size, elementType);
+}
+
+Type* compileInitializerElement(void) {
+  ConstantValue* value;
+  Type* type;
+
+  if (lookAhead->tokenType == SB_LSEL)
+    return compileArrayInitializer();
+
+  value = compileConstant();
+  if (value->type == TP_CHAR) {
+    type = makeCharType();
+    genData(value->charValue);
+  } else {
+    type = makeIntType();
+    genData(value->intValue);
+  }
+  free(value);
+  return type;
+}
+
 Type* compileType(void) {
   Type* type;
   Type* elementType;
@@ -357,7 +448,10 @@ void compileParam(void) {
   checkFreshIdent(currentToken->string);
   param = createParameterObject(currentToken->string, paramKind);
   eat(SB_COLON);
-  type = compileBasicType();
+  // Arrays are passed by their address only
+  if (paramKind == PARAM_REFERENCE)
+    type = compileType();
+  else type = compileBasicType();
   param->paramAttrs->type = type;
   declareObject(param);
 }
@@ -371,6 +465,9 @@ void compileStatements(void) {
 }
 
 void compileStatement(void) {
+  // The code the enclosing statement emits after this one is its own
+  int outerLine = setSourceLine(lookAhead->lineNo);
+
   switch (lookAhead->tokenType) {
   case TK_IDENT:
     compileAssignSt();
@@ -390,6 +487,9 @@ void compileStatement(void) {
   case KW_FOR:
     compileForSt();
     break;
+  case KW_CASE:
+    compileCaseSt();
+    break;
     // EmptySt needs to check FOLLOW tokens
   case SB_SEMICOLON:
   case KW_END:
@@ -400,6 +500,7 @@ void compileStatement(void) {
     error(ERR_INVALID_STATEMENT, lookAhead->lineNo, lookAhead->colNo);
     break;
   }
+  setSourceLine(outerLine);
 }
 
 Type* compileLValue(void) {
@@ -422,13 +523,18 @@ Type* compileLValue(void) {
       varType = var->varAttrs->type;
     break;
   case OBJ_PARAMETER:
-    // TEMPORARY: halt the program
-    genHL();
-    varType = var->paramAttrs->type;
+    // A reference parameter holds the address of the argument
+    if (var->paramAttrs->kind == PARAM_VALUE)
+      genParameterAddress(var);
+    else genParameterValue(var);
+    if (var->paramAttrs->type->typeClass == TP_ARRAY)
+      varType = compileIndexes(var->paramAttrs->type);
+    else
+      varType = var->paramAttrs->type;
     break;
   case OBJ_FUNCTION:
-    // TEMPORARY: halt the program
-    genHL();
+    // The result of the function is assigned to its return value slot
+    genReturnValueAddress(var);
     varType = var->funcAttrs->returnType;
     break;
   default: 
@@ -446,6 +552,14 @@ void compileAssignSt(void) {
   varType = compileLValue();
   
   eat(SB_ASSIGN);
+  if (varType->typeClass == TP_ARRAY) {
+    // Arrays are copied as a whole, word by word, from the address of
+    // the source
+    expType = compileLValue();
+    checkTypeEquality(varType, expType);
+    genBM(sizeOfType(varType));
+    return;
+  }
   expType = compileExpression();
   checkTypeEquality(varType, expType);
 
@@ -454,7 +568,6 @@ void compileAssignSt(void) {
 
 void compileCallSt(void) {
   // Generate code for call-statement
-  // TEMPORARY. halt
   Object* proc;
 
   eat(KW_CALL);
@@ -466,8 +579,13 @@ void compileCallSt(void) {
     compileArguments(proc->procAttrs->paramList);
     genPredefinedProcedureCall(proc);
   } else {
+    // Reserve the return value, dynamic link, return address and static
+    // link, push the arguments into the new frame, then drop them all again
+    // so that CALL makes the frame start right above the caller's top
+    genINT(RESERVED_WORDS);
     compileArguments(proc->procAttrs->paramList);
-    genHL();
+    genDCT(RESERVED_WORDS + PROCEDURE_PARAM_COUNT(proc));
+    genProcedureCall(proc);
   }
 }
 
@@ -479,39 +597,41 @@ void compileGroupSt(void) {
 
 void compileIfSt(void) {
   // TODO: generate code for if-statement
-  Instruction* fjInstruction;
+  JumpList trueJumps = {NULL, 0};
+  JumpList falseJumps = {NULL, 0};
   Instruction* jInstruction;
 
   eat(KW_IF);
-  compileCondition();
+  compileCondition(FALSE, &trueJumps, &falseJumps);
   eat(KW_THEN);
 
-  fjInstruction = genFJ(DC_VALUE);
+  updateJumps(&trueJumps, getCurrentCodeAddress());
   compileStatement();
   if (lookAhead->tokenType == KW_ELSE) {
     jInstruction = genJ(DC_VALUE);
-    updateFJ(fjInstruction, getCurrentCodeAddress());
+    updateJumps(&falseJumps, getCurrentCodeAddress());
     eat(KW_ELSE);
     compileStatement();
     updateJ(jInstruction, getCurrentCodeAddress());
   } else {
-    updateFJ(fjInstruction, getCurrentCodeAddress());
+    updateJumps(&falseJumps, getCurrentCodeAddress());
   }
 }
 
 void compileWhileSt(void) {
   // TODO: generate code for while statement
   CodeAddress beginWhile;
-  Instruction* fjInstruction;
+  JumpList trueJumps = {NULL, 0};
+  JumpList falseJumps = {NULL, 0};
 
   beginWhile = getCurrentCodeAddress();
   eat(KW_WHILE);
-  compileCondition();
-  fjInstruction = genFJ(DC_VALUE);
+  compileCondition(FALSE, &trueJumps, &falseJumps);
+  updateJumps(&trueJumps, getCurrentCodeAddress());
   eat(KW_DO);
   compileStatement();
   genJ(beginWhile);
-  updateFJ(fjInstruction, getCurrentCodeAddress());
+  updateJumps(&falseJumps, getCurrentCodeAddress());
 }
 
 void compileForSt(void) {
@@ -559,11 +679,98 @@ void compileForSt(void) {
 
 }
 
+// A label of a CASE statement, of the type of the selector
+WORD compileCaseLabel(Type* selectorType) {
+  ConstantValue* value;
+  WORD label;
+
+  value = compileConstant();
+  if (value->type != selectorType->typeClass)
+    error(ERR_TYPE_INCONSISTENCY, currentToken->lineNo, currentToken->colNo);
+  label = (value->type == TP_CHAR) ? value->charValue : value->intValue;
+  free(value);
+  return label;
+}
+
+// The labels of an arm, each one a constant or a range lo..hi, appended
+// to ranges
+void compileCaseLabels(Type* selectorType, CaseRange** ranges, int* count, CodeAddress arm) {
+  CaseRange range;
+  int k;
+
+  while (1) {
+    range.lo = compileCaseLabel(selectorType);
+    range.hi = range.lo;
+    if (lookAhead->tokenType == SB_RANGE) {
+      eat(SB_RANGE);
+      range.hi = compileCaseLabel(selectorType);
+      if (range.lo > range.hi)
+	error(ERR_EMPTY_CASE_RANGE, currentToken->lineNo, currentToken->colNo);
+    }
+    range.arm = arm;
+    for (k = 0; k < *count; k ++)
+      if ((range.lo <= (*ranges)[k].hi) && ((*ranges)[k].lo <= range.hi))
+	error(ERR_DUPLICATE_CASE_LABEL, currentToken->lineNo, currentToken->colNo);
+
+    *ranges = (CaseRange*) realloc(*ranges, (*count + 1) * sizeof(CaseRange));
+    (*ranges)[(*count)++] = range;
+
+    if (lookAhead->tokenType != SB_COMMA) break;
+    eat(SB_COMMA);
+  }
+}
+
+void compileCaseSt(void) {
+  // The arms come first, and the dispatch on the selector after them
+  // (see genCaseDispatch), once all the labels are known
+  Instruction* dispatch;
+  Instruction** exits = NULL;
+  CaseRange* ranges = NULL;
+  CodeAddress otherwise = NO_OTHERWISE;
+  Type* selectorType;
+  int rangeCount = 0, exitCount = 0, k;
+
+  eat(KW_CASE);
+  selectorType = compileExpression();
+  checkBasicType(selectorType);
+  eat(KW_OF);
+  dispatch = genJ(DC_VALUE);
+
+  while (1) {
+    compileCaseLabels(selectorType, &ranges, &rangeCount, getCurrentCodeAddress());
+    eat(SB_COLON);
+    compileStatement();
+    exits = (Instruction**) realloc(exits, (exitCount + 1) * sizeof(Instruction*));
+    exits[exitCount++] = genJ(DC_VALUE);
+
+    if (lookAhead->tokenType != SB_SEMICOLON) break;
+    eat(SB_SEMICOLON);
+    if ((lookAhead->tokenType == KW_ELSE) || (lookAhead->tokenType == KW_END)) break;
+  }
+
+  if (lookAhead->tokenType == KW_ELSE) {
+    eat(KW_ELSE);
+    otherwise = getCurrentCodeAddress();
+    compileStatements();
+    exits = (Instruction**) realloc(exits, (exitCount + 1) * sizeof(Instruction*));
+    exits[exitCount++] = genJ(DC_VALUE);
+  }
+  eat(KW_END);
+
+  updateJ(dispatch, getCurrentCodeAddress());
+  genCaseDispatch(ranges, rangeCount, otherwise);
+  for (k = 0; k < exitCount; k ++)
+    updateJ(exits[k], getCurrentCodeAddress());
+
+  free(ranges);
+  free(exits);
+}
+
 void compileArgument(Object* param) {
   Type* type;
 
   if (param->paramAttrs->kind == PARAM_VALUE) {
-    type = compileExpression();
+    type = compileNestedExpression();
     checkTypeEquality(type, param->paramAttrs->type);
   } else {
     type = compileLValue();
@@ -598,10 +805,15 @@ void compileArguments(ObjectNode* paramList) {
     // Check FOLLOW set 
   case SB_TIMES:
   case SB_SLASH:
+  case KW_MOD:
+  case KW_XOR:
+  case KW_SHL:
+  case KW_SHR:
   case SB_PLUS:
   case SB_MINUS:
   case KW_TO:
   case KW_DO:
+  case KW_OF:
   case SB_RPAR:
   case SB_COMMA:
   case SB_EQ:
@@ -615,46 +827,160 @@ void compileArguments(ObjectNode* paramList) {
   case KW_END:
   case KW_ELSE:
   case KW_THEN:
+  case KW_AND:
+  case KW_OR:
     break;
   default:
     error(ERR_INVALID_ARGUMENTS, lookAhead->lineNo, lookAhead->colNo);
   }
 }
 
-void compileCondition(void) {
-  // TODO: generate code for condition
-  Type* type1;
-  Type* type2;
-  TokenType op;
+// Conditions are compiled to jumps, and never to a value. The code of a
+// condition falls through when it holds, and takes one of the FJs of
+// falseJumps otherwise; the FJs of trueJumps skip the rest of the code
+// of a condition once it is known to hold. NOT is pushed down to the
+// comparisons: a negated condition compiles the opposite comparisons,
+// with AND and OR swapped.
 
-  type1 = compileExpression();
-  checkBasicType(type1);
+void compileCondition(int negated, JumpList* trueJumps, JumpList* falseJumps) {
+  compileConditionTerm(negated, trueJumps, falseJumps);
+  compileCondition2(negated, trueJumps, falseJumps);
+}
 
-  op = lookAhead->tokenType;
-  switch (op) {
-  case SB_EQ:
-    eat(SB_EQ);
+// The right operand of AND runs when the left one holds, and the left
+// operand of OR jumps past the right one when it holds
+void joinConditions(int isAnd, JumpList* trueJumps, JumpList* falseJumps) {
+  Instruction* fjInstruction;
+
+  if (isAnd) {
+    updateJumps(trueJumps, getCurrentCodeAddress());
+  } else {
+    fjInstruction = takeLastJump(falseJumps);
+    invertComparison(fjInstruction);
+    addJump(trueJumps, fjInstruction);
+    updateJumps(falseJumps, getCurrentCodeAddress());
+  }
+}
+
+void compileCondition2(int negated, JumpList* trueJumps, JumpList* falseJumps) {
+  JumpList termTrueJumps = {NULL, 0};
+  JumpList termFalseJumps = {NULL, 0};
+
+  while (lookAhead->tokenType == KW_OR) {
+    eat(KW_OR);
+    joinConditions(negated, trueJumps, falseJumps);
+    compileConditionTerm(negated, &termTrueJumps, &termFalseJumps);
+    appendJumps(trueJumps, &termTrueJumps);
+    appendJumps(falseJumps, &termFalseJumps);
+  }
+}
+
+void compileConditionTerm(int negated, JumpList* trueJumps, JumpList* falseJumps) {
+  compileConditionFactor(negated, trueJumps, falseJumps);
+  compileConditionTerm2(negated, trueJumps, falseJumps);
+}
+
+void compileConditionTerm2(int negated, JumpList* trueJumps, JumpList* falseJumps) {
+  while (lookAhead->tokenType == KW_AND) {
+    eat(KW_AND);
+    joinConditions(!negated, trueJumps, falseJumps);
+    compileConditionFactor(negated, trueJumps, falseJumps);
+  }
+}
+
+void compileConditionFactor(int negated, JumpList* trueJumps, JumpList* falseJumps) {
+  Type* type;
+
+  switch (lookAhead->tokenType) {
+  case KW_NOT:
+    eat(KW_NOT);
+    compileConditionFactor(!negated, trueJumps, falseJumps);
     break;
-  case SB_NEQ:
-    eat(SB_NEQ);
+  case SB_LPAR:
+    if (compileParenthesizedCondition(negated, trueJumps, falseJumps, &type))
+      break;
+    // A parenthesized expression starting the left side of a comparison
+    type = compileTerm2(type);
+    type = compileExpression3(type);
+    compileComparison(type, negated, falseJumps);
     break;
-  case SB_LE:
-    eat(SB_LE);
+  default:
+    type = compileExpression();
+    compileComparison(type, negated, falseJumps);
     break;
+  }
+}
+
+int isComparisonOperator(TokenType tokenType) {
+  switch (tokenType) {
+  case SB_EQ:
+  case SB_NEQ:
+  case SB_LE:
   case SB_LT:
-    eat(SB_LT);
-    break;
   case SB_GE:
-    eat(SB_GE);
-    break;
   case SB_GT:
-    eat(SB_GT);
-    break;
+    return TRUE;
   default:
-    error(ERR_INVALID_COMPARATOR, lookAhead->lineNo, lookAhead->colNo);
+    return FALSE;
   }
+}
+
+// A parenthesis opening a condition factor holds either a condition, or
+// an expression: that is known from the first comparison or NOT found in
+// it. Returns FALSE on an expression, with its type in *type.
+int compileParenthesizedCondition(int negated, JumpList* trueJumps, JumpList* falseJumps, Type** type) {
+  JumpList innerTrueJumps = {NULL, 0};
+  JumpList innerFalseJumps = {NULL, 0};
+  int isCondition;
+
+  eat(SB_LPAR);
+  if (lookAhead->tokenType == KW_NOT) {
+    compileCondition(negated, &innerTrueJumps, &innerFalseJumps);
+  } else {
+    if (lookAhead->tokenType == SB_LPAR) {
+      isCondition = compileParenthesizedCondition(negated, &innerTrueJumps, &innerFalseJumps, type);
+      if (!isCondition) {
+	*type = compileTerm2(*type);
+	*type = compileExpression3(*type);
+      }
+    } else {
+      isCondition = FALSE;
+      *type = compileExpression();
+    }
+    if (!isCondition) {
+      if (!isComparisonOperator(lookAhead->tokenType)) {
+	eat(SB_RPAR);
+	return FALSE;
+      }
+      compileComparison(*type, negated, &innerFalseJumps);
+    }
+    // The rest of the condition after its first factor
+    compileConditionTerm2(negated, &innerTrueJumps, &innerFalseJumps);
+    compileCondition2(negated, &innerTrueJumps, &innerFalseJumps);
+  }
+  eat(SB_RPAR);
+  appendJumps(trueJumps, &innerTrueJumps);
+  appendJumps(falseJumps, &innerFalseJumps);
+  return TRUE;
+}
+
+// The comparison of the left side, of type type1, with the right one,
+// ending with the FJ taken when it does not hold (or holds, if negated)
+void compileComparison(Type* type1, int negated, JumpList* falseJumps) {
+  Instruction* fjInstruction;
+  Type* type2;
+  TokenType op;
+
+  checkBasicType(type1);
 
+  op = lookAhead->tokenType;
+  if (!isComparisonOperator(op))
+    error(ERR_INVALID_COMPARATOR, lookAhead->lineNo, lookAhead->colNo);
+  eat(op);
+
+  rightOfComparison = TRUE;
   type2 = compileExpression();
+  rightOfComparison = FALSE;
   checkTypeEquality(type1,type2);
 
   switch (op) { // Generate code for comparison
@@ -680,6 +1006,10 @@ void compileCondition(void) {
     break;
   }
 
+  fjInstruction = genFJ(DC_VALUE);
+  if (negated)
+    invertComparison(fjInstruction);
+  addJump(falseJumps, fjInstruction);
 }
 
 Type* compileExpression(void) {
@@ -704,6 +1034,18 @@ Type* compileExpression(void) {
   return type;
 }
 
+// An expression in parentheses, brackets or arguments, where AND and OR
+// are always operators
+Type* compileNestedExpression(void) {
+  int saved = rightOfComparison;
+  Type* type;
+
+  rightOfComparison = FALSE;
+  type = compileExpression();
+  rightOfComparison = saved;
+  return type;
+}
+
 Type* compileExpression2(void) {
   Type* type;
 
@@ -738,11 +1080,36 @@ Type* compileExpression3(Type* argType1) {
 
     genSB();
 
+    resultType = compileExpression3(argType1);
+    break;
+  case KW_OR:
+    if (rightOfComparison) {
+      resultType = argType1;
+      break;
+    }
+    eat(KW_OR);
+    checkIntType(argType1);
+    argType2 = compileTerm();
+    checkIntType(argType2);
+
+    genOR();
+
+    resultType = compileExpression3(argType1);
+    break;
+  case KW_XOR:
+    eat(KW_XOR);
+    checkIntType(argType1);
+    argType2 = compileTerm();
+    checkIntType(argType2);
+
+    genXOR();
+
     resultType = compileExpression3(argType1);
     break;
     // check the FOLLOW set
   case KW_TO:
   case KW_DO:
+  case KW_OF:
   case SB_RPAR:
   case SB_COMMA:
   case SB_EQ:
@@ -756,6 +1123,7 @@ Type* compileExpression3(Type* argType1) {
   case KW_END:
   case KW_ELSE:
   case KW_THEN:
+  case KW_AND:
     resultType = argType1;
     break;
   default:
@@ -796,6 +1164,50 @@ Type* compileTerm2(Type* argType1) {
 
     genDV();
 
+    resultType = compileTerm2(argType1);
+    break;
+  case KW_MOD:
+    eat(KW_MOD);
+    checkIntType(argType1);
+    argType2 = compileFactor();
+    checkIntType(argType2);
+
+    genMOD();
+
+    resultType = compileTerm2(argType1);
+    break;
+  case KW_AND:
+    if (rightOfComparison) {
+      resultType = argType1;
+      break;
+    }
+    eat(KW_AND);
+    checkIntType(argType1);
+    argType2 = compileFactor();
+    checkIntType(argType2);
+
+    genAND();
+
+    resultType = compileTerm2(argType1);
+    break;
+  case KW_SHL:
+    eat(KW_SHL);
+    checkIntType(argType1);
+    argType2 = compileFactor();
+    checkIntType(argType2);
+
+    genSHL();
+
+    resultType = compileTerm2(argType1);
+    break;
+  case KW_SHR:
+    eat(KW_SHR);
+    checkIntType(argType1);
+    argType2 = compileFactor();
+    checkIntType(argType2);
+
+    genSHR();
+
     resultType = compileTerm2(argType1);
     break;
     // check the FOLLOW set
@@ -803,6 +1215,7 @@ Type* compileTerm2(Type* argType1) {
   case SB_MINUS:
   case KW_TO:
   case KW_DO:
+  case KW_OF:
   case SB_RPAR:
   case SB_COMMA:
   case SB_EQ:
@@ -816,6 +1229,8 @@ Type* compileTerm2(Type* argType1) {
   case KW_END:
   case KW_ELSE:
   case KW_THEN:
+  case KW_OR:
+  case KW_XOR:
     resultType = argType1;
     break;
   default:
@@ -855,6 +1270,13 @@ Type* compileFactor(void) {
 	type = charType;
 	genLC(obj->constAttrs->value->charValue);
 	break;
+      case TP_ARRAY:
+	// The address of the elements in the data segment, read by LD
+	genLC(obj->constAttrs->value->dataAddress);
+	type = compileIndexes(obj->constAttrs->value->arrayType);
+	checkBasicType(type);
+	genLD();
+	break;
       default:
 	break;
       }
@@ -863,6 +1285,7 @@ Type* compileFactor(void) {
       if (obj->varAttrs->type->typeClass == TP_ARRAY) {
 	genVariableAddress(obj);
 	type = compileIndexes(obj->varAttrs->type);
+	checkBasicType(type);
 	genLI();
       } else {
 	type = obj->varAttrs->type;
@@ -872,7 +1295,12 @@ Type* compileFactor(void) {
     case OBJ_PARAMETER:
       type = obj->paramAttrs->type;
       genParameterValue(obj);
-      if (obj->paramAttrs->kind == PARAM_REFERENCE)
+      if (type->typeClass == TP_ARRAY) {
+	// The address of the array, passed by reference
+	type = compileIndexes(type);
+	checkBasicType(type);
+	genLI();
+      } else if (obj->paramAttrs->kind == PARAM_REFERENCE)
 	genLI();
       break;
     case OBJ_FUNCTION:
@@ -880,9 +1308,9 @@ Type* compileFactor(void) {
 	compileArguments(obj->funcAttrs->paramList);
 	genPredefinedFunctionCall(obj);
       } else {
-	genINT(4);
+	genINT(RESERVED_WORDS);
 	compileArguments(obj->funcAttrs->paramList);
-	genDCT(4+obj->funcAttrs->paramCount);
+	genDCT(RESERVED_WORDS + FUNCTION_PARAM_COUNT(obj));
 	genFunctionCall(obj);
       }
       type = obj->funcAttrs->returnType;
@@ -894,7 +1322,7 @@ Type* compileFactor(void) {
     break;
   case SB_LPAR:
     eat(SB_LPAR);
-    type = compileExpression();
+    type = compileNestedExpression();
     eat(SB_RPAR);
     break;
   default:
@@ -905,22 +1333,49 @@ Type* compileFactor(void) {
 }
 
 Type* compileIndexes(Type* arrayType) {
-  // TEMPORARY: halt
+  // The address of the array is on the stack. An index moves it by the
+  // size of the elements of its dimension, known from the type. Indexes
+  // start at 1: the -1 of each one, and the constant indexes, add up to
+  // a single offset added last. With checkBounds, constant indexes are
+  // checked here and the others by a BC. The indexes may stop short of
+  // the elements, for the assignment of a whole array.
   Type* type;
+  CodeAddress indexStart;
+  WORD index, stride, offset = 0;
 
-  
   while (lookAhead->tokenType == SB_LSEL) {
     eat(SB_LSEL);
-    type = compileExpression();
+    indexStart = getCurrentCodeAddress();
+    type = compileNestedExpression();
     checkIntType(type);
     checkArrayType(arrayType);
 
-    genHL();
+    stride = sizeOfType(arrayType->elementType);
+    if (takeConstant(indexStart, &index)) {
+      if (checkBounds && ((index < 1) || (index > arrayType->arraySize)))
+	error(ERR_INDEX_OUT_OF_RANGE, currentToken->lineNo, currentToken->colNo);
+      offset += (index - 1) * stride;
+    } else {
+      if (checkBounds)
+	genBC(arrayType->arraySize);
+      if (stride != 1) {
+	genLC(stride);
+	genML();
+      }
+      genAD();
+      offset -= stride;
+    }
 
     arrayType = arrayType->elementType;
     eat(SB_RSEL);
   }
-  checkBasicType(arrayType);
+  if (offset > 0) {
+    genLC(offset);
+    genAD();
+  } else if (offset < 0) {
+    genLC(- offset);
+    genSB();
+  }
   return arrayType;
 }
 
@@ -930,6 +1385,7 @@ int compile(char *fileName) {
 
   currentToken = NULL;
   lookAhead = getValidToken();
+  lookAheadDirective = takeDirective();
 
   initSymTab();
 
@@ -7,6 +7,7 @@
 #define __PARSER_H__
 #include "token.h"
 #include "symtab.h"
+#include "codegen.h"
 
 void scan(void);
 void eat(TokenType tokenType);
@@ -29,6 +30,9 @@ void compileProcDecl(void);
 ConstantValue* compileUnsignedConstant(void);
 ConstantValue* compileConstant(void);
 ConstantValue* compileConstant2(void);
+ConstantValue* compileArrayConstant(void);
+Type* compileArrayInitializer(void);
+Type* compileInitializerElement(void);
 Type* compileType(void);
 Type* compileBasicType(void);
 void compileParams(void);
@@ -43,10 +47,22 @@ void compileIfSt(void);
 void compileElseSt(void);
 void compileWhileSt(void);
 void compileForSt(void);
+WORD compileCaseLabel(Type* selectorType);
+void compileCaseLabels(Type* selectorType, CaseRange** ranges, int* count, CodeAddress arm);
+void compileCaseSt(void);
 void compileArgument(Object* param);
 void compileArguments(ObjectNode* paramList);
-void compileCondition(void);
+void compileCondition(int negated, JumpList* trueJumps, JumpList* falseJumps);
+void joinConditions(int isAnd, JumpList* trueJumps, JumpList* falseJumps);
+void compileCondition2(int negated, JumpList* trueJumps, JumpList* falseJumps);
+void compileConditionTerm(int negated, JumpList* trueJumps, JumpList* falseJumps);
+void compileConditionTerm2(int negated, JumpList* trueJumps, JumpList* falseJumps);
+void compileConditionFactor(int negated, JumpList* trueJumps, JumpList* falseJumps);
+int isComparisonOperator(TokenType tokenType);
+int compileParenthesizedCondition(int negated, JumpList* trueJumps, JumpList* falseJumps, Type** type);
+void compileComparison(Type* type1, int negated, JumpList* falseJumps);
 Type* compileExpression(void);
+Type* compileNestedExpression(void);
 Type* compileExpression2(void);
 Type* compileExpression3(Type* argType1);
 Type* compileTerm(void);
@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <string.h>
 
 #include "reader.h"
 #include "charcode.h"
@@ -21,6 +22,9 @@ extern int currentChar;
 
 extern CharCode charCodes[];
 
+// The directive read in the last comment, for the next token
+enum Directive pendingDirective = DIR_NONE;
+
 /***************************************************************/
 
 void skipBlank() {
@@ -48,6 +52,35 @@ void skipComment() {
     error(ERR_END_OF_COMMENT, lineNo, colNo);
 }
 
+// A comment starting with $ is a directive: (*$INLINE*), (*$NOINLINE*),
+// (*$MEMO*).
+// Unknown directives are ignored like any other comment.
+void readDirective(void) {
+  char name[MAX_IDENT_LEN + 1];
+  int count = 0;
+
+  readChar();
+  while ((currentChar != EOF) && (charCodes[currentChar] == CHAR_LETTER)) {
+    if (count < MAX_IDENT_LEN)
+      name[count++] = toupper((char)currentChar);
+    readChar();
+  }
+  name[count] = '\0';
+
+  if (strcmp(name, "INLINE") == 0)
+    pendingDirective = DIR_INLINE;
+  else if (strcmp(name, "NOINLINE") == 0)
+    pendingDirective = DIR_NOINLINE;
+  else if (strcmp(name, "MEMO") == 0)
+    pendingDirective = DIR_MEMO;
+}
+
+enum Directive takeDirective(void) {
+  enum Directive directive = pendingDirective;
+  pendingDirective = DIR_NONE;
+  return directive;
+}
+
 Token* readIdentKeyword(void) {
   Token *token = makeToken(TK_NONE, lineNo, colNo);
   int count = 1;
@@ -77,15 +110,20 @@ Token* readIdentKeyword(void) {
 
 Token* readNumber(void) {
   Token *token = makeToken(TK_NUMBER, lineNo, colNo);
-  int count = 0;
+  int count = 0, digit;
 
+  token->value = 0;
   while ((currentChar != EOF) && (charCodes[currentChar] == CHAR_DIGIT)) {
-    token->string[count++] = (char)currentChar;
+    if (count < MAX_IDENT_LEN)
+      token->string[count++] = (char)currentChar;
+    digit = currentChar - '0';
+    if (token->value > (WORD_MAX - digit) / 10)
+      error(ERR_NUMBER_TOO_LARGE, token->lineNo, token->colNo);
+    token->value = token->value * 10 + digit;
     readChar();
   }
 
   token->string[count] = '\0';
-  token->value = atoi(token->string);
   return token;
 }
 
@@ -190,6 +228,9 @@ Token* getToken(void) {
     if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_RPAR)) {
       readChar();
       return makeToken(SB_RSEL, ln, cn);
+    } else if ((currentChar != EOF) && (charCodes[currentChar] == CHAR_PERIOD)) {
+      readChar();
+      return makeToken(SB_RANGE, ln, cn);
     } else return makeToken(SB_PERIOD, ln, cn);
   case CHAR_SEMICOLON:
     token = makeToken(SB_SEMICOLON, lineNo, colNo);
@@ -218,6 +259,8 @@ Token* getToken(void) {
       return makeToken(SB_LSEL, ln, cn);
     case CHAR_TIMES:
       readChar();
+      if (currentChar == '$')
+	readDirective();
       skipComment();
       return getToken();
     default:
@@ -278,10 +321,19 @@ void printToken(Token *token) {
   case KW_DO: printf("KW_DO\n"); break;
   case KW_FOR: printf("KW_FOR\n"); break;
   case KW_TO: printf("KW_TO\n"); break;
+  case KW_CASE: printf("KW_CASE\n"); break;
+  case KW_AND: printf("KW_AND\n"); break;
+  case KW_OR: printf("KW_OR\n"); break;
+  case KW_NOT: printf("KW_NOT\n"); break;
+  case KW_MOD: printf("KW_MOD\n"); break;
+  case KW_XOR: printf("KW_XOR\n"); break;
+  case KW_SHL: printf("KW_SHL\n"); break;
+  case KW_SHR: printf("KW_SHR\n"); break;
 
   case SB_SEMICOLON: printf("SB_SEMICOLON\n"); break;
   case SB_COLON: printf("SB_COLON\n"); break;
   case SB_PERIOD: printf("SB_PERIOD\n"); break;
+  case SB_RANGE: printf("SB_RANGE\n"); break;
   case SB_COMMA: printf("SB_COMMA\n"); break;
   case SB_ASSIGN: printf("SB_ASSIGN\n"); break;
   case SB_EQ: printf("SB_EQ\n"); break;
@@ -9,8 +9,18 @@
 
 #include "token.h"
 
+// Compiler directives, written as comments such as (*$INLINE*)
+enum Directive {
+  DIR_NONE,
+  DIR_INLINE,
+  DIR_NOINLINE,
+  DIR_MEMO
+};
+
 Token* getToken(void);
 Token* getValidToken(void);
 void printToken(Token *token);
+// The directive written right before the last token read, if any
+enum Directive takeDirective(void);
 
 #endif
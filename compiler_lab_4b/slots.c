@@ -0,0 +1,512 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "slots.h"
+#include "summary.h"
+
+// What is known about one stack word: the address of a slot, or nothing
+struct AbstractWord_ {
+  int known;
+  WORD p, q;
+};
+
+typedef struct AbstractWord_ AbstractWord;
+
+struct AbstractStack_ {
+  int reached;
+  int depth;
+  int maxDepth;
+  AbstractWord* words;
+};
+
+typedef struct AbstractStack_ AbstractStack;
+
+// Slots whose address is used otherwise than to load or store
+struct EscapeList_ {
+  SlotAccess* slots;
+  int count;
+  int max;
+};
+
+typedef struct EscapeList_ EscapeList;
+
+void pushWord(AbstractStack* stack, int known, WORD p, WORD q) {
+  if (stack->depth == stack->maxDepth) {
+    stack->maxDepth = stack->maxDepth * 2 + 16;
+    stack->words = (AbstractWord*) realloc(stack->words, stack->maxDepth * sizeof(AbstractWord));
+  }
+  stack->words[stack->depth].known = known;
+  stack->words[stack->depth].p = p;
+  stack->words[stack->depth].q = q;
+  stack->depth ++;
+}
+
+// Words pushed before the range are unknown
+AbstractWord popWord(AbstractStack* stack) {
+  AbstractWord word;
+
+  if (stack->depth > 0)
+    return stack->words[-- stack->depth];
+  word.known = FALSE;
+  word.p = 0;
+  word.q = 0;
+  return word;
+}
+
+void escapeWord(EscapeList* escapes, AbstractWord* word) {
+  if (!word->known) return;
+  if (escapes->count == escapes->max) {
+    escapes->max = escapes->max * 2 + 16;
+    escapes->slots = (SlotAccess*) realloc(escapes->slots, escapes->max * sizeof(SlotAccess));
+  }
+  escapes->slots[escapes->count].kind = SA_NONE;
+  escapes->slots[escapes->count].known = TRUE;
+  escapes->slots[escapes->count].p = word->p;
+  escapes->slots[escapes->count].q = word->q;
+  escapes->count ++;
+}
+
+void popWords(AbstractStack* stack, int count, EscapeList* escapes) {
+  while ((count > 0) && (stack->depth > 0)) {
+    stack->depth --;
+    if (escapes != NULL)
+      escapeWord(escapes, stack->words + stack->depth);
+    count --;
+  }
+}
+
+void copyStack(AbstractStack* to, AbstractStack* from) {
+  to->reached = from->reached;
+  to->depth = 0;
+  while (to->depth < from->depth)
+    pushWord(to, from->words[to->depth].known, from->words[to->depth].p, from->words[to->depth].q);
+}
+
+// Merge the state reaching a block along another edge. The stacks are
+// aligned at the top; a word is known only if it is the same on both, and
+// an address that is forgotten this way escapes.
+int mergeStack(AbstractStack* into, AbstractStack* from, EscapeList* escapes) {
+  int changed = FALSE;
+  int depth, i;
+  AbstractWord* a;
+  AbstractWord* b;
+
+  if (!into->reached) {
+    copyStack(into, from);
+    return TRUE;
+  }
+
+  depth = (into->depth < from->depth) ? into->depth : from->depth;
+  for (i = 0; i < from->depth - depth; i ++)
+    escapeWord(escapes, from->words + i);
+  if (depth < into->depth) {
+    for (i = 0; i < into->depth - depth; i ++)
+      escapeWord(escapes, into->words + i);
+    memmove(into->words, into->words + into->depth - depth, depth * sizeof(AbstractWord));
+    into->depth = depth;
+    changed = TRUE;
+  }
+  for (i = 0; i < depth; i ++) {
+    a = into->words + i;
+    b = from->words + from->depth - depth + i;
+    if ((a->known || b->known) && (!a->known || !b->known || (a->p != b->p) || (a->q != b->q))) {
+      escapeWord(escapes, a);
+      escapeWord(escapes, b);
+      if (a->known) changed = TRUE;
+      a->known = FALSE;
+    }
+  }
+  return changed;
+}
+
+int callResultCount(CodeBlock* codeBlock, Instruction* call) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+
+  if ((call->q < 0) || (call->q >= codeBlock->codeSize) || (code[call->q].op != OP_J))
+    return -1;
+  for (i = code[call->q].q; (i >= 0) && (i < codeBlock->codeSize); i ++)
+    if (code[i].op == OP_EP) return 0;
+    else if (code[i].op == OP_EF) return 1;
+  return -1;
+}
+
+void setAccess(SlotAccess* access, enum SlotAccessKind kind, AbstractWord* address) {
+  access->kind = kind;
+  access->known = address->known;
+  access->p = address->p;
+  access->q = address->q;
+}
+
+// Number of words a vector instruction takes off the stack
+int vectorOperandCount(enum OpCode op) {
+  switch (op) {
+  case OP_VSM:
+  case OP_BM:
+    return 2;
+  case OP_VAD:
+  case OP_VSB:
+  case OP_VML:
+    return 4;
+  default:
+    return 3;
+  }
+}
+
+// Run one block over the state at its entry, leaving the state at its exit
+void transferBlock(ControlFlowGraph* cfg, int n, AbstractStack* stack, SlotAccess* accesses, EscapeList* escapes) {
+  BasicBlock* block = cfg->blocks + n;
+  Instruction* code = cfg->codeBlock->code;
+  AbstractWord word;
+  CodeAddress i;
+  int k, results;
+
+  for (i = block->start; i < block->end; i ++) {
+    Instruction* inst = code + i;
+    SlotAccess* access = accesses + (i - cfg->start);
+
+    access->kind = SA_NONE;
+    access->known = FALSE;
+    switch (inst->op) {
+    case OP_LA:
+      pushWord(stack, TRUE, inst->p, inst->q);
+      break;
+    case OP_LV:
+      word.known = TRUE;
+      word.p = inst->p;
+      word.q = inst->q;
+      setAccess(access, SA_READ, &word);
+      pushWord(stack, FALSE, 0, 0);
+      break;
+    case OP_LC:
+    case OP_RC:
+    case OP_RI:
+      pushWord(stack, FALSE, 0, 0);
+      break;
+    case OP_LI:
+      word = popWord(stack);
+      setAccess(access, SA_READ, &word);
+      pushWord(stack, FALSE, 0, 0);
+      break;
+    case OP_ST:
+      word = popWord(stack);
+      escapeWord(escapes, &word);
+      word = popWord(stack);
+      setAccess(access, SA_WRITE, &word);
+      break;
+    case OP_CV:
+      word = popWord(stack);
+      pushWord(stack, word.known, word.p, word.q);
+      pushWord(stack, word.known, word.p, word.q);
+      break;
+    case OP_INT:
+      for (k = 0; k < inst->q; k ++)
+	pushWord(stack, FALSE, 0, 0);
+      break;
+    case OP_DCT:
+      // Words dropped right before a call are the arguments
+      if ((i + 1 < block->end) && (code[i + 1].op == OP_CALL))
+	popWords(stack, inst->q, escapes);
+      else popWords(stack, inst->q, NULL);
+      break;
+    case OP_NEG:
+    case OP_LD:
+      word = popWord(stack);
+      escapeWord(escapes, &word);
+      pushWord(stack, FALSE, 0, 0);
+      break;
+    case OP_WRC:
+    case OP_WRI:
+    case OP_FJ:
+    case OP_JT:
+      word = popWord(stack);
+      escapeWord(escapes, &word);
+      break;
+    case OP_VAD:
+    case OP_VSB:
+    case OP_VML:
+    case OP_VFL:
+    case OP_VCP:
+    case OP_VSM:
+    case OP_VDT:
+    case OP_BM:
+      // They read and write through their addresses, which are not
+      // known as a single slot. stepLiveness takes the reads into account.
+      word.known = FALSE;
+      setAccess(access, SA_WRITE, &word);
+      popWords(stack, vectorOperandCount(inst->op), escapes);
+      if ((inst->op == OP_VSM) || (inst->op == OP_VDT))
+	pushWord(stack, FALSE, 0, 0);
+      break;
+    case OP_CALL:
+      results = callResultCount(cfg->codeBlock, inst);
+      if (results < 0)
+	popWords(stack, stack->depth, escapes);
+      for (k = 0; k < results; k ++)
+	pushWord(stack, FALSE, 0, 0);
+      break;
+    case OP_J:
+    case OP_WLN:
+    case OP_BC:
+    case OP_BP:
+    case OP_HL:
+    case OP_EP:
+    case OP_EF:
+      break;
+    default:
+      // Binary operators
+      word = popWord(stack);
+      escapeWord(escapes, &word);
+      word = popWord(stack);
+      escapeWord(escapes, &word);
+      pushWord(stack, FALSE, 0, 0);
+      break;
+    }
+  }
+}
+
+CodeAddress nestedCodeStart(CodeBlock* codeBlock, CodeAddress bodyStart) {
+  CodeAddress i;
+
+  // The block starts with the only jump to its body from outside the body
+  for (i = bodyStart - 1; i >= 0; i --)
+    if ((codeBlock->code[i].op == OP_J) && (codeBlock->code[i].q == bodyStart))
+      return i + 1;
+  return 0;
+}
+
+int findSlot(SlotAnalysis* analysis, WORD p, WORD q) {
+  int i;
+
+  for (i = 0; i < analysis->slotCount; i ++)
+    if ((analysis->slots[i].p == p) && (analysis->slots[i].q == q))
+      return i;
+  return -1;
+}
+
+int isPrivateSlot(SlotAnalysis* analysis, WORD p, WORD q) {
+  int slot = findSlot(analysis, p, q);
+  return (slot >= 0) && analysis->isPrivate[slot];
+}
+
+void addSlot(SlotAnalysis* analysis, SlotAccess* access) {
+  if (findSlot(analysis, access->p, access->q) >= 0) return;
+  analysis->slots[analysis->slotCount] = *access;
+  analysis->isPrivate[analysis->slotCount] = (access->p == 0);
+  analysis->slotCount ++;
+}
+
+// Follow the addresses on the stack through the graph
+void findAccesses(ControlFlowGraph* cfg, SlotAccess* accesses, EscapeList* escapes) {
+  AbstractStack* in;
+  AbstractStack out;
+  int* work;
+  char* queued;
+  int top = 0;
+  int n, i, succ[2];
+
+  in = (AbstractStack*) calloc(cfg->blockCount, sizeof(AbstractStack));
+  memset(&out, 0, sizeof(AbstractStack));
+  work = (int*) malloc(cfg->blockCount * sizeof(int));
+  queued = (char*) calloc(cfg->blockCount, 1);
+
+  in[0].reached = TRUE;
+  work[top++] = 0;
+  queued[0] = TRUE;
+  while (top > 0) {
+    n = work[--top];
+    queued[n] = FALSE;
+
+    copyStack(&out, in + n);
+    transferBlock(cfg, n, &out, accesses, escapes);
+
+    succ[0] = cfg->blocks[n].fallThrough;
+    succ[1] = cfg->blocks[n].jumpTarget;
+    for (i = 0; i < 2; i ++)
+      if ((succ[i] != NO_BLOCK) && mergeStack(in + succ[i], &out, escapes) && !queued[succ[i]]) {
+	queued[succ[i]] = TRUE;
+	work[top++] = succ[i];
+      }
+  }
+
+  for (n = 0; n < cfg->blockCount; n ++)
+    free(in[n].words);
+  free(in);
+  free(out.words);
+  free(work);
+  free(queued);
+}
+
+SlotAnalysis* analyseSlots(ControlFlowGraph* cfg) {
+  SlotAnalysis* analysis = (SlotAnalysis*) malloc(sizeof(SlotAnalysis));
+  Instruction* code = cfg->codeBlock->code;
+  int size = cfg->end - cfg->start;
+  EscapeList escapes;
+  CodeAddress i;
+  int slot;
+
+  analysis->cfg = cfg;
+  analysis->accesses = (SlotAccess*) calloc(size + 1, sizeof(SlotAccess));
+  escapes.slots = NULL;
+  escapes.count = 0;
+  escapes.max = 0;
+  findAccesses(cfg, analysis->accesses, &escapes);
+
+  analysis->slots = (SlotAccess*) malloc((size + escapes.count + 1) * sizeof(SlotAccess));
+  analysis->isPrivate = (char*) malloc(size + escapes.count + 1);
+  analysis->slotCount = 0;
+  for (i = 0; i < size; i ++)
+    if ((analysis->accesses[i].kind != SA_NONE) && analysis->accesses[i].known)
+      addSlot(analysis, analysis->accesses + i);
+  for (i = 0; i < escapes.count; i ++) {
+    addSlot(analysis, escapes.slots + i);
+    analysis->isPrivate[findSlot(analysis, escapes.slots[i].p, escapes.slots[i].q)] = FALSE;
+  }
+
+  // The nested procedures reach this frame with a level of 1 or more
+  for (i = nestedCodeStart(cfg->codeBlock, cfg->start); i < cfg->start; i ++)
+    if (((code[i].op == OP_LA) || (code[i].op == OP_LV)) && (code[i].p > 0)) {
+      slot = findSlot(analysis, 0, code[i].q);
+      if (slot >= 0) analysis->isPrivate[slot] = FALSE;
+    }
+
+  free(escapes.slots);
+  return analysis;
+}
+
+void freeSlotAnalysis(SlotAnalysis* analysis) {
+  free(analysis->accesses);
+  free(analysis->slots);
+  free(analysis->isPrivate);
+  free(analysis);
+}
+
+/******************* Liveness ******************************/
+
+// The slots still needed when the body ends with the given instruction:
+// those of outer frames, and the result of a function, at offset 0
+void setExitLiveness(SlotAnalysis* analysis, enum OpCode op, char* live) {
+  int i;
+
+  for (i = 0; i < analysis->slotCount; i ++)
+    switch (op) {
+    case OP_EP:
+      live[i] = (analysis->slots[i].p != 0);
+      break;
+    case OP_EF:
+      live[i] = (analysis->slots[i].p != 0) || (analysis->slots[i].q == 0);
+      break;
+    default:
+      live[i] = FALSE;
+      break;
+    }
+}
+
+// A call or a load through an unknown address may read any slot that is
+// not private
+void makeSharedSlotsLive(SlotAnalysis* analysis, char* live) {
+  int i;
+
+  for (i = 0; i < analysis->slotCount; i ++)
+    if (!analysis->isPrivate[i]) live[i] = TRUE;
+}
+
+// A call reads the slots its summary names, seen from the caller, and
+// any slot that is not private if the summary is not known or reads
+// through addresses
+void makeCallReadsLive(SlotAnalysis* analysis, Instruction* call, char* live) {
+  Summary* summary = findCallSummary(call);
+  Effect* effect;
+  int i, slot;
+
+  if ((summary == NULL) || summary->effects.readsAny) {
+    makeSharedSlotsLive(analysis, live);
+    return;
+  }
+  for (i = 0; i < summary->effects.count; i ++) {
+    effect = summary->effects.effects + i;
+    if (effect->kind != EFFECT_READ) continue;
+    if (effect->indirect || effect->indexed) {
+      makeSharedSlotsLive(analysis, live);
+      return;
+    }
+    slot = findSlot(analysis, call->p + effect->p - 1, effect->q);
+    if (slot >= 0) live[slot] = TRUE;
+  }
+}
+
+int stepLiveness(SlotAnalysis* analysis, CodeAddress i, char* live) {
+  ControlFlowGraph* cfg = analysis->cfg;
+  SlotAccess* access = analysis->accesses + (i - cfg->start);
+  int slot;
+
+  if (cfg->codeBlock->code[i].op == OP_CALL) {
+    makeCallReadsLive(analysis, cfg->codeBlock->code + i, live);
+    return FALSE;
+  }
+  switch (access->kind) {
+  case SA_READ:
+    if (access->known)
+      live[findSlot(analysis, access->p, access->q)] = TRUE;
+    else makeSharedSlotsLive(analysis, live);
+    return FALSE;
+  case SA_WRITE:
+    if (!access->known) {
+      // The vector instructions read through addresses as well
+      if (isVectorInstruction(cfg->codeBlock->code[i].op))
+	makeSharedSlotsLive(analysis, live);
+      return FALSE;
+    }
+    slot = findSlot(analysis, access->p, access->q);
+    if (!live[slot]) return TRUE;
+    live[slot] = FALSE;
+    return FALSE;
+  default:
+    return FALSE;
+  }
+}
+
+void computeLiveOut(SlotAnalysis* analysis, char* liveIn, int n, char* live) {
+  ControlFlowGraph* cfg = analysis->cfg;
+  BasicBlock* block = cfg->blocks + n;
+  int count = analysis->slotCount;
+  int i;
+
+  if ((block->fallThrough == NO_BLOCK) && (block->jumpTarget == NO_BLOCK)) {
+    setExitLiveness(analysis, lastInstruction(cfg, n)->op, live);
+    return;
+  }
+  memset(live, FALSE, count);
+  for (i = 0; i < count; i ++) {
+    if (block->fallThrough != NO_BLOCK)
+      live[i] = live[i] || liveIn[block->fallThrough * count + i];
+    if (block->jumpTarget != NO_BLOCK)
+      live[i] = live[i] || liveIn[block->jumpTarget * count + i];
+  }
+}
+
+char* computeLiveness(SlotAnalysis* analysis) {
+  ControlFlowGraph* cfg = analysis->cfg;
+  int count = analysis->slotCount;
+  char* liveIn = (char*) calloc(cfg->blockCount * count + 1, 1);
+  char* live = (char*) malloc(count + 1);
+  int changed, n;
+  CodeAddress i;
+
+  do {
+    changed = FALSE;
+    for (n = cfg->blockCount - 1; n >= 0; n --) {
+      if (!cfg->blocks[n].reachable) continue;
+      computeLiveOut(analysis, liveIn, n, live);
+      for (i = cfg->blocks[n].end - 1; i >= cfg->blocks[n].start; i --)
+	stepLiveness(analysis, i, live);
+      if (memcmp(live, liveIn + n * count, count) != 0) {
+	memcpy(liveIn + n * count, live, count);
+	changed = TRUE;
+      }
+    }
+  } while (changed);
+
+  free(live);
+  return liveIn;
+}
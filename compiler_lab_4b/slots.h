@@ -0,0 +1,61 @@
+#ifndef __SLOTS_H__
+#define __SLOTS_H__
+
+#include "cfg.h"
+
+enum SlotAccessKind {
+  SA_NONE,
+  SA_READ,
+  SA_WRITE
+};
+
+struct SlotAccess_ {
+  enum SlotAccessKind kind;
+  int known;              // the slot is known at compile time
+  WORD p, q;              // level and offset of the slot, as in LA p,q
+};
+
+typedef struct SlotAccess_ SlotAccess;
+
+struct SlotAnalysis_ {
+  ControlFlowGraph* cfg;
+  SlotAccess* accesses;   // for each instruction, indexed by address - cfg->start
+  SlotAccess* slots;      // the distinct slots known to be accessed
+  char* isPrivate;        // for each slot: no call and no unknown address can reach it
+  int slotCount;
+};
+
+typedef struct SlotAnalysis_ SlotAnalysis;
+
+// Find the frame slot read or written by each instruction of the graph.
+// LV reads a known slot; LI reads and ST writes through the address on the
+// stack, which is known when it was pushed by LA, possibly copied by CV, in
+// any block on the way.
+//
+// A slot of the current frame is private when its address is never used
+// in other ways, for instance passed to a reference parameter, and no
+// nested procedure refers to its offset.
+SlotAnalysis* analyseSlots(ControlFlowGraph* cfg);
+void freeSlotAnalysis(SlotAnalysis* analysis);
+
+// Index of a slot in the analysis, -1 if it is never accessed
+int findSlot(SlotAnalysis* analysis, WORD p, WORD q);
+int isPrivateSlot(SlotAnalysis* analysis, WORD p, WORD q);
+
+// Backward liveness of the slots. liveIn[n * slotCount + s] tells whether
+// slot s is live when block n starts.
+char* computeLiveness(SlotAnalysis* analysis);
+void computeLiveOut(SlotAnalysis* analysis, char* liveIn, int n, char* live);
+// Step backward over the instruction at address i. Returns TRUE for a
+// store to a dead slot.
+int stepLiveness(SlotAnalysis* analysis, CodeAddress i, char* live);
+
+// Number of words left on the stack by a call: 1 for a function, 0 for a
+// procedure, -1 if the callee cannot be found
+int callResultCount(CodeBlock* codeBlock, Instruction* call);
+
+// Start of the code of the procedures nested in the block whose body
+// starts at the given address
+CodeAddress nestedCodeStart(CodeBlock* codeBlock, CodeAddress bodyStart);
+
+#endif
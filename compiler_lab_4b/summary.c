@@ -0,0 +1,560 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "summary.h"
+#include "cfg.h"
+#include "slots.h"
+
+// Mod/ref summaries. The code of each block is followed once, as for the
+// slot analysis, to find the words of enclosing frames it reads and
+// writes, the words it reaches through its reference parameters, its
+// input and output, and the calls it makes with what they pass. The
+// effects of the calls are then added over the call graph until nothing
+// changes.
+//
+// A callee sees the frames of its caller shifted: the frame at level
+// k >= 1 of a callee called with CALL p is the frame at level p + k - 1
+// of the caller. What a callee reaches through a reference parameter is
+// what the caller passed for it. Words of the frame of the caller itself
+// do not outlive it and are left out of its summary.
+//
+// Blocks are compiled before their callers, except for the enclosing
+// blocks a block calls. Such calls are followed once the enclosing block
+// has been compiled; until then they may do anything.
+
+#define CALL_FRAME_WORDS 4        // return value, dynamic link, return address, static link
+
+struct PointerStack_ {
+  int reached;
+  int depth, max;
+  Pointer* words;
+};
+
+typedef struct PointerStack_ PointerStack;
+
+void pushPointer(PointerStack* stack, enum PointerKind kind, WORD p, WORD q) {
+  if (stack->depth == stack->max) {
+    stack->max = stack->max * 2 + 16;
+    stack->words = (Pointer*) realloc(stack->words, stack->max * sizeof(Pointer));
+  }
+  stack->words[stack->depth].kind = kind;
+  stack->words[stack->depth].p = p;
+  stack->words[stack->depth].q = q;
+  stack->words[stack->depth].indexed = FALSE;
+  stack->depth ++;
+}
+
+void pushCopy(PointerStack* stack, Pointer* word) {
+  pushPointer(stack, word->kind, word->p, word->q);
+  stack->words[stack->depth - 1].indexed = word->indexed;
+}
+
+// Words pushed before the body are not known
+Pointer popPointer(PointerStack* stack) {
+  Pointer word;
+
+  if (stack->depth > 0)
+    return stack->words[-- stack->depth];
+  word.kind = PTR_NONE;
+  word.p = 0;
+  word.q = 0;
+  word.indexed = FALSE;
+  return word;
+}
+
+void copyPointerStack(PointerStack* to, PointerStack* from) {
+  to->reached = from->reached;
+  to->depth = 0;
+  while (to->depth < from->depth)
+    pushCopy(to, from->words + to->depth);
+}
+
+// The stacks are aligned at the top; a word is kept only if it points
+// into the same variable on both
+int mergePointerStack(PointerStack* into, PointerStack* from) {
+  int changed = FALSE;
+  int depth, i;
+  Pointer* a;
+  Pointer* b;
+
+  if (!into->reached) {
+    copyPointerStack(into, from);
+    return TRUE;
+  }
+
+  depth = (into->depth < from->depth) ? into->depth : from->depth;
+  if (depth < into->depth) {
+    memmove(into->words, into->words + into->depth - depth, depth * sizeof(Pointer));
+    into->depth = depth;
+    changed = TRUE;
+  }
+  for (i = 0; i < depth; i ++) {
+    a = into->words + i;
+    b = from->words + from->depth - depth + i;
+    if ((a->kind != PTR_NONE) && ((a->kind != b->kind) || (a->p != b->p) || (a->q != b->q))) {
+      a->kind = PTR_NONE;
+      changed = TRUE;
+    } else if ((a->kind != PTR_NONE) && !a->indexed && b->indexed) {
+      a->indexed = TRUE;
+      changed = TRUE;
+    }
+  }
+  return changed;
+}
+
+/******************* Side effects ******************************/
+
+void clearSideEffects(SideEffects* effects) {
+  effects->count = 0;
+  effects->readsAny = FALSE;
+  effects->writesAny = FALSE;
+  effects->input = FALSE;
+  effects->output = FALSE;
+}
+
+// Returns TRUE if the effect is new
+int addEffect(SideEffects* effects, enum EffectKind kind, int indirect, int indexed, WORD p, WORD q) {
+  int i;
+
+  for (i = 0; i < effects->count; i ++)
+    if ((effects->effects[i].kind == kind) && (effects->effects[i].indirect == indirect) &&
+	(effects->effects[i].indexed == indexed) && (effects->effects[i].p == p) && (effects->effects[i].q == q))
+      return FALSE;
+  if (effects->count == effects->max) {
+    effects->max = effects->max * 2 + 8;
+    effects->effects = (Effect*) realloc(effects->effects, effects->max * sizeof(Effect));
+  }
+  effects->effects[effects->count].kind = kind;
+  effects->effects[effects->count].indirect = indirect;
+  effects->effects[effects->count].indexed = indexed;
+  effects->effects[effects->count].p = p;
+  effects->effects[effects->count].q = q;
+  effects->count ++;
+  return TRUE;
+}
+
+int setFlag(int* flag) {
+  if (*flag) return FALSE;
+  *flag = TRUE;
+  return TRUE;
+}
+
+int addAnyAccess(SideEffects* effects, enum EffectKind kind) {
+  return setFlag((kind == EFFECT_READ) ? &effects->readsAny : &effects->writesAny);
+}
+
+int addEverything(SideEffects* effects) {
+  int changed = FALSE;
+
+  changed |= setFlag(&effects->readsAny);
+  changed |= setFlag(&effects->writesAny);
+  changed |= setFlag(&effects->input);
+  changed |= setFlag(&effects->output);
+  return changed;
+}
+
+// Add an access made in the block of the summary, seen from its callers
+int addAccess(Summary* summary, SideEffects* effects, enum EffectKind kind, int indirect, int indexed, WORD p, WORD q) {
+  if (p > 0)
+    return addEffect(effects, kind, indirect, indexed, p, q);
+  if (!indirect)
+    return FALSE;
+  // Only the parameters hold the addresses of words outside the frame
+  if ((q >= CALL_FRAME_WORDS) && (q < CALL_FRAME_WORDS + summary->paramCount))
+    return addEffect(effects, kind, TRUE, indexed, 0, q);
+  return addAnyAccess(effects, kind);
+}
+
+int addPointerAccess(Summary* summary, SideEffects* effects, enum EffectKind kind, Pointer* address) {
+  switch (address->kind) {
+  case PTR_ADDRESS:
+    return addAccess(summary, effects, kind, FALSE, address->indexed, address->p, address->q);
+  case PTR_CONTENT:
+    return addAccess(summary, effects, kind, TRUE, address->indexed, address->p, address->q);
+  default:
+    return addAnyAccess(effects, kind);
+  }
+}
+
+// A vector instruction reaches the words of an array from the address
+int addVectorAccess(Summary* summary, SideEffects* effects, enum EffectKind kind, Pointer* address) {
+  Pointer element = *address;
+
+  element.indexed = TRUE;
+  return addPointerAccess(summary, effects, kind, &element);
+}
+
+/******************* Local effects ******************************/
+
+void addCallFact(Summary* summary, Instruction* call, PointerStack* stack, int argCount) {
+  CallFact* fact;
+  int k;
+
+  if (summary->callCount == summary->maxCalls) {
+    summary->maxCalls = summary->maxCalls * 2 + 4;
+    summary->calls = (CallFact*) realloc(summary->calls, summary->maxCalls * sizeof(CallFact));
+  }
+  fact = summary->calls + (summary->callCount++);
+  fact->callee = call->q;
+  fact->level = call->p;
+  fact->argCount = argCount;
+  fact->args = (Pointer*) malloc((argCount + 1) * sizeof(Pointer));
+  for (k = 0; k < argCount; k ++)
+    if (stack->depth - argCount + k >= 0)
+      fact->args[k] = stack->words[stack->depth - argCount + k];
+    else {
+      fact->args[k].kind = PTR_NONE;
+      fact->args[k].indexed = FALSE;
+    }
+}
+
+// Run one block of the graph. The accesses and the calls are recorded
+// only when summary is not NULL, once the stacks are known.
+void transferPointers(ControlFlowGraph* cfg, int n, PointerStack* stack, Summary* summary) {
+  BasicBlock* block = cfg->blocks + n;
+  Instruction* code = cfg->codeBlock->code;
+  SideEffects* local = (summary != NULL) ? &summary->local : NULL;
+  CompiledBlock* callee;
+  Pointer a, b, d;
+  CodeAddress i;
+  int k, results;
+
+  for (i = block->start; i < block->end; i ++) {
+    Instruction* inst = code + i;
+
+    switch (inst->op) {
+    case OP_LA:
+      pushPointer(stack, PTR_ADDRESS, inst->p, inst->q);
+      break;
+    case OP_LV:
+      if (local != NULL)
+	addAccess(summary, local, EFFECT_READ, FALSE, FALSE, inst->p, inst->q);
+      pushPointer(stack, PTR_CONTENT, inst->p, inst->q);
+      break;
+    case OP_LC:
+      pushPointer(stack, PTR_NONE, 0, 0);
+      break;
+    case OP_RC:
+    case OP_RI:
+      if (local != NULL) local->input = TRUE;
+      pushPointer(stack, PTR_NONE, 0, 0);
+      break;
+    case OP_LI:
+      a = popPointer(stack);
+      if (local != NULL)
+	addPointerAccess(summary, local, EFFECT_READ, &a);
+      pushPointer(stack, PTR_NONE, 0, 0);
+      break;
+    case OP_ST:
+      popPointer(stack);
+      a = popPointer(stack);
+      if (local != NULL)
+	addPointerAccess(summary, local, EFFECT_WRITE, &a);
+      break;
+    case OP_CV:
+      a = popPointer(stack);
+      pushCopy(stack, &a);
+      pushCopy(stack, &a);
+      break;
+    case OP_AD:
+    case OP_SB:
+      // An address plus an index stays within the same variable. Of an
+      // address and the content of a word, the address is the base.
+      b = popPointer(stack);
+      a = popPointer(stack);
+      if ((inst->op == OP_AD) && (b.kind > a.kind))
+	pushCopy(stack, &b);
+      else if (a.kind > b.kind)
+	pushCopy(stack, &a);
+      else pushPointer(stack, PTR_NONE, 0, 0);
+      stack->words[stack->depth - 1].indexed = TRUE;
+      break;
+    case OP_ML:
+    case OP_DV:
+    case OP_MOD:
+    case OP_EQ:
+    case OP_NE:
+    case OP_GT:
+    case OP_LT:
+    case OP_GE:
+    case OP_LE:
+    case OP_SHL:
+    case OP_SHR:
+    case OP_SRZ:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+      popPointer(stack);
+      popPointer(stack);
+      pushPointer(stack, PTR_NONE, 0, 0);
+      break;
+    case OP_NEG:
+    case OP_LD:
+      // LD reads the data segment, which no code writes
+      popPointer(stack);
+      pushPointer(stack, PTR_NONE, 0, 0);
+      break;
+    case OP_VAD:
+    case OP_VSB:
+    case OP_VML:
+      popPointer(stack);
+      b = popPointer(stack);
+      a = popPointer(stack);
+      d = popPointer(stack);
+      if (local != NULL) {
+	addVectorAccess(summary, local, EFFECT_READ, &a);
+	addVectorAccess(summary, local, EFFECT_READ, &b);
+	addVectorAccess(summary, local, EFFECT_WRITE, &d);
+      }
+      break;
+    case OP_BM:
+      a = popPointer(stack);
+      d = popPointer(stack);
+      if (local != NULL) {
+	addVectorAccess(summary, local, EFFECT_READ, &a);
+	addVectorAccess(summary, local, EFFECT_WRITE, &d);
+      }
+      break;
+    case OP_VFL:
+    case OP_VCP:
+      popPointer(stack);
+      a = popPointer(stack);
+      d = popPointer(stack);
+      if (local != NULL) {
+	if (inst->op == OP_VCP)
+	  addVectorAccess(summary, local, EFFECT_READ, &a);
+	addVectorAccess(summary, local, EFFECT_WRITE, &d);
+      }
+      break;
+    case OP_VSM:
+    case OP_VDT:
+      popPointer(stack);
+      if (inst->op == OP_VDT) {
+	b = popPointer(stack);
+	if (local != NULL)
+	  addVectorAccess(summary, local, EFFECT_READ, &b);
+      }
+      a = popPointer(stack);
+      if (local != NULL)
+	addVectorAccess(summary, local, EFFECT_READ, &a);
+      pushPointer(stack, PTR_NONE, 0, 0);
+      break;
+    case OP_WRC:
+    case OP_WRI:
+      if (local != NULL) local->output = TRUE;
+      popPointer(stack);
+      break;
+    case OP_WLN:
+      if (local != NULL) local->output = TRUE;
+      break;
+    case OP_FJ:
+    case OP_JT:
+      popPointer(stack);
+      break;
+    case OP_INT:
+      for (k = 0; k < inst->q; k ++)
+	pushPointer(stack, PTR_NONE, 0, 0);
+      break;
+    case OP_DCT:
+      // The words dropped right before a call are its frame and arguments
+      if ((summary != NULL) && (i + 1 < block->end) && (code[i + 1].op == OP_CALL) &&
+	  (inst->q >= CALL_FRAME_WORDS))
+	addCallFact(summary, code + i + 1, stack, inst->q - CALL_FRAME_WORDS);
+      for (k = 0; k < inst->q; k ++)
+	popPointer(stack);
+      break;
+    case OP_CALL:
+      // The body of an enclosing block is not there yet
+      callee = findCompiledBlock(inst->q);
+      results = ((callee != NULL) && (callee->end != 0)) ? callResultCount(cfg->codeBlock, inst) : -1;
+      if (results < 0) {
+	if (local != NULL) addEverything(local);
+	stack->depth = 0;
+	break;
+      }
+      for (k = 0; k < results; k ++)
+	pushPointer(stack, PTR_NONE, 0, 0);
+      break;
+    case OP_J:
+    case OP_BC:
+    case OP_BP:
+    case OP_HL:
+    case OP_EP:
+    case OP_EF:
+      break;
+    default:
+      // Code that is not understood may do anything
+      if (local != NULL) addEverything(local);
+      stack->depth = 0;
+      break;
+    }
+  }
+}
+
+void collectLocalEffects(CodeBlock* codeBlock, CompiledBlock* block, Summary* summary) {
+  ControlFlowGraph* cfg = buildCFG(codeBlock, block->bodyStart, block->end);
+  PointerStack* in;
+  PointerStack out;
+  int* work;
+  char* queued;
+  int top = 0;
+  int n, i, succ[2];
+
+  if (cfg == NULL) {
+    addEverything(&summary->local);
+    return;
+  }
+
+  in = (PointerStack*) calloc(cfg->blockCount, sizeof(PointerStack));
+  memset(&out, 0, sizeof(PointerStack));
+  work = (int*) malloc(cfg->blockCount * sizeof(int));
+  queued = (char*) calloc(cfg->blockCount, 1);
+
+  in[0].reached = TRUE;
+  work[top++] = 0;
+  queued[0] = TRUE;
+  while (top > 0) {
+    n = work[--top];
+    queued[n] = FALSE;
+
+    copyPointerStack(&out, in + n);
+    transferPointers(cfg, n, &out, NULL);
+
+    succ[0] = cfg->blocks[n].fallThrough;
+    succ[1] = cfg->blocks[n].jumpTarget;
+    for (i = 0; i < 2; i ++)
+      if ((succ[i] != NO_BLOCK) && mergePointerStack(in + succ[i], &out) && !queued[succ[i]]) {
+	queued[succ[i]] = TRUE;
+	work[top++] = succ[i];
+      }
+  }
+
+  // Once more with the stacks known, recording what is done
+  for (n = 0; n < cfg->blockCount; n ++)
+    if (in[n].reached) {
+      copyPointerStack(&out, in + n);
+      transferPointers(cfg, n, &out, summary);
+    }
+
+  for (n = 0; n < cfg->blockCount; n ++)
+    free(in[n].words);
+  free(in);
+  free(out.words);
+  free(work);
+  free(queued);
+  freeCFG(cfg);
+}
+
+/******************* Call graph ******************************/
+
+// Add the effects of a call made by the block of the summary
+int addCallEffects(Summary* summary, CallFact* fact, Summary* callee) {
+  SideEffects* effects = &summary->effects;
+  Effect* effect;
+  Pointer* arg;
+  int changed = FALSE;
+  int i, k;
+
+  if (callee->effects.readsAny) changed |= setFlag(&effects->readsAny);
+  if (callee->effects.writesAny) changed |= setFlag(&effects->writesAny);
+  if (callee->effects.input) changed |= setFlag(&effects->input);
+  if (callee->effects.output) changed |= setFlag(&effects->output);
+
+  for (i = 0; i < callee->effects.count; i ++) {
+    effect = callee->effects.effects + i;
+    if (effect->p > 0) {
+      changed |= addAccess(summary, effects, effect->kind, effect->indirect, effect->indexed,
+			   fact->level + effect->p - 1, effect->q);
+      continue;
+    }
+
+    // Through a reference parameter: to what the caller passed
+    k = effect->q - CALL_FRAME_WORDS;
+    arg = (k < fact->argCount) ? fact->args + k : NULL;
+    if ((arg != NULL) && (arg->kind == PTR_ADDRESS))
+      changed |= addAccess(summary, effects, effect->kind, FALSE, effect->indexed || arg->indexed, arg->p, arg->q);
+    else if ((arg != NULL) && (arg->kind == PTR_CONTENT))
+      changed |= addAccess(summary, effects, effect->kind, TRUE, effect->indexed || arg->indexed, arg->p, arg->q);
+    else changed |= addAnyAccess(effects, effect->kind);
+  }
+  return changed;
+}
+
+// Tell whether a block is nested, at any depth, in another one
+int isNestedBlock(CompiledBlock* block, CompiledBlock* outer) {
+  return (block->blockAddress > outer->blockAddress) && (block->blockAddress < outer->bodyStart);
+}
+
+void copySideEffects(SideEffects* to, SideEffects* from) {
+  int i;
+
+  clearSideEffects(to);
+  for (i = 0; i < from->count; i ++)
+    addEffect(to, from->effects[i].kind, from->effects[i].indirect, from->effects[i].indexed,
+	      from->effects[i].p, from->effects[i].q);
+  to->readsAny = from->readsAny;
+  to->writesAny = from->writesAny;
+  to->input = from->input;
+  to->output = from->output;
+}
+
+// Solve the summaries of a block and of the blocks nested in it, whose
+// calls all go to blocks already compiled, except for the enclosing ones
+void solveSummaries(CompiledBlock* block) {
+  CompiledBlock* member;
+  CompiledBlock* callee;
+  Summary* summary;
+  CallFact* fact;
+  int changed, k, i;
+
+  for (k = 0; (member = compiledBlockAt(k)) != NULL; k ++)
+    if (((member == block) || isNestedBlock(member, block)) && (member->summary != NULL))
+      copySideEffects(&member->summary->effects, &member->summary->local);
+
+  do {
+    changed = FALSE;
+    for (k = 0; (member = compiledBlockAt(k)) != NULL; k ++) {
+      if (((member != block) && !isNestedBlock(member, block)) || (member->summary == NULL))
+	continue;
+      summary = member->summary;
+      for (i = 0; i < summary->callCount; i ++) {
+	fact = summary->calls + i;
+	callee = findCompiledBlock(fact->callee);
+	if ((callee == NULL) || (callee->end == 0) || (callee->summary == NULL))
+	  changed |= addEverything(&summary->effects);
+	else changed |= addCallEffects(summary, fact, callee->summary);
+      }
+    }
+  } while (changed);
+}
+
+void summarizeBlock(CodeBlock* codeBlock, CompiledBlock* block) {
+  Summary* summary = (Summary*) calloc(1, sizeof(Summary));
+
+  summary->paramCount = (block->paramCount > 0) ? block->paramCount : 0;
+  summary->isFunction = (codeBlock->code[block->end - 1].op == OP_EF);
+  collectLocalEffects(codeBlock, block, summary);
+  block->summary = summary;
+  solveSummaries(block);
+}
+
+Summary* findCallSummary(Instruction* call) {
+  CompiledBlock* callee;
+
+  if (call->op != OP_CALL) return NULL;
+  callee = findCompiledBlock(call->q);
+  if ((callee == NULL) || (callee->end == 0)) return NULL;
+  return callee->summary;
+}
+
+int isPure(Summary* summary) {
+  SideEffects* effects = &summary->effects;
+
+  return (effects->count == 0) && !effects->readsAny && !effects->writesAny &&
+    !effects->input && !effects->output;
+}
+
+int isPureCall(Instruction* call) {
+  Summary* summary = findCallSummary(call);
+  return (summary != NULL) && isPure(summary);
+}
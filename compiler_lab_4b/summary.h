@@ -0,0 +1,82 @@
+#ifndef __SUMMARY_H__
+#define __SUMMARY_H__
+
+#include "optimizer.h"
+
+enum EffectKind {
+  EFFECT_READ,
+  EFFECT_WRITE
+};
+
+// A word a block reads or writes outside of its own frame: the word
+// (p,q) of an enclosing frame, as in LA p,q with p >= 1, or the word
+// whose address is held in (p,q), such as the variable passed to a
+// reference parameter (p = 0)
+struct Effect_ {
+  enum EffectKind kind;
+  int indirect;           // through the address held in (p,q)
+  int indexed;            // any element of the array starting there
+  WORD p, q;
+};
+
+typedef struct Effect_ Effect;
+
+struct SideEffects_ {
+  Effect* effects;
+  int count, max;
+  int readsAny;           // through an address that is not known
+  int writesAny;
+  int input;
+  int output;
+};
+
+typedef struct SideEffects_ SideEffects;
+
+// What a word on the stack is known to hold, the likeliest address last
+enum PointerKind {
+  PTR_NONE,
+  PTR_CONTENT,            // the content of (p,q)
+  PTR_ADDRESS             // the address of (p,q), or of an element of the array there
+};
+
+struct Pointer_ {
+  enum PointerKind kind;
+  WORD p, q;
+  int indexed;            // plus an index
+};
+
+typedef struct Pointer_ Pointer;
+
+// A call made by the code of a block, with what it passes as arguments
+struct CallFact_ {
+  CodeAddress callee;
+  WORD level;
+  int argCount;
+  Pointer* args;
+};
+
+typedef struct CallFact_ CallFact;
+
+struct Summary_ {
+  int paramCount;
+  int isFunction;
+  SideEffects local;      // of the code of the block itself
+  CallFact* calls;
+  int callCount, maxCalls;
+  SideEffects effects;    // including the calls, as seen from a caller
+};
+
+typedef struct Summary_ Summary;
+
+// Summarize a block that has just been compiled. The summaries of the
+// blocks nested in it are brought up to date as well, now that their
+// calls to it can be followed.
+void summarizeBlock(CodeBlock* codeBlock, CompiledBlock* block);
+
+// Summary of the callee of a CALL, NULL if it is not known yet
+Summary* findCallSummary(Instruction* call);
+// No reads nor writes outside of its frame, no input nor output
+int isPure(Summary* summary);
+int isPureCall(Instruction* call);
+
+#endif
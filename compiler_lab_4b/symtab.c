@@ -75,7 +75,7 @@ void freeType(Type* type) {
     break;
   case TP_ARRAY:
     freeType(type->elementType);
-    freeType(type);
+    free(type);
     break;
   }
 }
@@ -94,7 +94,7 @@ int sizeOfType(Type* type) {
 
 /******************* Constant utility ******************************/
 
-ConstantValue* makeIntConstant(int i) {
+ConstantValue* makeIntConstant(WORD i) {
   ConstantValue* value = (ConstantValue*) malloc(sizeof(ConstantValue));
   value->type = TP_INT;
   value->intValue = i;
@@ -108,12 +108,23 @@ ConstantValue* makeCharConstant(char ch) {
   return value;
 }
 
+ConstantValue* makeArrayConstant(Type* arrayType, int dataAddress) {
+  ConstantValue* value = (ConstantValue*) malloc(sizeof(ConstantValue));
+  value->type = TP_ARRAY;
+  value->dataAddress = dataAddress;
+  value->arrayType = arrayType;
+  return value;
+}
+
 ConstantValue* duplicateConstantValue(ConstantValue* v) {
   ConstantValue* value = (ConstantValue*) malloc(sizeof(ConstantValue));
   value->type = v->type;
   if (v->type == TP_INT) 
     value->intValue = v->intValue;
-  else
+  else if (v->type == TP_ARRAY) {
+    value->dataAddress = v->dataAddress;
+    value->arrayType = duplicateType(v->arrayType);
+  } else
     value->charValue = v->charValue;
   return value;
 }
@@ -208,6 +219,8 @@ Object* createParameterObject(char *name, enum ParamKind kind) {
 void freeObject(Object* obj) {
   switch (obj->kind) {
   case OBJ_CONSTANT:
+    if (obj->constAttrs->value->type == TP_ARRAY)
+      freeType(obj->constAttrs->value->arrayType);
     free(obj->constAttrs->value);
     free(obj->constAttrs);
     break;
@@ -44,8 +44,13 @@ typedef struct Type_ BasicType;
 struct ConstantValue_ {
   enum TypeClass type;
   union {
-    int intValue;
+    WORD intValue;
     char charValue;
+    struct {
+      // The elements of an array are kept in the data segment
+      int dataAddress;
+      Type* arrayType;
+    };
   };
 };
 
@@ -156,8 +161,9 @@ int compareType(Type* type1, Type* type2);
 void freeType(Type* type);
 int sizeOfType(Type* type);
 
-ConstantValue* makeIntConstant(int i);
+ConstantValue* makeIntConstant(WORD i);
 ConstantValue* makeCharConstant(char ch);
+ConstantValue* makeArrayConstant(Type* arrayType, int dataAddress);
 ConstantValue* duplicateConstantValue(ConstantValue* v);
 
 Scope* createScope(Object* owner);
@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "slots.h"
+
+// Tail calls. A call after which the block returns at once,
+//
+//    INT 4; arguments; DCT 4+n; CALL p,callee; EP
+//    LA 0,0; INT 4; arguments; DCT 4+n; CALL p,callee; ST; EF
+//
+// needs nothing more from the frame, which is handed over to the callee.
+// The DCT and the CALL become
+//
+//    TC p,n; J body
+//
+// TC moves the arguments down to the parameter slots, puts the static
+// link of the callee in the frame and cuts the stack back to the frame
+// base, so that the body of the callee runs in the frame. It then returns
+// to the caller of the current block, and a function leaves its result in
+// the slot of the current one. Recursion in tail position so runs in
+// constant stack.
+//
+// A callee nested in the current block (p = 0) needs the frame as its
+// static link, and a call passing the address of a local variable needs
+// the variable: both are called as usual.
+
+#define TAIL_JUMP_LIMIT 16        // jumps followed to reach the exit
+#define CALL_FRAME_WORDS 4        // return value, dynamic link, return address, static link
+
+// Tell whether control goes from address to an exit of the given kind
+// without doing anything else
+int leadsToExit(CodeBlock* codeBlock, CodeAddress address, enum OpCode exit) {
+  Instruction* code = codeBlock->code;
+  int hops;
+
+  for (hops = 0; hops < TAIL_JUMP_LIMIT; hops ++) {
+    if ((address < 0) || (address >= codeBlock->codeSize)) return FALSE;
+    if (code[address].op != OP_J)
+      return code[address].op == exit;
+    address = code[address].q;
+  }
+  return FALSE;
+}
+
+// Tell whether the result of the function call at address call is stored
+// by the ST that follows to the result slot, pushed by LA 0,0 right before
+// the frame of the call
+int storesResult(CodeBlock* codeBlock, CodeAddress start, int* depth, CodeAddress call) {
+  Instruction* code = codeBlock->code;
+  int below = depth[call + 2 - start];
+  CodeAddress i, k;
+
+  if (below < 0) return FALSE;
+  for (i = call - 1; (i > start) && (depth[i - start] > below); i --);
+  if ((i <= start) || (depth[i - start] != below)) return FALSE;
+  if ((code[i].op != OP_LA) || (code[i].p != 0) || (code[i].q != 0)) return FALSE;
+  if ((code[i + 1].op != OP_INT) || (code[i + 1].q != CALL_FRAME_WORDS)) return FALSE;
+  // The frame of the call stays on top of the result address
+  for (k = i + 2; k < call; k ++)
+    if (depth[k - start] <= below + CALL_FRAME_WORDS) return FALSE;
+  return TRUE;
+}
+
+// Tell whether an argument of the call at address call holds an address
+// in the frame, such as a local array passed to a reference parameter,
+// which the callee would overwrite
+int passesFrameAddress(CodeBlock* codeBlock, CodeAddress start, int* depth, CodeAddress call) {
+  Instruction* code = codeBlock->code;
+  int below = depth[call - 1 - start] - code[call - 1].q;
+  CodeAddress i;
+
+  if (depth[call - 1 - start] < 0) return TRUE;
+  for (i = call - 2; (i > start) && (depth[i - start] > below); i --)
+    if ((code[i].op == OP_LA) && (code[i].p == 0)) return TRUE;
+  return FALSE;
+}
+
+// Tell whether the call at address call, in the block body starting at
+// start, can hand the frame over to the callee
+int isTailCall(CodeBlock* codeBlock, CodeAddress start, int* depth, CodeAddress call) {
+  Instruction* code = codeBlock->code;
+  int results;
+
+  if ((code[call].op != OP_CALL) || (code[call].p < 1)) return FALSE;
+  if ((code[call - 1].op != OP_DCT) || (code[call - 1].q < CALL_FRAME_WORDS)) return FALSE;
+  results = callResultCount(codeBlock, code + call);
+
+  if (results == 0) {
+    if (!leadsToExit(codeBlock, call + 1, OP_EP)) return FALSE;
+  } else if (results == 1) {
+    if ((code[call + 1].op != OP_ST) || !leadsToExit(codeBlock, call + 2, OP_EF) ||
+	!storesResult(codeBlock, start, depth, call)) return FALSE;
+  } else return FALSE;
+  return !passesFrameAddress(codeBlock, start, depth, call);
+}
+
+int eliminateTailCalls(CodeBlock* codeBlock, CodeAddress start, CodeAddress end) {
+  Instruction* code = codeBlock->code;
+  int* depth;
+  CodeAddress i, callee;
+  int count = 0;
+
+  if (code[start].op != OP_INT) return 0;
+  depth = computeStackDepths(codeBlock, start, end);
+
+  for (i = start + 2; i + 1 < end; i ++) {
+    if (!isTailCall(codeBlock, start, depth, i)) continue;
+
+    callee = code[i].q;
+    code[i - 1].op = OP_TC;
+    code[i - 1].p = code[i].p;
+    code[i - 1].q = code[i - 1].q - CALL_FRAME_WORDS;
+    code[i].op = OP_J;
+    code[i].p = DC_VALUE;
+    code[i].q = code[callee].q;
+    count ++;
+  }
+
+  free(depth);
+  return count;
+}
@@ -46,6 +46,25 @@ for kpl_file in "$TEST_DIR"/*.kpl; do
         TOTAL=$((TOTAL + 1))
         
         echo -n "Testing $base_name.kpl ... "
+
+        # Options for the compiler, if any, are in name.flags
+        flags=""
+        if [ -f "$TEST_DIR/$base_name.flags" ]; then
+            flags=$(cat "$TEST_DIR/$base_name.flags")
+        fi
+
+        # A test of a compile error has the expected message in name.err
+        if [ -f "$TEST_DIR/$base_name.err" ]; then
+            $COMPILER "$kpl_file" "$output_file" $flags > "$output_file.err" 2>&1
+            if diff -q "$output_file.err" "$TEST_DIR/$base_name.err" > /dev/null 2>&1; then
+                echo -e "${GREEN}PASSED${NC}"
+                PASSED=$((PASSED + 1))
+            else
+                echo -e "${RED}FAILED (error mismatch)${NC}"
+                FAILED=$((FAILED + 1))
+            fi
+            continue
+        fi
         
         # Check if expected output file exists
         if [ ! -f "$expected_file" ]; then
@@ -54,7 +73,7 @@ for kpl_file in "$TEST_DIR"/*.kpl; do
         fi
         
         # Compile the .kpl file
-        $COMPILER "$kpl_file" "$output_file" 2>/dev/null
+        $COMPILER "$kpl_file" "$output_file" $flags 2>/dev/null
         
         if [ $? -ne 0 ]; then
             echo -e "${RED}FAILED (compilation error)${NC}"
@@ -75,34 +94,67 @@ for kpl_file in "$TEST_DIR"/*.kpl; do
     fi
 done
 
-echo ""
-echo "=========================================="
-echo "               Summary"
-echo "=========================================="
-echo -e "Total: $TOTAL | ${GREEN}Passed: $PASSED${NC} | ${RED}Failed: $FAILED${NC}"
-echo ""
+# Run the generated code and compare with the expected output, both as
+# compiled and with all optimizations enabled
+KPLRUN="./kplrun"
+if [ ! -x "$KPLRUN" ]; then
+    KPLRUN=$(command -v kplrun)
+fi
 
-# Test with kplrun if available
-if command -v kplrun &> /dev/null; then
+if [ -n "$KPLRUN" ]; then
+    echo ""
     echo "=========================================="
-    echo "     Running tests with kplrun"
+    echo "     Running tests with $KPLRUN"
     echo "=========================================="
-    for output_file in "$OUTPUT_DIR"/*; do
-        if [ -f "$output_file" ]; then
-            base_name=$(basename "$output_file")
-            echo -n "Running $base_name ... "
+    for kpl_file in "$TEST_DIR"/*.kpl; do
+        base_name=$(basename "$kpl_file" .kpl)
+        expected_file="$TEST_DIR/$base_name.out"
+        input_file="$TEST_DIR/$base_name.in"
+
+        if [ ! -f "$expected_file" ]; then
+            continue
+        fi
+        if [ ! -f "$input_file" ]; then
+            input_file=/dev/null
+        fi
+        flags=""
+        if [ -f "$TEST_DIR/$base_name.flags" ]; then
+            flags=$(cat "$TEST_DIR/$base_name.flags")
+        fi
+
+        for opt in "" "-O"; do
+            output_file="$OUTPUT_DIR/$base_name$opt"
+            # A test expecting another output with -O has it in name-O.out
+            expected_file="$TEST_DIR/$base_name$opt.out"
+            if [ ! -f "$expected_file" ]; then
+                expected_file="$TEST_DIR/$base_name.out"
+            fi
+            TOTAL=$((TOTAL + 1))
+            echo -n "Running $base_name $opt ... "
+
+            $COMPILER "$kpl_file" "$output_file" $opt $flags > /dev/null 2>&1
             # Run with timeout to avoid infinite loops
-            timeout 5s kplrun "$output_file" < /dev/null > /dev/null 2>&1
-            if [ $? -eq 0 ]; then
+            timeout 5s $KPLRUN "$output_file" < "$input_file" > "$output_file.out" 2>&1
+
+            if diff -q "$output_file.out" "$expected_file" > /dev/null 2>&1; then
                 echo -e "${GREEN}OK${NC}"
+                PASSED=$((PASSED + 1))
             else
-                echo -e "${YELLOW}RUNTIME ERROR or TIMEOUT${NC}"
+                echo -e "${RED}FAILED (output mismatch)${NC}"
+                FAILED=$((FAILED + 1))
             fi
-        fi
+        done
     done
 else
-    echo -e "${YELLOW}Note: kplrun not found in PATH. Skipping runtime tests.${NC}"
+    echo -e "${YELLOW}Note: kplrun not found. Skipping runtime tests.${NC}"
     echo "To run the generated code, use: kplrun <output_file>"
 fi
 
+echo ""
+echo "=========================================="
+echo "               Summary"
+echo "=========================================="
+echo -e "Total: $TOTAL | ${GREEN}Passed: $PASSED${NC} | ${RED}Failed: $FAILED${NC}"
+echo ""
+
 exit $FAILED
@@ -31,7 +31,15 @@ struct {
   {"WHILE", KW_WHILE},
   {"DO", KW_DO},
   {"FOR", KW_FOR},
-  {"TO", KW_TO}
+  {"TO", KW_TO},
+  {"CASE", KW_CASE},
+  {"AND", KW_AND},
+  {"OR", KW_OR},
+  {"NOT", KW_NOT},
+  {"MOD", KW_MOD},
+  {"XOR", KW_XOR},
+  {"SHL", KW_SHL},
+  {"SHR", KW_SHR}
 };
 
 int keywordEq(char *kw, char *string) {
@@ -86,10 +94,19 @@ char *tokenToString(TokenType tokenType) {
   case KW_DO: return "keyword DO";
   case KW_FOR: return "keyword FOR";
   case KW_TO: return "keyword TO";
+  case KW_CASE: return "keyword CASE";
+  case KW_AND: return "keyword AND";
+  case KW_OR: return "keyword OR";
+  case KW_NOT: return "keyword NOT";
+  case KW_MOD: return "keyword MOD";
+  case KW_XOR: return "keyword XOR";
+  case KW_SHL: return "keyword SHL";
+  case KW_SHR: return "keyword SHR";
 
   case SB_SEMICOLON: return "\';\'";
   case SB_COLON: return "\':\'";
   case SB_PERIOD: return "\'.\'";
+  case SB_RANGE: return "\'..\'";
   case SB_COMMA: return "\',\'";
   case SB_ASSIGN: return "\':=\'";
   case SB_EQ: return "\'=\'";
@@ -7,8 +7,10 @@
 #ifndef __TOKEN_H__
 #define __TOKEN_H__
 
+#include "instructions.h"
+
 #define MAX_IDENT_LEN 15
-#define KEYWORDS_COUNT 20
+#define KEYWORDS_COUNT 28
 
 typedef enum {
   TK_NONE, TK_IDENT, TK_NUMBER, TK_CHAR, TK_EOF,
@@ -19,8 +21,11 @@ typedef enum {
   KW_BEGIN, KW_END, KW_CALL,
   KW_IF, KW_THEN, KW_ELSE,
   KW_WHILE, KW_DO, KW_FOR, KW_TO,
+  KW_CASE,
+  KW_AND, KW_OR, KW_NOT,
+  KW_MOD, KW_XOR, KW_SHL, KW_SHR,
 
-  SB_SEMICOLON, SB_COLON, SB_PERIOD, SB_COMMA,
+  SB_SEMICOLON, SB_COLON, SB_PERIOD, SB_RANGE, SB_COMMA,
   SB_ASSIGN, SB_EQ, SB_NEQ, SB_LT, SB_LE, SB_GT, SB_GE,
   SB_PLUS, SB_MINUS, SB_TIMES, SB_SLASH,
   SB_LPAR, SB_RPAR, SB_LSEL, SB_RSEL
@@ -30,7 +35,7 @@ typedef struct {
   char string[MAX_IDENT_LEN + 1];
   int lineNo, colNo;
   TokenType tokenType;
-  int value;
+  WORD value;
 } Token;
 
 TokenType checkKeyword(char *string);
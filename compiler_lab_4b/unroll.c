@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "optimizer.h"
+#include "summary.h"
+
+// Loop unrolling. A FOR loop over a local variable with constant bounds,
+//
+//    LA 0,q; CV; LC a; ST; CV; LI
+//    head: LC b; LE; FJ exit
+//    body
+//    CV; CV; LI; LC 1; AD; ST; CV; LI; J head
+//    exit: DCT 1
+//
+// runs b - a + 1 times, known here. A short loop is unrolled fully: the
+// body is copied once per value of the variable, with the variable read
+// as LC value. A longer one runs unrollFactor copies of the body per trip
+// of the loop, and the trips left over are copied after it, read as
+// constants again. The variable is stored as it would be on exit, b + 1.
+//
+// The body must not store to the variable nor take its address, and its
+// calls must not write it (see summary.h). When the body has calls, which
+// may read it, the variable is stored before each copy.
+
+#define UNROLL_SIZE_LIMIT 128     // longest unrolled loop
+#define UNROLL_GROWTH_LIMIT 1000  // instructions a block may grow by unrolling
+#define LOOP_HEADER_LENGTH 9      // LA 0,q up to the FJ
+#define LOOP_LATCH_LENGTH 9       // CV up to the J
+
+int unrollFactor = 4;
+
+struct ForLoop_ {
+  CodeAddress start;      // the LA of the variable
+  CodeAddress body;
+  CodeAddress latch;      // the CV incrementing the variable
+  CodeAddress exit;       // the DCT
+  WORD q;                 // offset of the variable
+  WORD first, last;
+  int hasCalls;
+};
+
+typedef struct ForLoop_ ForLoop;
+
+int isInstruction(Instruction* inst, enum OpCode op, WORD q) {
+  return (inst->op == op) && ((q == DC_VALUE) || (inst->q == q));
+}
+
+int matchForLoop(CodeBlock* codeBlock, CodeAddress start, ForLoop* loop) {
+  Instruction* code = codeBlock->code;
+  CodeAddress exit, latch;
+
+  if (start + LOOP_HEADER_LENGTH + LOOP_LATCH_LENGTH >= codeBlock->codeSize) return FALSE;
+  if (!isInstruction(code + start, OP_LA, DC_VALUE) || (code[start].p != 0) ||
+      !isInstruction(code + start + 1, OP_CV, DC_VALUE) ||
+      !isInstruction(code + start + 2, OP_LC, DC_VALUE) ||
+      !isInstruction(code + start + 3, OP_ST, DC_VALUE) ||
+      !isInstruction(code + start + 4, OP_CV, DC_VALUE) ||
+      !isInstruction(code + start + 5, OP_LI, DC_VALUE) ||
+      !isInstruction(code + start + 6, OP_LC, DC_VALUE) ||
+      !isInstruction(code + start + 7, OP_LE, DC_VALUE) ||
+      !isInstruction(code + start + 8, OP_FJ, DC_VALUE))
+    return FALSE;
+
+  exit = code[start + 8].q;
+  latch = exit - LOOP_LATCH_LENGTH;
+  if ((latch < start + LOOP_HEADER_LENGTH) || (exit >= codeBlock->codeSize)) return FALSE;
+  if (!isInstruction(code + latch, OP_CV, DC_VALUE) ||
+      !isInstruction(code + latch + 1, OP_CV, DC_VALUE) ||
+      !isInstruction(code + latch + 2, OP_LI, DC_VALUE) ||
+      !isInstruction(code + latch + 3, OP_LC, 1) ||
+      !isInstruction(code + latch + 4, OP_AD, DC_VALUE) ||
+      !isInstruction(code + latch + 5, OP_ST, DC_VALUE) ||
+      !isInstruction(code + latch + 6, OP_CV, DC_VALUE) ||
+      !isInstruction(code + latch + 7, OP_LI, DC_VALUE) ||
+      !isInstruction(code + latch + 8, OP_J, start + 6) ||
+      !isInstruction(code + exit, OP_DCT, 1))
+    return FALSE;
+
+  loop->start = start;
+  loop->body = start + LOOP_HEADER_LENGTH;
+  loop->latch = latch;
+  loop->exit = exit;
+  loop->q = code[start].q;
+  loop->first = code[start + 2].q;
+  loop->last = code[start + 6].q;
+  loop->hasCalls = FALSE;
+  return TRUE;
+}
+
+// Tell whether a call in the body may store to the variable
+int callWritesVariable(Instruction* call, WORD q) {
+  Summary* summary = findCallSummary(call);
+  Effect* effect;
+  int i;
+
+  if ((summary == NULL) || summary->effects.writesAny) return TRUE;
+  for (i = 0; i < summary->effects.count; i ++) {
+    effect = summary->effects.effects + i;
+    if (effect->kind != EFFECT_WRITE) continue;
+    if (effect->indirect || effect->indexed) return TRUE;
+    if ((call->p + effect->p - 1 == 0) && (effect->q == q)) return TRUE;
+  }
+  return FALSE;
+}
+
+// The body must be entered from the header only, jump within itself or
+// to the latch, and leave the variable alone
+int canUnroll(CodeBlock* codeBlock, ForLoop* loop) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+
+  for (i = 0; i < codeBlock->codeSize; i ++) {
+    if ((i >= loop->body) && (i < loop->latch)) continue;
+    if ((code[i].op != OP_J) && (code[i].op != OP_FJ)) continue;
+    if ((code[i].q > loop->start) && (code[i].q <= loop->exit) &&
+	(i != loop->start + 8) && (i != loop->latch + 8))
+      return FALSE;
+  }
+
+  for (i = loop->body; i < loop->latch; i ++)
+    switch (code[i].op) {
+    case OP_LA:
+      if ((code[i].p == 0) && (code[i].q == loop->q)) return FALSE;
+      break;
+    case OP_J:
+    case OP_FJ:
+      if ((code[i].q < loop->body) || (code[i].q > loop->latch)) return FALSE;
+      break;
+    case OP_CALL:
+      if (callWritesVariable(code + i, loop->q)) return FALSE;
+      loop->hasCalls = TRUE;
+      break;
+    case OP_CS:
+    case OP_TC:
+    case OP_EP:
+    case OP_EF:
+    case OP_HL:
+      return FALSE;
+    default:
+      break;
+    }
+  return TRUE;
+}
+
+void addUnrolledCode(Instruction* newCode, char* isLocal, int* count, enum OpCode op, WORD p, WORD q) {
+  newCode[*count].op = op;
+  newCode[*count].p = p;
+  newCode[*count].q = q;
+  isLocal[*count] = FALSE;
+  (*count) ++;
+}
+
+// Store value to the variable, or add value to it if constant is FALSE
+void addVariableStore(ForLoop* loop, Instruction* newCode, char* isLocal, int* count, int constant, WORD value) {
+  addUnrolledCode(newCode, isLocal, count, OP_LA, 0, loop->q);
+  if (constant)
+    addUnrolledCode(newCode, isLocal, count, OP_LC, DC_VALUE, value);
+  else {
+    addUnrolledCode(newCode, isLocal, count, OP_LV, 0, loop->q);
+    addUnrolledCode(newCode, isLocal, count, OP_LC, DC_VALUE, value);
+    addUnrolledCode(newCode, isLocal, count, OP_AD, DC_VALUE, DC_VALUE);
+  }
+  addUnrolledCode(newCode, isLocal, count, OP_ST, DC_VALUE, DC_VALUE);
+}
+
+// Copy the body with the variable read as the constant value, or as
+// itself plus value if constant is FALSE
+void addUnrolledBody(CodeBlock* codeBlock, ForLoop* loop, Instruction* newCode, char* isLocal, int* count,
+		     int constant, WORD value) {
+  Instruction* code = codeBlock->code;
+  int length = loop->latch - loop->body;
+  int* newOffset = (int*) malloc((length + 1) * sizeof(int));
+  int copy = *count;
+  CodeAddress i;
+
+  for (i = loop->body; i < loop->latch; i ++) {
+    newOffset[i - loop->body] = *count;
+    if ((code[i].op == OP_LV) && (code[i].p == 0) && (code[i].q == loop->q) && (constant || (value != 0))) {
+      if (constant)
+	addUnrolledCode(newCode, isLocal, count, OP_LC, DC_VALUE, value);
+      else {
+	addUnrolledCode(newCode, isLocal, count, OP_LV, 0, loop->q);
+	addUnrolledCode(newCode, isLocal, count, OP_LC, DC_VALUE, value);
+	addUnrolledCode(newCode, isLocal, count, OP_AD, DC_VALUE, DC_VALUE);
+      }
+      continue;
+    }
+    newCode[*count] = code[i];
+    isLocal[*count] = (code[i].op == OP_J) || (code[i].op == OP_FJ);
+    (*count) ++;
+  }
+  // A jump to the latch goes to the end of the copy
+  newOffset[length] = *count;
+
+  for (i = copy; i < *count; i ++)
+    if (isLocal[i])
+      newCode[i].q = newOffset[newCode[i].q - loop->body];
+  free(newOffset);
+}
+
+// Replace the loop with its unrolled code. Returns the growth of the
+// code, -1 if the loop is not unrolled.
+int unrollLoop(CodeBlock* codeBlock, ForLoop* loop, int growth) {
+  int length = loop->latch - loop->body;
+  long trips = (loop->last >= loop->first) ? (long) loop->last - loop->first + 1 : 0;
+  int factor = (unrollFactor > 1) ? unrollFactor : 1;
+  int full, groups, rest, size, count, k, j, head, exitJump, done;
+  Instruction* newCode;
+  char* isLocal;
+  WORD value;
+
+  if (loop->last == WORD_MAX) return -1;
+
+  // A copy of the body, storing the variable first if it has calls
+  size = length + (loop->hasCalls ? 4 : 0);
+  full = (trips * size + 3 <= UNROLL_SIZE_LIMIT);
+  if (!full && ((factor < 2) || (trips < 2 * factor) || (factor * (size + 1) + 12 > UNROLL_SIZE_LIMIT)))
+    return -1;
+  groups = full ? 0 : trips / factor;
+  rest = full ? trips : trips % factor;
+  if (growth + (groups > 0 ? factor * (size + 1) + 12 : 0) + rest * size + 3 - (loop->exit - loop->start + 1) >
+      UNROLL_GROWTH_LIMIT)
+    return -1;
+
+  // Reading the variable plus an offset takes three instructions
+  size = (groups > 0 ? factor * (3 * length + 5) + 12 : 0) + rest * size + 3;
+  newCode = (Instruction*) malloc((size + 1) * sizeof(Instruction));
+  isLocal = (char*) malloc(size + 1);
+  count = 0;
+
+  value = loop->first;
+  if (groups > 0) {
+    // head: LV 0,q; LC last start; LE; FJ rest
+    addVariableStore(loop, newCode, isLocal, &count, TRUE, value);
+    head = count;
+    addUnrolledCode(newCode, isLocal, &count, OP_LV, 0, loop->q);
+    addUnrolledCode(newCode, isLocal, &count, OP_LC, DC_VALUE, (WORD) (loop->first + (groups - 1) * factor));
+    addUnrolledCode(newCode, isLocal, &count, OP_LE, DC_VALUE, DC_VALUE);
+    exitJump = count;
+    addUnrolledCode(newCode, isLocal, &count, OP_FJ, DC_VALUE, DC_VALUE);
+    for (j = 0; j < factor; j ++) {
+      if (loop->hasCalls) {
+	if (j > 0)
+	  addVariableStore(loop, newCode, isLocal, &count, FALSE, 1);
+	addUnrolledBody(codeBlock, loop, newCode, isLocal, &count, FALSE, 0);
+      } else addUnrolledBody(codeBlock, loop, newCode, isLocal, &count, FALSE, j);
+    }
+    addVariableStore(loop, newCode, isLocal, &count, FALSE, loop->hasCalls ? 1 : factor);
+    addUnrolledCode(newCode, isLocal, &count, OP_J, DC_VALUE, head);
+    isLocal[count - 1] = TRUE;
+    newCode[exitJump].q = count;
+    isLocal[exitJump] = TRUE;
+    value = (WORD) (loop->first + groups * factor);
+  }
+
+  for (k = 0; k < rest; k ++, value ++) {
+    if (loop->hasCalls)
+      addVariableStore(loop, newCode, isLocal, &count, TRUE, value);
+    addUnrolledBody(codeBlock, loop, newCode, isLocal, &count, TRUE, value);
+  }
+  // The variable as the loop leaves it
+  addVariableStore(loop, newCode, isLocal, &count, TRUE, (trips > 0) ? (WORD) (loop->last + 1) : loop->first);
+
+  done = replaceCode(codeBlock, loop->start, loop->exit, newCode, isLocal, count);
+  free(newCode);
+  free(isLocal);
+  return done ? count - (loop->exit - loop->start + 1) : -1;
+}
+
+int unrollLoops(CodeBlock* codeBlock, CodeAddress start) {
+  ForLoop loop;
+  CodeAddress i;
+  int growth = 0, count = 0, length, changed;
+
+  // The inner loops first, which start after the outer ones. Again after
+  // each one, since the code moves.
+  do {
+    changed = FALSE;
+    for (i = codeBlock->codeSize - 1; i > start; i --) {
+      if (!matchForLoop(codeBlock, i, &loop) || !canUnroll(codeBlock, &loop)) continue;
+      length = unrollLoop(codeBlock, &loop, growth);
+      if (length < 0) continue;
+      growth += length;
+      count ++;
+      changed = TRUE;
+      break;
+    }
+  } while (changed);
+  return count;
+}
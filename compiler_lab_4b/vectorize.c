@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+
+// Vectorization. A FOR loop over a local variable,
+//
+//    LA 0,q; CV; lo; ST; CV; LI
+//    head: hi; LE; FJ exit
+//    body
+//    CV; CV; LI; LC 1; AD; ST; CV; LI; J head
+//    exit: DCT 1
+//
+// whose body is one assignment on the elements of arrays at the index
+// of the loop, next to each other (see ElementAddress in optimizer.h),
+// is replaced with a single vector instruction over the hi - lo + 1
+// elements (see instructions.h):
+//
+//    a(.i.) := b(.i.) + c(.i.)     VAD, and VSB and VML for - and *
+//    a(.i.) := b(.i.)              VCP
+//    a(.i.) := e                   VFL
+//    s := s + a(.i.)               VSM
+//    s := s + a(.i.) * b(.i.)      VDT
+//
+// The bounds, the bases and e must be computed from constants and
+// variables the loop does not write, so that computing them once gives
+// what the loop would. The vector instructions work one element after
+// the other, as the loop does, whatever the arrays they are given. The
+// new code stores lo to the variable, reads the addresses with it, and
+// stores the variable as the loop would leave it:
+//
+//    LA 0,q; lo; ST
+//    [LA s; LV s]; addresses; hi; LV 0,q; SB; LC 1; AD; V..; [AD; ST]
+//    hi; LV 0,q; GE; FJ done; LA 0,q; hi; LC 1; AD; ST
+//    done:
+
+#define NO_VARIABLE -1
+
+// The assignment of the body. The operands are the element addresses,
+// or e for VFL, each one from start to end inclusive.
+struct VectorStatement_ {
+  enum OpCode op;
+  int operandCount;
+  CodeAddress operandStart[3], operandEnd[3];
+  WORD p, q;              // the variable of a sum, NO_VARIABLE otherwise
+};
+
+typedef struct VectorStatement_ VectorStatement;
+
+int isOp(Instruction* inst, enum OpCode op) {
+  return inst->op == op;
+}
+
+// Start of the address of an element at the index of the loop, ending
+// at address end; -1 if the code is not one
+CodeAddress elementStart(CodeBlock* codeBlock, ForStatement* loop, CodeAddress low, CodeAddress end) {
+  ElementAddress element;
+
+  if (!matchElementAddress(codeBlock, low, end, loop->q, &element) || (element.stride != 1))
+    return -1;
+  return element.start;
+}
+
+void setOperand(VectorStatement* statement, int k, CodeAddress start, CodeAddress end) {
+  statement->operandStart[k] = start;
+  statement->operandEnd[k] = end;
+}
+
+// s := s + ..., or s := ... + s for a sum, starting at address start
+int matchSumVariable(CodeBlock* codeBlock, CodeAddress start, CodeAddress load, VectorStatement* statement) {
+  Instruction* code = codeBlock->code;
+
+  if (!isOp(code + start, OP_LA) || !isOp(code + load, OP_LV) ||
+      (code[start].p != code[load].p) || (code[start].q != code[load].q))
+    return FALSE;
+  statement->p = code[start].p;
+  statement->q = code[start].q;
+  return TRUE;
+}
+
+int matchVectorStatement(CodeBlock* codeBlock, ForStatement* loop, VectorStatement* statement) {
+  Instruction* code = codeBlock->code;
+  CodeAddress low = loop->body, store = loop->latch - 1;
+  CodeAddress x, y, dst, value;
+  int k;
+
+  if ((store <= low) || !isOp(code + store, OP_ST)) return FALSE;
+  statement->p = NO_VARIABLE;
+  statement->q = NO_VARIABLE;
+
+  switch (code[store - 1].op) {
+  case OP_AD:
+  case OP_SB:
+  case OP_ML:
+    if ((code[store - 1].op == OP_AD) && isOp(code + store - 2, OP_ML) && isOp(code + store - 3, OP_LI)) {
+      // s := s + a(.i.) * b(.i.)
+      y = elementStart(codeBlock, loop, low, store - 4);
+      if ((y < 0) || !isOp(code + y - 1, OP_LI)) return FALSE;
+      x = elementStart(codeBlock, loop, low, y - 2);
+      if ((x != low + 2) || !matchSumVariable(codeBlock, low, low + 1, statement)) return FALSE;
+      statement->op = OP_VDT;
+      statement->operandCount = 2;
+      setOperand(statement, 0, x, y - 2);
+      setOperand(statement, 1, y, store - 4);
+      break;
+    }
+    if ((code[store - 1].op == OP_AD) && isOp(code + store - 2, OP_LV)) {
+      // s := a(.i.) + s
+      if (!isOp(code + store - 3, OP_LI)) return FALSE;
+      x = elementStart(codeBlock, loop, low, store - 4);
+      if ((x != low + 1) || !matchSumVariable(codeBlock, low, store - 2, statement)) return FALSE;
+      statement->op = OP_VSM;
+      statement->operandCount = 1;
+      setOperand(statement, 0, x, store - 4);
+      break;
+    }
+    if (!isOp(code + store - 2, OP_LI)) return FALSE;
+    y = elementStart(codeBlock, loop, low, store - 3);
+    if (y < 0) return FALSE;
+    if ((code[store - 1].op == OP_AD) && (y == low + 2)) {
+      // s := s + a(.i.)
+      if (!matchSumVariable(codeBlock, low, low + 1, statement)) return FALSE;
+      statement->op = OP_VSM;
+      statement->operandCount = 1;
+      setOperand(statement, 0, y, store - 3);
+      break;
+    }
+    if (!isOp(code + y - 1, OP_LI)) return FALSE;
+    x = elementStart(codeBlock, loop, low, y - 2);
+    if (x < 0) return FALSE;
+    dst = elementStart(codeBlock, loop, low, x - 1);
+    if (dst != low) return FALSE;
+    statement->op = (code[store - 1].op == OP_AD) ? OP_VAD : (code[store - 1].op == OP_SB) ? OP_VSB : OP_VML;
+    statement->operandCount = 3;
+    setOperand(statement, 0, dst, x - 1);
+    setOperand(statement, 1, x, y - 2);
+    setOperand(statement, 2, y, store - 3);
+    break;
+  case OP_LI:
+    // a(.i.) := b(.i.)
+    x = elementStart(codeBlock, loop, low, store - 2);
+    if (x < 0) return FALSE;
+    dst = elementStart(codeBlock, loop, low, x - 1);
+    if (dst != low) return FALSE;
+    statement->op = OP_VCP;
+    statement->operandCount = 2;
+    setOperand(statement, 0, dst, x - 1);
+    setOperand(statement, 1, x, store - 2);
+    break;
+  default:
+    // a(.i.) := e
+    value = invariantStart(codeBlock, low, store - 1);
+    if (value < 0) return FALSE;
+    dst = elementStart(codeBlock, loop, low, value - 1);
+    if (dst != low) return FALSE;
+    statement->op = OP_VFL;
+    statement->operandCount = 2;
+    setOperand(statement, 0, dst, value - 1);
+    setOperand(statement, 1, value, store - 1);
+    break;
+  }
+
+  // The index is read in the addresses only, and a sum in its own update
+  if ((statement->op == OP_VFL) &&
+      readsSlot(codeBlock, statement->operandStart[1], statement->operandEnd[1] + 1, 0, loop->q))
+    return FALSE;
+  if (statement->p == NO_VARIABLE) return TRUE;
+  for (k = 0; k < statement->operandCount; k ++)
+    if (readsSlot(codeBlock, statement->operandStart[k], statement->operandEnd[k] + 1, statement->p, statement->q))
+      return FALSE;
+  return ((statement->p != 0) || (statement->q != loop->q)) &&
+    !readsSlot(codeBlock, loop->head, loop->body - 2, statement->p, statement->q);
+}
+
+void addVectorCode(Instruction* newCode, int* count, enum OpCode op, WORD p, WORD q) {
+  newCode[*count].op = op;
+  newCode[*count].p = p;
+  newCode[*count].q = q;
+  (*count) ++;
+}
+
+void copyVectorCode(CodeBlock* codeBlock, Instruction* newCode, int* count, CodeAddress start, int length) {
+  memcpy(newCode + *count, codeBlock->code + start, length * sizeof(Instruction));
+  *count += length;
+}
+
+int vectorizeLoop(CodeBlock* codeBlock, ForStatement* loop, VectorStatement* statement) {
+  Instruction* newCode;
+  char* isLocal;
+  int loLength = loop->head - 3 - loop->lo, hiLength = loop->body - 2 - loop->head;
+  int size, count = 0, k, skip, done;
+
+  size = loLength + 3 * hiLength + 22;
+  for (k = 0; k < statement->operandCount; k ++)
+    size += statement->operandEnd[k] - statement->operandStart[k] + 1;
+  newCode = (Instruction*) malloc((size + 1) * sizeof(Instruction));
+  isLocal = (char*) calloc(size + 1, 1);
+
+  addVectorCode(newCode, &count, OP_LA, 0, loop->q);
+  copyVectorCode(codeBlock, newCode, &count, loop->lo, loLength);
+  addVectorCode(newCode, &count, OP_ST, DC_VALUE, DC_VALUE);
+
+  if (statement->p != NO_VARIABLE) {
+    addVectorCode(newCode, &count, OP_LA, statement->p, statement->q);
+    addVectorCode(newCode, &count, OP_LV, statement->p, statement->q);
+  }
+  for (k = 0; k < statement->operandCount; k ++)
+    copyVectorCode(codeBlock, newCode, &count, statement->operandStart[k],
+		   statement->operandEnd[k] - statement->operandStart[k] + 1);
+  copyVectorCode(codeBlock, newCode, &count, loop->head, hiLength);
+  addVectorCode(newCode, &count, OP_LV, 0, loop->q);
+  addVectorCode(newCode, &count, OP_SB, DC_VALUE, DC_VALUE);
+  addVectorCode(newCode, &count, OP_LC, DC_VALUE, 1);
+  addVectorCode(newCode, &count, OP_AD, DC_VALUE, DC_VALUE);
+  addVectorCode(newCode, &count, statement->op, DC_VALUE, DC_VALUE);
+  if (statement->p != NO_VARIABLE) {
+    addVectorCode(newCode, &count, OP_AD, DC_VALUE, DC_VALUE);
+    addVectorCode(newCode, &count, OP_ST, DC_VALUE, DC_VALUE);
+  }
+
+  // The variable as the loop leaves it
+  copyVectorCode(codeBlock, newCode, &count, loop->head, hiLength);
+  addVectorCode(newCode, &count, OP_LV, 0, loop->q);
+  addVectorCode(newCode, &count, OP_GE, DC_VALUE, DC_VALUE);
+  skip = count;
+  addVectorCode(newCode, &count, OP_FJ, DC_VALUE, DC_VALUE);
+  addVectorCode(newCode, &count, OP_LA, 0, loop->q);
+  copyVectorCode(codeBlock, newCode, &count, loop->head, hiLength);
+  addVectorCode(newCode, &count, OP_LC, DC_VALUE, 1);
+  addVectorCode(newCode, &count, OP_AD, DC_VALUE, DC_VALUE);
+  addVectorCode(newCode, &count, OP_ST, DC_VALUE, DC_VALUE);
+  newCode[skip].q = count;
+  isLocal[skip] = TRUE;
+
+  done = replaceCode(codeBlock, loop->start, loop->exit, newCode, isLocal, count);
+  free(newCode);
+  free(isLocal);
+  return done;
+}
+
+int vectorizeLoops(CodeBlock* codeBlock, CodeAddress start) {
+  ForStatement loop;
+  VectorStatement statement;
+  CodeAddress i;
+  int count = 0;
+
+  // From the end, so that the code moved by a loop has been looked at
+  for (i = codeBlock->codeSize - 1; i > start; i --) {
+    if (!matchForStatement(codeBlock, i, &loop) || !matchVectorStatement(codeBlock, &loop, &statement)) continue;
+    if (vectorizeLoop(codeBlock, &loop, &statement))
+      count ++;
+  }
+  return count;
+}
@@ -0,0 +1,732 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+
+// The vector instructions use lanes of 32 bits, for 32-bit words only
+#if defined(__SSE2__) && !defined(WORD64)
+#define VECTOR_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__SSE4_1__) && !defined(WORD64)
+#define VECTOR_SSE4_1
+#include <smmintrin.h>
+#endif
+
+CodeBlock* codeBlock;
+
+WORD* stack;
+int stackSize;
+int t;          // top of the stack
+int b;          // base of the current frame
+int pc;         // program counter
+int ps;         // processor status
+
+int countInstructions = FALSE;
+VMStatistics statistics;
+
+// The memo table is direct mapped: a result replaces the one stored in
+// its entry
+struct MemoEntry_ {
+  int used;
+  WORD function;
+  WORD key[MEMO_KEY_WORDS];
+  WORD value;
+};
+
+typedef struct MemoEntry_ MemoEntry;
+
+MemoEntry* memoTable;
+
+int initVM(int size) {
+  stackSize = size;
+  stack = (WORD*) malloc((stackSize + STACK_SAFETY_WORDS) * sizeof(WORD));
+  if (stack == NULL) return 0;
+  memoTable = (MemoEntry*) calloc(MEMO_TABLE_SIZE, sizeof(MemoEntry));
+  if (memoTable == NULL) return 0;
+  codeBlock = NULL;
+  ps = PS_INACTIVE;
+  return 1;
+}
+
+void cleanVM(void) {
+  free(stack);
+  free(memoTable);
+  if (codeBlock != NULL)
+    freeCodeBlock(codeBlock);
+}
+
+int loadExecutable(FILE* f) {
+  long fileSize;
+
+  fseek(f, 0, SEEK_END);
+  fileSize = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  codeBlock = createCodeBlock(fileSize / sizeof(Instruction) + 1);
+  if (loadCode(codeBlock, f)) return codeBlock->codeSize > 0;
+  if (((codeBlock->wordSize == 4) || (codeBlock->wordSize == 8)) && (codeBlock->wordSize != sizeof(WORD)))
+    printf("The executable has %d-bit words, and the VM %d-bit words.\n", 8 * codeBlock->wordSize, WORD_BITS);
+  return 0;
+}
+
+void enableStatistics(void) {
+  countInstructions = TRUE;
+}
+
+void enableCheckedArithmetic(void) {
+  Instruction* code = codeBlock->code;
+  CodeAddress i;
+
+  for (i = 0; i < codeBlock->codeSize; i ++)
+    switch (code[i].op) {
+    case OP_AD: code[i].op = OP_CAD; break;
+    case OP_SB: code[i].op = OP_CSB; break;
+    case OP_ML: code[i].op = OP_CML; break;
+    case OP_DV: code[i].op = OP_CDV; break;
+    case OP_MOD: code[i].op = OP_CMOD; break;
+    case OP_NEG: code[i].op = OP_CNEG; break;
+    case OP_SHL: code[i].op = OP_CSHL; break;
+    case OP_VAD: code[i].op = OP_CVAD; break;
+    case OP_VSB: code[i].op = OP_CVSB; break;
+    case OP_VML: code[i].op = OP_CVML; break;
+    case OP_VSM: code[i].op = OP_CVSM; break;
+    case OP_VDT: code[i].op = OP_CVDT; break;
+    default: break;
+    }
+}
+
+// Follow the static links p times from the current frame
+WORD base(int p) {
+  WORD currentBase = b;
+  while (p > 0) {
+    currentBase = stack[currentBase + 3];
+    p --;
+  }
+  return currentBase;
+}
+
+// Entry of the memo table for the function and the argCount arguments of
+// the current frame
+MemoEntry* findMemoEntry(WORD function, int argCount) {
+  unsigned int hash = (unsigned int) function * 2654435761u;
+  int i;
+
+  for (i = 0; i < argCount; i ++)
+    hash = (hash ^ (unsigned int) stack[b+4+i]) * 16777619u;
+  return memoTable + ((hash ^ (hash >> 16)) % MEMO_TABLE_SIZE);
+}
+
+int isMemoHit(MemoEntry* entry, WORD function, int argCount) {
+  int i;
+
+  if (!entry->used || (entry->function != function)) return FALSE;
+  for (i = 0; i < argCount; i ++)
+    if (entry->key[i] != stack[b+4+i]) return FALSE;
+  return TRUE;
+}
+
+/******************* Vector instructions ******************************/
+
+// The vector instructions work on n words starting at addresses taken
+// from the stack. They run four words at a time where the processor has
+// the instructions for it, and one word at a time otherwise. Their result
+// is that of the words done one after the other, from the first on: a
+// destination starting less than four words above a source is done one
+// word at a time.
+
+#define VECTOR_WORDS 4
+
+int isValidRange(WORD address, WORD n) {
+  return (address >= 0) && (address <= stackSize - n);
+}
+
+int overlapsAhead(WORD* dst, WORD* src) {
+  return (dst > src) && (dst - src < VECTOR_WORDS);
+}
+
+void vectorOperation(enum OpCode op, WORD* dst, WORD* x, WORD* y, WORD n) {
+  WORD k = 0;
+
+#ifdef VECTOR_SSE2
+  if (!overlapsAhead(dst, x) && !overlapsAhead(dst, y))
+    for (; k + VECTOR_WORDS <= n; k += VECTOR_WORDS) {
+      __m128i a = _mm_loadu_si128((__m128i*) (x + k));
+      __m128i c = _mm_loadu_si128((__m128i*) (y + k));
+
+      if (op == OP_VAD)
+	a = _mm_add_epi32(a, c);
+      else if (op == OP_VSB)
+	a = _mm_sub_epi32(a, c);
+      else {
+#ifdef VECTOR_SSE4_1
+	a = _mm_mullo_epi32(a, c);
+#else
+	break;
+#endif
+      }
+      _mm_storeu_si128((__m128i*) (dst + k), a);
+    }
+#endif
+  for (; k < n; k ++)
+    switch (op) {
+    case OP_VAD:
+      dst[k] = (WORD) ((UWORD) x[k] + (UWORD) y[k]);
+      break;
+    case OP_VSB:
+      dst[k] = (WORD) ((UWORD) x[k] - (UWORD) y[k]);
+      break;
+    default:
+      dst[k] = (WORD) ((UWORD) x[k] * (UWORD) y[k]);
+      break;
+    }
+}
+
+void vectorFill(WORD* dst, WORD value, WORD n) {
+  WORD k = 0;
+
+#ifdef VECTOR_SSE2
+  __m128i v = _mm_set1_epi32(value);
+
+  for (; k + VECTOR_WORDS <= n; k += VECTOR_WORDS)
+    _mm_storeu_si128((__m128i*) (dst + k), v);
+#endif
+  for (; k < n; k ++)
+    dst[k] = value;
+}
+
+void vectorCopy(WORD* dst, WORD* src, WORD n) {
+  WORD k;
+
+  // A destination inside the source repeats its first words
+  if ((dst > src) && (dst < src + n))
+    for (k = 0; k < n; k ++)
+      dst[k] = src[k];
+  else memmove(dst, src, n * sizeof(WORD));
+}
+
+WORD vectorSum(WORD* x, WORD n) {
+  UWORD sum = 0;
+  WORD k = 0;
+
+#ifdef VECTOR_SSE2
+  __m128i s = _mm_setzero_si128();
+  unsigned int lanes[VECTOR_WORDS];
+
+  for (; k + VECTOR_WORDS <= n; k += VECTOR_WORDS)
+    s = _mm_add_epi32(s, _mm_loadu_si128((__m128i*) (x + k)));
+  _mm_storeu_si128((__m128i*) lanes, s);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+  // Sums wrap around as those of AD do
+  for (; k < n; k ++)
+    sum += (UWORD) x[k];
+  return (WORD) sum;
+}
+
+WORD vectorDot(WORD* x, WORD* y, WORD n) {
+  UWORD sum = 0;
+  WORD k = 0;
+
+#ifdef VECTOR_SSE4_1
+  __m128i s = _mm_setzero_si128();
+  unsigned int lanes[VECTOR_WORDS];
+
+  for (; k + VECTOR_WORDS <= n; k += VECTOR_WORDS)
+    s = _mm_add_epi32(s, _mm_mullo_epi32(_mm_loadu_si128((__m128i*) (x + k)),
+					 _mm_loadu_si128((__m128i*) (y + k))));
+  _mm_storeu_si128((__m128i*) lanes, s);
+  sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+  for (; k < n; k ++)
+    sum += (UWORD) x[k] * (UWORD) y[k];
+  return (WORD) sum;
+}
+
+// The checked variants go one word at a time, in the order of the loops
+// they replace, and return FALSE at the first result that does not fit
+
+int checkedVectorOperation(enum OpCode op, WORD* dst, WORD* x, WORD* y, WORD n) {
+  WORD k;
+  int overflow;
+
+  for (k = 0; k < n; k ++) {
+    switch (op) {
+    case OP_CVAD:
+      overflow = __builtin_add_overflow(x[k], y[k], dst + k);
+      break;
+    case OP_CVSB:
+      overflow = __builtin_sub_overflow(x[k], y[k], dst + k);
+      break;
+    default:
+      overflow = __builtin_mul_overflow(x[k], y[k], dst + k);
+      break;
+    }
+    if (overflow) return FALSE;
+  }
+  return TRUE;
+}
+
+int checkedVectorSum(WORD* x, WORD n, WORD* result) {
+  WORD sum = 0, k;
+
+  for (k = 0; k < n; k ++)
+    if (__builtin_add_overflow(sum, x[k], &sum)) return FALSE;
+  *result = sum;
+  return TRUE;
+}
+
+int checkedVectorDot(WORD* x, WORD* y, WORD n, WORD* result) {
+  WORD sum = 0, product, k;
+
+  for (k = 0; k < n; k ++)
+    if (__builtin_mul_overflow(x[k], y[k], &product) || __builtin_add_overflow(sum, product, &sum))
+      return FALSE;
+  *result = sum;
+  return TRUE;
+}
+
+int run(void) {
+  Instruction* code = codeBlock->code;
+  WORD* data = codeBlock->data;
+  Instruction* inst;
+  WORD k, n, returnAddress, staticLink;
+  MemoEntry* memo;
+  int i;
+
+  t = -1;
+  b = 0;
+  pc = 0;
+  ps = PS_ACTIVE;
+
+  statistics.instructionCount = 0;
+  for (i = 0; i <= OP_BP; i ++)
+    statistics.opcodeCount[i] = 0;
+  statistics.peakStack = 0;
+
+  while (ps == PS_ACTIVE) {
+    if (t >= statistics.peakStack) {
+      statistics.peakStack = t + 1;
+      if (t >= stackSize) {
+	ps = PS_STACK_OVERFLOW;
+	break;
+      }
+    }
+    if ((pc < 0) || (pc >= codeBlock->codeSize)) {
+      ps = PS_INVALID_INSTRUCTION;
+      break;
+    }
+
+    inst = code + pc;
+    if (countInstructions) {
+      statistics.instructionCount ++;
+      statistics.opcodeCount[inst->op] ++;
+    }
+
+    switch (inst->op) {
+    case OP_LA:
+      t ++;
+      stack[t] = base(inst->p) + inst->q;
+      break;
+    case OP_LV:
+      t ++;
+      stack[t] = stack[base(inst->p) + inst->q];
+      break;
+    case OP_LC:
+      t ++;
+      stack[t] = inst->q;
+      break;
+    case OP_LI:
+      stack[t] = stack[stack[t]];
+      break;
+    case OP_INT:
+      t += inst->q;
+      break;
+    case OP_DCT:
+      t -= inst->q;
+      break;
+    case OP_J:
+      pc = inst->q - 1;
+      break;
+    case OP_FJ:
+      if (stack[t] == FALSE)
+	pc = inst->q - 1;
+      t --;
+      break;
+    case OP_HL:
+      ps = PS_NORMAL_EXIT;
+      break;
+    case OP_ST:
+      stack[stack[t-1]] = stack[t];
+      t -= 2;
+      break;
+    case OP_CALL:
+      stack[t+2] = b;
+      stack[t+3] = pc;
+      stack[t+4] = base(inst->p);
+      b = t + 1;
+      pc = inst->q - 1;
+      break;
+    case OP_EP:
+      t = b - 1;
+      pc = stack[b+2];
+      b = stack[b+1];
+      break;
+    case OP_EF:
+      t = b;
+      pc = stack[b+2];
+      b = stack[b+1];
+      break;
+    case OP_RC:
+      t ++;
+      stack[t] = getchar();
+      break;
+    case OP_RI:
+      t ++;
+      if (scanf(WORD_FORMAT, &stack[t]) != 1)
+	ps = PS_IO_ERROR;
+      break;
+    case OP_WRC:
+      putchar(stack[t]);
+      t --;
+      break;
+    case OP_WRI:
+      printf(WORD_FORMAT, stack[t]);
+      t --;
+      break;
+    case OP_WLN:
+      putchar('\n');
+      break;
+    // The unchecked arithmetic wraps around, computed on UWORD where signed
+    // overflow would be undefined
+    case OP_AD:
+      t --;
+      stack[t] = (WORD) ((UWORD) stack[t] + (UWORD) stack[t+1]);
+      break;
+    case OP_SB:
+      t --;
+      stack[t] = (WORD) ((UWORD) stack[t] - (UWORD) stack[t+1]);
+      break;
+    case OP_ML:
+      t --;
+      stack[t] = (WORD) ((UWORD) stack[t] * (UWORD) stack[t+1]);
+      break;
+    case OP_DV:
+      // WORD_MIN / -1 wraps around as AD and ML do, instead of trapping on the host
+      t --;
+      if (stack[t+1] == 0)
+	ps = PS_DIVIDE_BY_ZERO;
+      else if ((stack[t] == WORD_MIN) && (stack[t+1] == -1))
+	stack[t] = WORD_MIN;
+      else stack[t] /= stack[t+1];
+      break;
+    case OP_NEG:
+      stack[t] = (WORD) (- (UWORD) stack[t]);
+      break;
+    case OP_CV:
+      stack[t+1] = stack[t];
+      t ++;
+      break;
+    case OP_EQ:
+      t --;
+      stack[t] = (stack[t] == stack[t+1]);
+      break;
+    case OP_NE:
+      t --;
+      stack[t] = (stack[t] != stack[t+1]);
+      break;
+    case OP_GT:
+      t --;
+      stack[t] = (stack[t] > stack[t+1]);
+      break;
+    case OP_LT:
+      t --;
+      stack[t] = (stack[t] < stack[t+1]);
+      break;
+    case OP_GE:
+      t --;
+      stack[t] = (stack[t] >= stack[t+1]);
+      break;
+    case OP_LE:
+      t --;
+      stack[t] = (stack[t] <= stack[t+1]);
+      break;
+    case OP_SHL:
+      t --;
+      stack[t] = (WORD) ((UWORD) stack[t] << (stack[t+1] & SHIFT_MASK));
+      break;
+    case OP_SHR:
+      t --;
+      stack[t] = stack[t] >> (stack[t+1] & SHIFT_MASK);
+      break;
+    case OP_SRZ:
+      // Bias negative dividends by 2^k - 1 so that the shift truncates like OP_DV
+      t --;
+      k = stack[t+1];
+      if (stack[t] < 0)
+	stack[t] += (WORD) (((UWORD) 1 << k) - 1);
+      stack[t] = stack[t] >> k;
+      break;
+    case OP_AND:
+      t --;
+      stack[t] &= stack[t+1];
+      break;
+    case OP_OR:
+      t --;
+      stack[t] |= stack[t+1];
+      break;
+    case OP_XOR:
+      t --;
+      stack[t] ^= stack[t+1];
+      break;
+    case OP_MOD:
+      // Any remainder by -1 is 0, where WORD_MIN % -1 would trap on the host
+      t --;
+      if (stack[t+1] == 0)
+	ps = PS_DIVIDE_BY_ZERO;
+      else if (stack[t+1] == -1)
+	stack[t] = 0;
+      else stack[t] %= stack[t+1];
+      break;
+    case OP_CAD:
+      t --;
+      if (__builtin_add_overflow(stack[t], stack[t+1], stack + t))
+	ps = PS_ARITHMETIC_OVERFLOW;
+      break;
+    case OP_CSB:
+      t --;
+      if (__builtin_sub_overflow(stack[t], stack[t+1], stack + t))
+	ps = PS_ARITHMETIC_OVERFLOW;
+      break;
+    case OP_CML:
+      t --;
+      if (__builtin_mul_overflow(stack[t], stack[t+1], stack + t))
+	ps = PS_ARITHMETIC_OVERFLOW;
+      break;
+    case OP_CDV:
+      t --;
+      if (stack[t+1] == 0)
+	ps = PS_DIVIDE_BY_ZERO;
+      else if ((stack[t] == WORD_MIN) && (stack[t+1] == -1))
+	ps = PS_ARITHMETIC_OVERFLOW;
+      else stack[t] /= stack[t+1];
+      break;
+    case OP_CMOD:
+      t --;
+      if (stack[t+1] == 0)
+	ps = PS_DIVIDE_BY_ZERO;
+      else if (stack[t+1] == -1)
+	stack[t] = 0;
+      else stack[t] %= stack[t+1];
+      break;
+    case OP_CNEG:
+      if (__builtin_sub_overflow((WORD) 0, stack[t], stack + t))
+	ps = PS_ARITHMETIC_OVERFLOW;
+      break;
+    case OP_CSHL:
+      // A multiplication by 2^k: shifting back must give the operand
+      t --;
+      k = stack[t+1] & SHIFT_MASK;
+      n = (WORD) ((UWORD) stack[t] << k);
+      if ((n >> k) != stack[t])
+	ps = PS_ARITHMETIC_OVERFLOW;
+      else stack[t] = n;
+      break;
+    case OP_TC:
+      // The arguments move down, above the reserved words of the frame
+      k = base(inst->p);
+      for (i = 0; i < inst->q; i ++)
+	stack[b+4+i] = stack[t-inst->q+1+i];
+      stack[b+3] = k;
+      t = b - 1;
+      break;
+    case OP_CS:
+      stack[t+1] = pc;
+      stack[t+2] = (inst->p >= 0) ? base(inst->p) : 0;
+      t += 2;
+      pc = inst->q - 1;
+      break;
+    case OP_EN:
+      // The arguments move up over the reserved words of the new frame
+      returnAddress = stack[t-1];
+      staticLink = stack[t];
+      k = t - inst->p - 1;
+      for (i = inst->p - 1; i >= 0; i --)
+	stack[k+4+i] = stack[k+i];
+      stack[k+1] = b;
+      stack[k+2] = returnAddress;
+      stack[k+3] = staticLink;
+      b = k;
+      t = k + inst->q - 1;
+      break;
+    case OP_MC:
+      memo = findMemoEntry(inst->q, inst->p);
+      if (isMemoHit(memo, inst->q, inst->p)) {
+	stack[b] = memo->value;
+	t = b;
+	pc = stack[b+2];
+	b = stack[b+1];
+      }
+      break;
+    case OP_MS:
+      memo = findMemoEntry(inst->q, inst->p);
+      memo->used = TRUE;
+      memo->function = inst->q;
+      for (i = 0; i < inst->p; i ++)
+	memo->key[i] = stack[b+4+i];
+      memo->value = stack[b];
+      break;
+    case OP_VAD:
+    case OP_VSB:
+    case OP_VML:
+    case OP_CVAD:
+    case OP_CVSB:
+    case OP_CVML:
+      n = stack[t];
+      t -= 4;
+      if (n <= 0) break;
+      if (!isValidRange(stack[t+1], n) || !isValidRange(stack[t+2], n) || !isValidRange(stack[t+3], n)) {
+	ps = PS_INVALID_INSTRUCTION;
+	break;
+      }
+      if ((inst->op == OP_VAD) || (inst->op == OP_VSB) || (inst->op == OP_VML))
+	vectorOperation(inst->op, stack + stack[t+1], stack + stack[t+2], stack + stack[t+3], n);
+      else if (!checkedVectorOperation(inst->op, stack + stack[t+1], stack + stack[t+2], stack + stack[t+3], n))
+	ps = PS_ARITHMETIC_OVERFLOW;
+      break;
+    case OP_VFL:
+      n = stack[t];
+      t -= 3;
+      if (n <= 0) break;
+      if (!isValidRange(stack[t+1], n)) {
+	ps = PS_INVALID_INSTRUCTION;
+	break;
+      }
+      vectorFill(stack + stack[t+1], stack[t+2], n);
+      break;
+    case OP_VCP:
+      n = stack[t];
+      t -= 3;
+      if (n <= 0) break;
+      if (!isValidRange(stack[t+1], n) || !isValidRange(stack[t+2], n)) {
+	ps = PS_INVALID_INSTRUCTION;
+	break;
+      }
+      vectorCopy(stack + stack[t+1], stack + stack[t+2], n);
+      break;
+    case OP_VSM:
+    case OP_CVSM:
+      n = stack[t];
+      t --;
+      if (n <= 0)
+	stack[t] = 0;
+      else if (!isValidRange(stack[t], n))
+	ps = PS_INVALID_INSTRUCTION;
+      else if (inst->op == OP_VSM)
+	stack[t] = vectorSum(stack + stack[t], n);
+      else if (!checkedVectorSum(stack + stack[t], n, stack + t))
+	ps = PS_ARITHMETIC_OVERFLOW;
+      break;
+    case OP_VDT:
+    case OP_CVDT:
+      n = stack[t];
+      t -= 2;
+      if (n <= 0)
+	stack[t] = 0;
+      else if (!isValidRange(stack[t], n) || !isValidRange(stack[t+1], n))
+	ps = PS_INVALID_INSTRUCTION;
+      else if (inst->op == OP_VDT)
+	stack[t] = vectorDot(stack + stack[t], stack + stack[t+1], n);
+      else if (!checkedVectorDot(stack + stack[t], stack + stack[t+1], n, stack + t))
+	ps = PS_ARITHMETIC_OVERFLOW;
+      break;
+    case OP_BC:
+      if ((stack[t] < 1) || (stack[t] > inst->q))
+	ps = PS_INDEX_OUT_OF_RANGE;
+      break;
+    case OP_BM:
+      t -= 2;
+      if (inst->q <= 0) break;
+      if (!isValidRange(stack[t+1], inst->q) || !isValidRange(stack[t+2], inst->q)) {
+	ps = PS_INVALID_INSTRUCTION;
+	break;
+      }
+      memmove(stack + stack[t+1], stack + stack[t+2], inst->q * sizeof(WORD));
+      break;
+    case OP_LD:
+      if ((stack[t] < 0) || (stack[t] >= codeBlock->dataSize))
+	ps = PS_INDEX_OUT_OF_RANGE;
+      else stack[t] = data[stack[t]];
+      break;
+    case OP_JT:
+      // Values out of the table take its last J
+      if ((stack[t] >= inst->p) && ((UWORD) stack[t] - (UWORD) inst->p < (UWORD) inst->q))
+	k = stack[t] - inst->p;
+      else k = inst->q;
+      t --;
+      if ((inst->q < 0) || (pc + 1 + inst->q >= codeBlock->codeSize)) {
+	ps = PS_INVALID_INSTRUCTION;
+	break;
+      }
+      pc = code[pc + 1 + k].q - 1;
+      break;
+    case OP_BP:
+      break;
+    default:
+      ps = PS_INVALID_INSTRUCTION;
+      break;
+    }
+    pc ++;
+  }
+
+  fflush(stdout);
+  return ps;
+}
+
+void printStatistics(void) {
+  int i;
+
+  printf("instructions: %lld\n", statistics.instructionCount);
+  printf("peak stack: %d\n", statistics.peakStack);
+  for (i = 0; i <= OP_BP; i ++)
+    if (statistics.opcodeCount[i] > 0)
+      printf("  %s: %lld\n", opCodeToString(i), statistics.opcodeCount[i]);
+}
+
+// The errors give the address of the instruction, and its source line
+// when the executable has a line table
+void printStatus(void) {
+  CodeAddress address = pc - 1;
+
+  switch (ps) {
+  case PS_IO_ERROR:
+    printf("IO error at %d", address);
+    break;
+  case PS_STACK_OVERFLOW:
+    address = pc;
+    printf("Stack overflow at %d", address);
+    break;
+  case PS_DIVIDE_BY_ZERO:
+    printf("Divide by zero at %d", address);
+    break;
+  case PS_INVALID_INSTRUCTION:
+    address = pc;
+    printf("Invalid instruction at %d", address);
+    break;
+  case PS_INDEX_OUT_OF_RANGE:
+    printf("Index out of range at %d", address);
+    break;
+  case PS_ARITHMETIC_OVERFLOW:
+    printf("Arithmetic overflow at %d", address);
+    break;
+  default:
+    return;
+  }
+  if ((address >= 0) && (address < codeBlock->codeSize) && (codeBlock->lines[address] > 0))
+    printf(", line %d", codeBlock->lines[address]);
+  printf(".\n");
+}
+
+void dumpExecutable(void) {
+  printCodeBlock(codeBlock);
+}
@@ -0,0 +1,49 @@
+#ifndef __VM_H__
+#define __VM_H__
+
+#include <stdio.h>
+#include "instructions.h"
+
+#define DEFAULT_STACK_SIZE 100000
+
+// Processor status
+#define PS_INACTIVE 0
+#define PS_ACTIVE 1
+#define PS_NORMAL_EXIT 2
+#define PS_IO_ERROR 3
+#define PS_STACK_OVERFLOW 4
+#define PS_DIVIDE_BY_ZERO 5
+#define PS_INVALID_INSTRUCTION 6
+#define PS_INDEX_OUT_OF_RANGE 7
+#define PS_ARITHMETIC_OVERFLOW 8
+
+// Words kept free above the stack limit, so that a single instruction
+// may write a few words past the top before the overflow is detected
+#define STACK_SAFETY_WORDS 8
+
+// Entries of the memo table of the functions compiled with MC and MS
+#define MEMO_TABLE_SIZE 65536
+
+struct VMStatistics_ {
+  long long instructionCount;
+  long long opcodeCount[OP_BP + 1];
+  int peakStack;
+};
+
+typedef struct VMStatistics_ VMStatistics;
+
+int initVM(int stackSize);
+void cleanVM(void);
+
+int loadExecutable(FILE* f);
+// Replace the arithmetic instructions of the code loaded with their
+// checked variants
+void enableCheckedArithmetic(void);
+int run(void);
+
+void enableStatistics(void);
+void printStatistics(void);
+void printStatus(void);
+void dumpExecutable(void);
+
+#endif